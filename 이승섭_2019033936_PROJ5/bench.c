@@ -0,0 +1,289 @@
+/*
+ * Copyright(c) 2021-2023 All rights reserved by Heekuck Oh.
+ * 이 프로그램은 한양대학교 ERICA 컴퓨터학부 학생을 위한 교육용으로 제작되었다.
+ * 한양대학교 ERICA 학생이 아닌 이는 프로그램을 수정하거나 배포할 수 없다.
+ * 프로그램을 수정할 경우 날짜, 학과, 학번, 이름, 수정 내용을 기록한다.
+ * 10월 17일 컴퓨터학부 2019033936 이승섭 - 스레드풀 성능 측정 프로그램 작성
+ *
+ * 일꾼 수, 대기열 크기, 작업 길이(빈 작업, 1µs, 100µs), 요청 스레드 수를 바꿔 가며 스레드풀의 처리량과
+ * 지연 시간을 재고, 스레드풀의 생성과 종료에 드는 시간도 잰다. 결과는 한 줄에 측정 하나씩 CSV로 표준 출력에 쓰므로
+ * 파일로 받아 두었다가 버전끼리 비교하면 된다. 진행 상황은 표준 에러로 나온다.
+ *
+ * proj5.zip의 Makefile에 다음 규칙을 더해서 make bench로 만든다.
+ *
+ *     bench: bench.o pthread_pool.o
+ *         $(CC) -o bench bench.o pthread_pool.o $(CLIBS)
+ *
+ *     bench.o: bench.c pthread_pool.h
+ *         $(CC) $(CFLAGS) -c bench.c
+ *
+ * 사용법: ./bench [-q] [-m fifo|steal|lockfree|steal,lockfree] > result.csv
+ *     -q  측정 조합과 작업 수를 줄여 빨리 끝낸다.
+ *     -m  작업 배분 방식과 대기열 구현을 고른다. 기본값은 fifo이다.
+ *
+ * 열의 뜻은 다음과 같으며 시간은 모두 나노초이다.
+ *     kind        throughput이면 처리량 측정, lifecycle이면 생성과 종료 시간 측정
+ *     tasks_per_sec  요청을 시작해서 모든 작업이 끝날 때까지의 초당 작업 수
+ *     submit_*    pthread_pool_submit() 호출 한 번에 걸린 시간의 백분위수
+ *     wait_*      작업을 넣은 뒤 일꾼이 실행을 시작할 때까지 걸린 시간의 백분위수
+ *     run_*       작업을 실행하는 데 걸린 시간의 백분위수
+ *     init_ns, shutdown_ns  pthread_pool_init_attr()과 pthread_pool_shutdown()에 걸린 시간의 평균
+ * wait_*와 run_*는 통계를 켠 스레드풀의 히스토그램에서 읽으므로 상대 오차가 1/8 안이다.
+ * 처리량과 submit_*는 통계를 끈 스레드풀에서 따로 잰다.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include "pthread_pool.h"
+
+#define MAXPROD 8
+#define LIFECYCLE_LOOP 50
+
+/*
+ * 측정 하나의 조건이다.
+ */
+struct config {
+    int bees;               /* 일꾼 수 */
+    int qsize;              /* 대기열 크기 */
+    long work_ns;           /* 작업 하나가 일하는 시간 */
+    int producers;          /* 작업을 요청하는 스레드 수 */
+    long tasks;             /* 요청할 작업의 수 */
+};
+
+/*
+ * 요청 스레드 하나가 쓰는 정보이다. lat이 NULL이 아니면 호출마다 걸린 시간을 모은다.
+ */
+struct producer {
+    pthread_t tid;
+    pthread_pool_t *pool;
+    long work_ns;
+    long n;
+    long *lat;
+};
+
+static const char *const modes[] = { "fifo", "steal", "lockfree", "steal,lockfree" };  /* -m으로 고를 수 있는 값 */
+static pthread_pool_attr_t base_attr;   /* -m으로 고른 속성 */
+static atomic_long done;                /* 끝난 작업의 수 */
+
+/*
+ * CLOCK_MONOTONIC 기준의 현재 시각을 나노초로 리턴한다.
+ */
+static long now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long)ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+/*
+ * 인자로 받은 시간(나노초)만큼 CPU를 쓰며 일하고 끝난 작업의 수를 올린다. 0이면 바로 끝나는 빈 작업이다.
+ */
+static void work(void *param)
+{
+    long ns = (long)param;
+
+    if (ns > 0) {
+        long end = now_ns() + ns;
+        while (now_ns() < end)
+            ;
+    }
+    atomic_fetch_add_explicit(&done, 1, memory_order_relaxed);
+}
+
+/*
+ * 요청 스레드가 수행할 함수이다. 작업을 n개 요청하며 호출 한 번마다 걸린 시간을 잰다.
+ */
+static void *produce(void *param)
+{
+    struct producer *p = (struct producer *)param;
+
+    for (long i = 0; i < p->n; i++) {
+        if (p->lat == NULL) {
+            pthread_pool_submit(p->pool, work, (void *)p->work_ns, POOL_WAIT);
+            continue;
+        }
+        long t = now_ns();
+        pthread_pool_submit(p->pool, work, (void *)p->work_ns, POOL_WAIT);
+        p->lat[i] = now_ns() - t;
+    }
+    return NULL;
+}
+
+static int cmp_long(const void *a, const void *b)
+{
+    long x = *(const long *)a, y = *(const long *)b;
+
+    return (x > y) - (x < y);
+}
+
+/*
+ * 정렬된 n개의 값 v에서 p(0에서 100 사이) 백분위수를 리턴한다.
+ */
+static long percentile(const long *v, long n, double p)
+{
+    long i = (long)(n * p / 100.0);
+
+    if (n == 0)
+        return 0;
+    return v[i < n ? i : n - 1];
+}
+
+/*
+ * 조건 c로 스레드풀을 만들고 요청 스레드들이 작업을 모두 요청한 뒤 끝날 때까지 기다린다.
+ * stats가 true이면 스레드풀의 통계를 켜고 끝난 뒤의 통계를 st에 담는다. 요청을 시작해서 모든 작업이 끝날 때까지의
+ * 시간을 리턴하며, lat이 NULL이 아니면 호출마다 걸린 시간을 담는다. 스레드풀을 만들지 못하면 -1을 리턴한다.
+ */
+static long run_once(const struct config *c, bool stats, long *lat, pool_stats_t *st)
+{
+    pthread_pool_t pool;
+    pthread_pool_attr_t attr = base_attr;
+    struct producer prod[MAXPROD];
+
+    attr.stats = stats;
+    if (pthread_pool_init_attr(&pool, c->bees, c->qsize, &attr) != POOL_SUCCESS)
+        return -1;
+    atomic_store(&done, 0);
+
+    long start = now_ns(), each = c->tasks / c->producers;
+    for (int i = 0; i < c->producers; i++) {
+        prod[i].pool = &pool;
+        prod[i].work_ns = c->work_ns;
+        prod[i].n = each;
+        prod[i].lat = lat != NULL ? lat + i * each : NULL;
+        pthread_create(&prod[i].tid, NULL, produce, &prod[i]);
+    }
+    for (int i = 0; i < c->producers; i++)
+        pthread_join(prod[i].tid, NULL);
+    while (atomic_load_explicit(&done, memory_order_relaxed) < each * c->producers)
+        sched_yield();
+    long elapsed = now_ns() - start;
+
+    if (st != NULL)
+        pthread_pool_stats(&pool, st);
+    pthread_pool_shutdown(&pool, POOL_COMPLETE);
+    return elapsed;
+}
+
+/*
+ * 조건 c의 처리량과 지연 시간을 재서 한 줄로 출력한다.
+ * 처리량과 호출 시간은 통계를 끈 스레드풀로, 대기 시간과 실행 시간의 분포는 통계를 켠 스레드풀로 따로 잰다.
+ */
+static void bench_throughput(const char *mode, const struct config *c)
+{
+    long *lat = (long *)malloc(c->tasks * sizeof(long));
+    pool_stats_t *st = (pool_stats_t *)malloc(sizeof(pool_stats_t));
+    long n = c->tasks / c->producers * c->producers;
+
+    if (lat == NULL || st == NULL) {
+        fprintf(stderr, "bench: out of memory\n");
+        exit(1);
+    }
+    long elapsed = run_once(c, false, lat, NULL);
+    if (elapsed < 0 || run_once(c, true, NULL, st) < 0) {
+        fprintf(stderr, "bench: pthread_pool_init_attr failed (bees=%d qsize=%d)\n", c->bees, c->qsize);
+        exit(1);
+    }
+    elapsed = elapsed > 0 ? elapsed : 1;
+    qsort(lat, n, sizeof(long), cmp_long);
+
+    printf("throughput,%s,%d,%d,%ld,%d,%ld,%.0f,%ld,%ld,%ld,%lu,%lu,%lu,%lu,%lu,%lu,0,0\n",
+           mode, c->bees, c->qsize, c->work_ns, c->producers, n, n * 1e9 / elapsed,
+           percentile(lat, n, 50), percentile(lat, n, 99), percentile(lat, n, 99.9),
+           pthread_pool_hist_percentile(st->wait_hist, 50), pthread_pool_hist_percentile(st->wait_hist, 99),
+           pthread_pool_hist_percentile(st->wait_hist, 99.9), pthread_pool_hist_percentile(st->run_hist, 50),
+           pthread_pool_hist_percentile(st->run_hist, 99), pthread_pool_hist_percentile(st->run_hist, 99.9));
+    fflush(stdout);
+    free(st);
+    free(lat);
+}
+
+/*
+ * 일꾼 bees명과 크기 qsize의 대기열로 스레드풀을 만들었다가 바로 종료하기를 여러 번 되풀이해서
+ * 생성과 종료에 걸린 평균 시간을 한 줄로 출력한다.
+ */
+static void bench_lifecycle(const char *mode, int bees, int qsize)
+{
+    long init = 0, fini = 0;
+
+    for (int i = 0; i < LIFECYCLE_LOOP; i++) {
+        pthread_pool_t pool;
+        long t0 = now_ns();
+        if (pthread_pool_init_attr(&pool, bees, qsize, &base_attr) != POOL_SUCCESS) {
+            fprintf(stderr, "bench: pthread_pool_init_attr failed (bees=%d qsize=%d)\n", bees, qsize);
+            exit(1);
+        }
+        long t1 = now_ns();
+        pthread_pool_shutdown(&pool, POOL_COMPLETE);
+        long t2 = now_ns();
+        init += t1 - t0;
+        fini += t2 - t1;
+    }
+    printf("lifecycle,%s,%d,%d,0,0,0,0,0,0,0,0,0,0,0,0,0,%ld,%ld\n",
+           mode, bees, qsize, init / LIFECYCLE_LOOP, fini / LIFECYCLE_LOOP);
+    fflush(stdout);
+}
+
+int main(int argc, char *argv[])
+{
+    static const int bees_full[] = { 1, 2, 4, 8, 16 }, bees_quick[] = { 1, 4 };
+    static const int qsize_full[] = { 16, 256, 1024 }, qsize_quick[] = { 256 };
+    static const long work_ns[] = { 0, 1000, 100000 };
+    static const int prod_full[] = { 1, 4 }, prod_quick[] = { 1, 4 };
+    const char *mode = "fifo";
+    bool quick = false, known;
+    int opt;
+
+    //CSV의 mode 열에 그대로 쓰이므로 설명한 네 가지 값이 아니면 받지 않는다.
+    while ((opt = getopt(argc, argv, "qm:")) != -1) {
+        known = true;
+        if (opt == 'q')
+            quick = true;
+        else if (opt == 'm') {
+            mode = optarg;
+            known = false;
+            for (size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); i++)
+                if (strcmp(mode, modes[i]) == 0)
+                    known = true;
+        }
+        else
+            known = false;
+        if (!known) {
+            fprintf(stderr, "usage: %s [-q] [-m fifo|steal|lockfree|steal,lockfree]\n", argv[0]);
+            return 1;
+        }
+    }
+    pthread_pool_attr_init(&base_attr);
+    if (strstr(mode, "steal") != NULL)
+        base_attr.sched = POOL_SCHED_STEAL;
+    if (strstr(mode, "lockfree") != NULL)
+        base_attr.queue = POOL_QUEUE_LOCKFREE;
+
+    const int *bees = quick ? bees_quick : bees_full, *qsize = quick ? qsize_quick : qsize_full;
+    const int *prod = quick ? prod_quick : prod_full;
+    int nbees = quick ? 2 : 5, nqsize = quick ? 1 : 3, nprod = 2;
+
+    printf("kind,mode,bees,qsize,work_ns,producers,tasks,tasks_per_sec,"
+           "submit_p50,submit_p99,submit_p999,wait_p50,wait_p99,wait_p999,run_p50,run_p99,run_p999,init_ns,shutdown_ns\n");
+
+    //작업이 길수록 작업 수를 줄여 조합마다 걸리는 시간을 비슷하게 맞춘다.
+    for (int b = 0; b < nbees; b++)
+        for (int q = 0; q < nqsize; q++)
+            for (int w = 0; w < 3; w++)
+                for (int p = 0; p < nprod; p++) {
+                    struct config c = { bees[b], qsize[q], work_ns[w], prod[p], 0 };
+                    c.tasks = work_ns[w] == 0 ? 200000 : work_ns[w] < 10000 ? 50000 : 2000;
+                    if (quick)
+                        c.tasks /= 10;
+                    fprintf(stderr, "bench: %s bees=%d qsize=%d work=%ldns producers=%d\n",
+                            mode, c.bees, c.qsize, c.work_ns, c.producers);
+                    bench_throughput(mode, &c);
+                }
+
+    for (int b = 0; b < nbees; b++)
+        bench_lifecycle(mode, bees[b], quick ? 256 : 1024);
+    return 0;
+}
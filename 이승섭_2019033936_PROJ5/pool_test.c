@@ -0,0 +1,1071 @@
+/*
+ * Copyright(c) 2021-2023 All rights reserved by Heekuck Oh.
+ * 이 프로그램은 한양대학교 ERICA 컴퓨터학부 학생을 위한 교육용으로 제작되었다.
+ * 한양대학교 ERICA 학생이 아닌 이는 프로그램을 수정하거나 배포할 수 없다.
+ * 프로그램을 수정할 경우 날짜, 학과, 학번, 이름, 수정 내용을 기록한다.
+ * 10월 18일 컴퓨터학부 2019033936 이승섭 - 스레드풀 기능 시험 프로그램 작성
+ *
+ * 스레드풀의 기능이 약속한 대로 동작하는지 스스로 확인하는 시험 프로그램이다. 결과를 눈으로 비교할 필요 없이
+ * 어긋나는 곳이 있으면 assert()가 파일과 줄을 알리고 멈추므로, 종료 코드가 0이면 모든 시험을 통과한 것이다.
+ * 덱이나 락 없는 대기열처럼 밖으로 드러나지 않는 부분도 직접 시험하도록 pthread_pool.c를 함께 포함해서 만든다.
+ *
+ * proj5.zip의 Makefile에 다음 규칙을 더해서 make check로 만들고 실행한다.
+ *
+ *     check: pool_test
+ *         ./pool_test
+ *
+ *     pool_test: pool_test.c pthread_pool.c pthread_pool.h
+ *         $(CC) $(CFLAGS) -o pool_test pool_test.c $(CLIBS)
+ *
+ * 사용법: ./pool_test [이름...]
+ *     이름을 주면 그 시험만 실행한다. 진행 상황은 표준 에러로 나온다.
+ */
+//일꾼 스레드를 만들지 못하는 경우를 시험할 수 있도록 pthread_pool.c가 부르는 pthread_create()를 가로챈다.
+#define _GNU_SOURCE
+#include <pthread.h>
+#define pthread_create pool_test_create
+static int pool_test_create(pthread_t *tid, const pthread_attr_t *attr, void *(*start)(void *), void *arg);
+#include "pthread_pool.c"
+#undef pthread_create
+#undef NDEBUG
+#include <assert.h>
+#include <fcntl.h>
+
+static atomic_bool create_fails;    /* true이면 스레드풀이 스레드를 만들지 못한다 */
+
+static int pool_test_create(pthread_t *tid, const pthread_attr_t *attr, void *(*start)(void *), void *arg)
+{
+    if (atomic_load(&create_fails))
+        return EAGAIN;
+    return pthread_create(tid, attr, start, arg);
+}
+
+#define DEQUE_TASKS 200000
+#define DEQUE_THIEVES 3
+#define RING_PRODUCERS 4
+#define RING_CONSUMERS 4
+#define RING_TASKS 100000
+#define STRANDS 8
+#define STRAND_TASKS 5000
+#define STRAND_BACKLOG 200
+#define STRAND_OTHERS 50
+#define TOKEN_TASKS 100
+#define FIBERS 16
+#define FIBER_STEPS 50
+#define FIBER_WAITERS 200
+#define IO_CHUNKS 16
+#define IO_CHUNK 4096
+#define DRR_SPIN_NS 20000
+#define DRAIN_TASKS 1000
+#define DRAIN_TIMEOUT_MS 20
+
+/*
+ * 덱 시험에서 주인과 도둑이 함께 쓰는 정보이다. seen은 작업마다 몇 번 꺼냈는지를 센다.
+ */
+struct deque_test {
+    struct bee bee;
+    atomic_bool done;
+    atomic_long taken;
+    atomic_uchar *seen;
+};
+
+/*
+ * 작업 task를 꺼냈다고 적는다. 같은 작업을 두 번 꺼냈으면 멈춘다.
+ */
+static void deque_mark(struct deque_test *t, const task_t *task)
+{
+    long i = (long)task->param;
+
+    assert(i >= 0 && i < DEQUE_TASKS);
+    assert(atomic_fetch_add(&t->seen[i], 1) == 0);
+    atomic_fetch_add(&t->taken, 1);
+}
+
+/*
+ * 도둑 스레드가 수행할 함수이다. 주인이 다 넣고 덱이 빌 때까지 훔친다.
+ */
+static void *deque_thief(void *param)
+{
+    struct deque_test *t = (struct deque_test *)param;
+    task_t task;
+
+    while (!atomic_load(&t->done) || deque_nonempty(&t->bee)) {
+        if (deque_steal(&t->bee, &task))
+            deque_mark(t, &task);
+        else
+            sched_yield();
+    }
+    return NULL;
+}
+
+/*
+ * Chase-Lev 덱에 주인이 넣고 꺼내는 동안 도둑 여럿이 함께 훔쳐도 모든 작업이 정확히 한 번씩 나오는지 확인한다.
+ * 덱을 작게 시작해서 도둑이 읽는 도중에 버퍼가 커지는 경우도 거친다.
+ */
+static void test_deque(void)
+{
+    struct deque_test t;
+    pthread_t thief[DEQUE_THIEVES];
+    task_t task = { 0 };
+
+    memset(&t, 0, sizeof(t));
+    atomic_init(&t.bee.buf, deque_buf_alloc(4));
+    t.seen = (atomic_uchar *)calloc(DEQUE_TASKS, sizeof(atomic_uchar));
+    assert(t.seen != NULL);
+    for (int i = 0; i < DEQUE_THIEVES; i++)
+        assert(pthread_create(&thief[i], NULL, deque_thief, &t) == 0);
+
+    //세 개를 넣을 때마다 하나를 꺼내서 주인의 꺼내기와 도둑의 훔치기가 마지막 작업을 두고 다투게 한다.
+    for (long i = 0; i < DEQUE_TASKS; i++) {
+        task.param = (void *)i;
+        assert(deque_push(&t.bee, &task));
+        if (i % 3 == 2 && deque_pop(&t.bee, &task))
+            deque_mark(&t, &task);
+    }
+    while (deque_pop(&t.bee, &task))
+        deque_mark(&t, &task);
+    atomic_store(&t.done, true);
+    for (int i = 0; i < DEQUE_THIEVES; i++)
+        pthread_join(thief[i], NULL);
+
+    assert(atomic_load(&t.taken) == DEQUE_TASKS);
+    for (long i = 0; i < DEQUE_TASKS; i++)
+        assert(atomic_load(&t.seen[i]) == 1);
+    for (struct deque_buf *d = atomic_load(&t.bee.buf), *prev; d != NULL; d = prev) {
+        prev = d->prev;
+        free(d);
+    }
+    free(t.seen);
+}
+
+/*
+ * 락 없는 대기열 시험에서 생산자와 소비자가 함께 쓰는 정보이다. 작업의 param에는 생산자 번호와 생산자 안의 순번을 담는다.
+ */
+struct ring_test {
+    struct ring *ring;
+    atomic_int producers;
+    atomic_long taken;
+    atomic_uchar *seen;
+};
+
+struct ring_producer {
+    struct ring_test *t;
+    long id;
+};
+
+/*
+ * 생산자 스레드가 수행할 함수이다. 한 개씩 넣기와 여러 개 한꺼번에 넣기를 번갈아 쓰며 순번대로 작업을 넣는다.
+ */
+static void *ring_producer(void *param)
+{
+    struct ring_producer *p = (struct ring_producer *)param;
+    task_t tasks[7] = { 0 };
+    long i = 0;
+
+    while (i < RING_TASKS) {
+        size_t n = i % 2 ? 1 : sizeof(tasks) / sizeof(tasks[0]);
+        if (n > (size_t)(RING_TASKS - i))
+            n = RING_TASKS - i;
+        for (size_t k = 0; k < n; k++)
+            tasks[k].param = (void *)(p->id * RING_TASKS + i + k);
+        size_t put = n == 1 ? ring_push(p->t->ring, &tasks[0]) : ring_push_many(p->t->ring, tasks, n);
+        if (put == 0)
+            sched_yield();
+        i += put;
+    }
+    atomic_fetch_sub(&p->t->producers, 1);
+    return NULL;
+}
+
+/*
+ * 소비자 스레드가 수행할 함수이다. 생산자가 모두 끝나고 대기열이 빌 때까지 최대 5개씩 꺼낸다.
+ * 한 소비자가 꺼낸 작업은 생산자마다 넣은 순서를 지켜야 한다.
+ */
+static void *ring_consumer(void *param)
+{
+    struct ring_test *t = (struct ring_test *)param;
+    long last[RING_PRODUCERS];
+    task_t tasks[5];
+
+    for (int i = 0; i < RING_PRODUCERS; i++)
+        last[i] = -1;
+    while (atomic_load(&t->producers) > 0 || ring_nonempty(t->ring)) {
+        size_t n = ring_pop_many(t->ring, tasks, 5);
+        if (n == 0)
+            sched_yield();
+        for (size_t k = 0; k < n; k++) {
+            long v = (long)tasks[k].param, id = v / RING_TASKS, seq = v % RING_TASKS;
+            assert(id >= 0 && id < RING_PRODUCERS);
+            assert(seq > last[id]);
+            last[id] = seq;
+            assert(atomic_fetch_add(&t->seen[v], 1) == 0);
+            atomic_fetch_add(&t->taken, 1);
+        }
+    }
+    return NULL;
+}
+
+/*
+ * 크기가 작은 Vyukov 원형 버퍼에 생산자 여럿이 넣고 소비자 여럿이 꺼내도 모든 작업이 정확히 한 번씩 나오고
+ * 생산자마다 넣은 순서가 지켜지는지 확인한다. 버퍼가 자주 꽉 차고 비도록 크기를 2의 거듭제곱이 아닌 값으로 작게 잡는다.
+ */
+static void test_ring(void)
+{
+    struct ring_test t;
+    struct ring_producer prod[RING_PRODUCERS];
+    pthread_t ptid[RING_PRODUCERS], ctid[RING_CONSUMERS];
+
+    t.ring = ring_alloc(37);
+    assert(t.ring != NULL);
+    atomic_init(&t.producers, RING_PRODUCERS);
+    atomic_init(&t.taken, 0);
+    t.seen = (atomic_uchar *)calloc((size_t)RING_PRODUCERS * RING_TASKS, sizeof(atomic_uchar));
+    assert(t.seen != NULL);
+    for (int i = 0; i < RING_CONSUMERS; i++)
+        assert(pthread_create(&ctid[i], NULL, ring_consumer, &t) == 0);
+    for (int i = 0; i < RING_PRODUCERS; i++) {
+        prod[i].t = &t;
+        prod[i].id = i;
+        assert(pthread_create(&ptid[i], NULL, ring_producer, &prod[i]) == 0);
+    }
+    for (int i = 0; i < RING_PRODUCERS; i++)
+        pthread_join(ptid[i], NULL);
+    for (int i = 0; i < RING_CONSUMERS; i++)
+        pthread_join(ctid[i], NULL);
+
+    assert(atomic_load(&t.taken) == (long)RING_PRODUCERS * RING_TASKS);
+    assert(!ring_nonempty(t.ring));
+    ring_free(t.ring);
+    free(t.seen);
+}
+
+/*
+ * 스트랜드 하나의 시험 상태이다. next는 다음에 실행되어야 할 순번이고, running은 이 스트랜드의 작업이 실행 중이면 true이다.
+ */
+struct strand_state {
+    pool_strand_t strand;
+    long next;
+    atomic_bool running;
+};
+
+struct strand_item {
+    struct strand_state *s;
+    long seq;
+};
+
+/*
+ * 스트랜드의 작업이다. 같은 스트랜드의 다른 작업과 겹쳐 실행되지 않고 넣은 순서대로 실행되는지 확인한다.
+ */
+static void strand_step(void *param)
+{
+    struct strand_item *item = (struct strand_item *)param;
+    struct strand_state *s = item->s;
+
+    assert(!atomic_exchange(&s->running, true));
+    assert(s->next == item->seq);
+    s->next++;
+    atomic_store(&s->running, false);
+}
+
+struct strand_submitter {
+    struct strand_state *s;
+    struct strand_item *items;
+};
+
+/*
+ * 요청 스레드가 수행할 함수이다. 맡은 두 스트랜드에 번갈아 가며 순번대로 작업을 넣는다.
+ */
+static void *strand_submitter(void *param)
+{
+    struct strand_submitter *sub = (struct strand_submitter *)param;
+
+    for (long i = 0; i < STRAND_TASKS; i++)
+        for (int k = 0; k < 2; k++) {
+            struct strand_item *item = &sub->items[k * STRAND_TASKS + i];
+            item->s = &sub->s[k];
+            item->seq = i;
+            assert(pthread_pool_strand_submit(&sub->s[k].strand, strand_step, item) == POOL_SUCCESS);
+        }
+    return NULL;
+}
+
+/*
+ * 요청 스레드 넷이 스트랜드 여덟 개에 작업을 넣을 때 스트랜드마다 작업이 넣은 순서대로 하나씩만 실행되는지 확인한다.
+ * 공유 대기열 방식과 작업 훔치기 방식을 모두 시험한다.
+ */
+static void test_strand_order(void)
+{
+    for (int sched = POOL_SCHED_FIFO; sched <= POOL_SCHED_STEAL; sched++) {
+        pthread_pool_t pool;
+        pthread_pool_attr_t attr;
+        struct strand_state s[STRANDS];
+        struct strand_submitter sub[STRANDS / 2];
+        pthread_t tid[STRANDS / 2];
+        struct strand_item *items = (struct strand_item *)malloc(sizeof(struct strand_item) * STRANDS * STRAND_TASKS);
+
+        assert(items != NULL);
+        pthread_pool_attr_init(&attr);
+        attr.sched = sched;
+        assert(pthread_pool_init_attr(&pool, 4, 64, &attr) == POOL_SUCCESS);
+        for (int i = 0; i < STRANDS; i++) {
+            assert(pthread_pool_strand_init(&s[i].strand, &pool, 1 + i % 3) == POOL_SUCCESS);
+            s[i].next = 0;
+            atomic_init(&s[i].running, false);
+        }
+        for (int i = 0; i < STRANDS / 2; i++) {
+            sub[i].s = &s[2 * i];
+            sub[i].items = &items[2 * i * STRAND_TASKS];
+            assert(pthread_create(&tid[i], NULL, strand_submitter, &sub[i]) == 0);
+        }
+        for (int i = 0; i < STRANDS / 2; i++)
+            pthread_join(tid[i], NULL);
+        for (int i = 0; i < STRANDS; i++) {
+            assert(pthread_pool_strand_wait(&s[i].strand) == POOL_SUCCESS);
+            assert(s[i].next == STRAND_TASKS);
+            assert(pthread_pool_strand_destroy(&s[i].strand) == POOL_SUCCESS);
+        }
+        assert(pthread_pool_shutdown(&pool, POOL_COMPLETE) == POOL_SUCCESS);
+        free(items);
+    }
+}
+
+static atomic_bool strand_gate;     /* 스트랜드의 첫 작업을 붙잡아 두는 문 */
+static atomic_long strand_ran;      /* 스트랜드에서 실행된 작업의 수 */
+static atomic_long others_ran;      /* 스트랜드와 상관없는 작업이 실행된 수 */
+static atomic_long others_seen;     /* 상관없는 작업이 실행될 때 본 strand_ran의 최댓값 */
+
+static void strand_backlog(void *param)
+{
+    if (atomic_load(&strand_ran) == 0)
+        while (!atomic_load(&strand_gate))
+            sched_yield();
+    atomic_fetch_add(&strand_ran, 1);
+}
+
+static void strand_other(void *param)
+{
+    long seen = atomic_load(&strand_ran), max = atomic_load(&others_seen);
+
+    while (seen > max && !atomic_compare_exchange_weak(&others_seen, &max, seen))
+        ;
+    atomic_fetch_add(&others_ran, 1);
+}
+
+/*
+ * 작업 훔치기 모드에서 batch가 1인 스트랜드에 작업이 잔뜩 밀려 있어도, 스트랜드가 차례마다 공유 대기열 뒤로 가서
+ * 그 사이에 들어온 다른 작업이 먼저 실행되는지 확인한다. 일꾼을 하나만 두어 실행 순서가 정해지게 한다.
+ * 스트랜드의 첫 작업을 붙잡아 둔 동안 나머지 작업과 상관없는 작업을 넣고 놓아준다.
+ */
+static void test_strand_steal(void)
+{
+    pthread_pool_t pool;
+    pthread_pool_attr_t attr;
+    pool_strand_t strand;
+
+    pthread_pool_attr_init(&attr);
+    attr.sched = POOL_SCHED_STEAL;
+    assert(pthread_pool_init_attr(&pool, 1, 256, &attr) == POOL_SUCCESS);
+    assert(pthread_pool_strand_init(&strand, &pool, 1) == POOL_SUCCESS);
+    for (int i = 0; i < STRAND_BACKLOG; i++)
+        assert(pthread_pool_strand_submit(&strand, strand_backlog, NULL) == POOL_SUCCESS);
+    for (int i = 0; i < STRAND_OTHERS; i++)
+        assert(pthread_pool_submit(&pool, strand_other, NULL, POOL_WAIT) == POOL_SUCCESS);
+    atomic_store(&strand_gate, true);
+
+    //pthread_pool_strand_wait()는 기다리는 동안 작업을 대신 실행하므로, 순서를 흐리지 않도록 일꾼이 모두 마칠 때까지 잠만 잔다.
+    while (atomic_load(&strand_ran) < STRAND_BACKLOG || atomic_load(&others_ran) < STRAND_OTHERS)
+        usleep(1000);
+    assert(pthread_pool_strand_wait(&strand) == POOL_SUCCESS);
+
+    //붙잡혀 있던 첫 작업이 끝나면 스트랜드는 기다리던 작업 뒤로 가므로 그 작업들은 스트랜드의 작업을 많아야 하나 더 본다.
+    assert(atomic_load(&others_seen) <= 2);
+    assert(pthread_pool_strand_destroy(&strand) == POOL_SUCCESS);
+    assert(pthread_pool_shutdown(&pool, POOL_COMPLETE) == POOL_SUCCESS);
+}
+
+static atomic_bool token_gate;      /* 하나뿐인 일꾼을 붙잡아 두는 문 */
+static atomic_long token_ran;       /* 토큰을 붙인 작업이 실행된 수 */
+static atomic_bool token_stopped;   /* 실행 중인 작업이 취소를 알아챘으면 true */
+
+static void token_hold(void *param)
+{
+    while (!atomic_load(&token_gate))
+        sched_yield();
+}
+
+static void token_work(void *param)
+{
+    atomic_fetch_add(&token_ran, 1);
+}
+
+/*
+ * 토큰이 만료될 때까지 돌다가 pthread_pool_canceled()가 true가 되면 그만둔다.
+ */
+static void token_spin(void *param)
+{
+    atomic_fetch_add(&token_ran, 1);
+    while (!pthread_pool_canceled())
+        sched_yield();
+    atomic_store(&token_stopped, true);
+}
+
+/*
+ * 일꾼 하나를 붙잡아 둔 스레드풀을 만들어 토큰을 붙인 작업을 넣은 뒤 prepare로 토큰을 다루고 일꾼을 놓아준다.
+ * 모든 작업이 끝날 때까지 기다린 다음 실행된 작업의 수를 리턴하며, 버린 작업의 수는 canceled에 담는다.
+ */
+static long token_run(pool_token_t *token, void (*prepare)(pool_token_t *token), unsigned long *canceled)
+{
+    pthread_pool_t pool;
+    pool_stats_t st;
+
+    atomic_store(&token_gate, false);
+    atomic_store(&token_ran, 0);
+    assert(pthread_pool_init(&pool, 1, 256) == POOL_SUCCESS);
+    assert(pthread_pool_submit(&pool, token_hold, NULL, POOL_WAIT) == POOL_SUCCESS);
+    for (int i = 0; i < TOKEN_TASKS; i++)
+        assert(pthread_pool_submit_token(&pool, token_work, NULL, token, POOL_WAIT) == POOL_SUCCESS);
+    prepare(token);
+    atomic_store(&token_gate, true);
+    do {
+        usleep(1000);
+        assert(pthread_pool_stats(&pool, &st) == POOL_SUCCESS);
+    } while (atomic_load(&token_ran) + (long)st.canceled < TOKEN_TASKS);
+    assert(pthread_pool_shutdown(&pool, POOL_COMPLETE) == POOL_SUCCESS);
+    *canceled = st.canceled;
+    return atomic_load(&token_ran);
+}
+
+static void token_prepare_none(pool_token_t *token)
+{
+}
+
+static void token_prepare_cancel(pool_token_t *token)
+{
+    pthread_pool_token_cancel(token);
+}
+
+static void token_prepare_short(pool_token_t *token)
+{
+    pthread_pool_token_deadline(token, 10);
+    usleep(30000);
+}
+
+static void token_prepare_long(pool_token_t *token)
+{
+    pthread_pool_token_deadline(token, 60000);
+}
+
+/*
+ * 취소 토큰과 기한을 확인한다. 취소하거나 기한이 지난 토큰의 작업은 하나도 실행되지 않고 canceled로 세며,
+ * 기한이 남은 토큰의 작업은 모두 실행된다. 실행 중인 작업은 pthread_pool_canceled()로 취소를 알아챈다.
+ * 그룹을 취소하면 아직 시작하지 않은 그룹의 작업도 끝난 것으로 세어 pthread_pool_group_wait()이 돌아온다.
+ */
+static void test_token(void)
+{
+    pool_token_t token;
+    unsigned long canceled;
+
+    pthread_pool_token_init(&token);
+    assert(token_run(&token, token_prepare_none, &canceled) == TOKEN_TASKS && canceled == 0);
+    pthread_pool_token_init(&token);
+    assert(token_run(&token, token_prepare_long, &canceled) == TOKEN_TASKS && canceled == 0);
+    assert(!pthread_pool_token_expired(&token));
+    pthread_pool_token_init(&token);
+    assert(token_run(&token, token_prepare_cancel, &canceled) == 0 && canceled == TOKEN_TASKS);
+    pthread_pool_token_init(&token);
+    assert(token_run(&token, token_prepare_short, &canceled) == 0 && canceled == TOKEN_TASKS);
+    assert(pthread_pool_token_expired(&token));
+
+    //실행 중인 작업은 멈추지 않고, 작업이 스스로 취소를 확인해서 그만둔다.
+    pthread_pool_t pool;
+    assert(pthread_pool_init(&pool, 2, 16) == POOL_SUCCESS);
+    pthread_pool_token_init(&token);
+    atomic_store(&token_ran, 0);
+    assert(pthread_pool_submit_token(&pool, token_spin, NULL, &token, POOL_WAIT) == POOL_SUCCESS);
+    while (atomic_load(&token_ran) == 0)
+        usleep(1000);
+    assert(!atomic_load(&token_stopped));
+    pthread_pool_token_cancel(&token);
+    assert(pthread_pool_shutdown(&pool, POOL_COMPLETE) == POOL_SUCCESS);
+    assert(atomic_load(&token_stopped));
+
+    //그룹을 취소하면 시작하지 않은 작업은 버려지고 기다림이 끝난다.
+    pool_group_t group;
+    assert(pthread_pool_init(&pool, 1, 256) == POOL_SUCCESS);
+    atomic_store(&token_gate, false);
+    atomic_store(&token_ran, 0);
+    assert(pthread_pool_submit(&pool, token_hold, NULL, POOL_WAIT) == POOL_SUCCESS);
+    assert(pthread_pool_group_init(&group, &pool) == POOL_SUCCESS);
+    for (int i = 0; i < TOKEN_TASKS; i++)
+        assert(pthread_pool_group_submit(&group, token_work, NULL) == POOL_SUCCESS);
+    pthread_pool_group_cancel(&group);
+    atomic_store(&token_gate, true);
+    assert(pthread_pool_group_wait(&group) == POOL_SUCCESS);
+    assert(atomic_load(&token_ran) == 0);
+    assert(pthread_pool_shutdown(&pool, POOL_COMPLETE) == POOL_SUCCESS);
+}
+
+static atomic_bool fiber_gate;      /* 하나뿐인 일꾼을 붙잡아 두는 문 */
+static atomic_int fiber_log[FIBERS * FIBER_STEPS];  /* 파이버가 한 걸음씩 실행된 순서 */
+static atomic_int fiber_pos;        /* fiber_log에 다음에 적을 자리 */
+static atomic_int fiber_done;       /* 끝난 파이버의 수 */
+
+static void fiber_hold(void *param)
+{
+    while (!atomic_load(&fiber_gate))
+        sched_yield();
+}
+
+/*
+ * 한 걸음마다 자기 번호를 적고 차례를 넘기는 파이버이다.
+ */
+static void fiber_steps(void *param)
+{
+    int id = (int)(long)param;
+
+    for (int i = 0; i < FIBER_STEPS; i++) {
+        fiber_log[atomic_fetch_add(&fiber_pos, 1)] = id;
+        assert(pthread_pool_yield() == POOL_SUCCESS);
+    }
+    atomic_fetch_add(&fiber_done, 1);
+}
+
+struct fiber_wait {
+    pthread_pool_t *pool;
+    int id;
+    int value;
+};
+
+static void fiber_double(void *param)
+{
+    struct fiber_wait *w = (struct fiber_wait *)param;
+
+    w->value = w->id * 2;
+}
+
+/*
+ * 다른 작업을 요청하고 그 작업의 완료를 기다리는 파이버이다. 기다리는 동안 일꾼을 붙잡지 않는다.
+ */
+static void fiber_waiter(void *param)
+{
+    struct fiber_wait *w = (struct fiber_wait *)param;
+    pool_future_t *fut;
+
+    assert(pthread_pool_submit_future(w->pool, fiber_double, w, POOL_WAIT, &fut) == POOL_SUCCESS);
+    assert(pthread_pool_future_wait(fut) == POOL_SUCCESS);
+    pthread_pool_future_release(fut);
+    assert(w->value == w->id * 2);
+    atomic_fetch_add(&fiber_done, 1);
+}
+
+/*
+ * 파이버를 확인한다. 일꾼이 하나뿐인 스레드풀에서 차례를 넘기는 파이버 여럿은 공유 대기열을 돌며 번갈아 실행되어야 하고,
+ * 같은 파이버가 두 번 이어 실행되면 안 된다. 작업 훔치기 모드에서도 차례를 넘긴 파이버가 자기 덱에서 바로 다시 나오지 않는다.
+ * 완료를 기다리는 파이버 수백 개도 일꾼 하나로 모두 끝나야 한다. 파이버 밖에서 차례를 넘기면 POOL_FAIL이다.
+ */
+static void test_fiber(void)
+{
+    assert(pthread_pool_yield() == POOL_FAIL);
+    for (int sched = POOL_SCHED_FIFO; sched <= POOL_SCHED_STEAL; sched++) {
+        pthread_pool_t pool;
+        pthread_pool_attr_t attr;
+
+        pthread_pool_attr_init(&attr);
+        attr.sched = sched;
+        assert(pthread_pool_init_attr(&pool, 1, 256, &attr) == POOL_SUCCESS);
+        atomic_store(&fiber_gate, false);
+        atomic_store(&fiber_pos, 0);
+        atomic_store(&fiber_done, 0);
+        assert(pthread_pool_submit(&pool, fiber_hold, NULL, POOL_WAIT) == POOL_SUCCESS);
+        for (long i = 0; i < FIBERS; i++)
+            assert(pthread_pool_submit_fiber(&pool, fiber_steps, (void *)i, POOL_WAIT) == POOL_SUCCESS);
+        atomic_store(&fiber_gate, true);
+        while (atomic_load(&fiber_done) < FIBERS)
+            usleep(1000);
+
+        int count[FIBERS] = { 0 };
+        assert(atomic_load(&fiber_pos) == FIBERS * FIBER_STEPS);
+        for (int i = 0; i < FIBERS * FIBER_STEPS; i++) {
+            count[fiber_log[i]]++;
+            assert(i == 0 || fiber_log[i] != fiber_log[i - 1]);
+        }
+        for (int i = 0; i < FIBERS; i++)
+            assert(count[i] == FIBER_STEPS);
+
+        struct fiber_wait w[FIBER_WAITERS];
+        atomic_store(&fiber_done, 0);
+        for (int i = 0; i < FIBER_WAITERS; i++) {
+            w[i].pool = &pool;
+            w[i].id = i;
+            w[i].value = -1;
+            assert(pthread_pool_submit_fiber(&pool, fiber_waiter, &w[i], POOL_WAIT) == POOL_SUCCESS);
+        }
+        while (atomic_load(&fiber_done) < FIBER_WAITERS)
+            usleep(1000);
+        assert(pthread_pool_shutdown(&pool, POOL_COMPLETE) == POOL_SUCCESS);
+    }
+}
+
+/*
+ * 입출력 요청 하나의 결과를 받는 곳이다. done은 완료 함수가 불렸으면 true이다.
+ */
+struct io_result {
+    atomic_bool done;
+    long res;
+};
+
+static void io_record(void *p, long res)
+{
+    struct io_result *r = (struct io_result *)p;
+
+    r->res = res;
+    atomic_store(&r->done, true);
+}
+
+/*
+ * 결과 n개가 모두 도착할 때까지 기다린다.
+ */
+static void io_wait_results(struct io_result *r, int n)
+{
+    for (int i = 0; i < n; i++)
+        while (!atomic_load(&r[i].done))
+            usleep(1000);
+}
+
+struct io_shutdown {
+    pthread_pool_t *pool;
+    atomic_bool returned;
+};
+
+static void *io_shutdown_thread(void *param)
+{
+    struct io_shutdown *s = (struct io_shutdown *)param;
+
+    assert(pthread_pool_shutdown(s->pool, POOL_COMPLETE) == POOL_SUCCESS);
+    atomic_store(&s->returned, true);
+    return NULL;
+}
+
+/*
+ * 비동기 입출력을 확인한다. 파일에 조각으로 나눠 쓰고 fsync한 뒤 다시 읽으면 쓴 내용이 나와야 하고,
+ * 잘못된 파일 기술자는 -EBADF로 끝나야 한다. 끝나지 않은 입출력이 있는 동안 종료하면 그 입출력이 끝나 완료 함수가
+ * 실행될 때까지 종료가 기다려야 한다. io_uring을 쓰고 있으면 reaper가 기다리던 링을 더 쓸 수 없게 만들어,
+ * 링에 들어가 있던 요청이 오류로 끝나고 그 뒤의 요청은 막히는 시스템 호출로 처리되는지도 확인한다.
+ */
+static void test_io(void)
+{
+    static char out[IO_CHUNKS * IO_CHUNK], in[IO_CHUNKS * IO_CHUNK], pipe_buf[2][16];
+    struct io_result wr[IO_CHUNKS], rd[IO_CHUNKS], one[3];
+    char path[] = "/tmp/pool_test_XXXXXX";
+    pthread_pool_t pool;
+    int fd, pfd[2][2];
+
+    fd = mkstemp(path);
+    assert(fd >= 0);
+    unlink(path);
+    for (int i = 0; i < IO_CHUNKS * IO_CHUNK; i++)
+        out[i] = (char)(i * 7 + i / IO_CHUNK);
+    assert(pthread_pool_init(&pool, 2, 64) == POOL_SUCCESS);
+
+    memset(wr, 0, sizeof(wr));
+    for (int i = 0; i < IO_CHUNKS; i++)
+        assert(pthread_pool_io_write(&pool, fd, out + i * IO_CHUNK, IO_CHUNK, (off_t)i * IO_CHUNK,
+                                     io_record, &wr[i]) == POOL_SUCCESS);
+    io_wait_results(wr, IO_CHUNKS);
+    for (int i = 0; i < IO_CHUNKS; i++)
+        assert(wr[i].res == IO_CHUNK);
+    memset(one, 0, sizeof(one));
+    assert(pthread_pool_io_fsync(&pool, fd, io_record, &one[0]) == POOL_SUCCESS);
+    assert(pthread_pool_io_read(&pool, -1, in, 1, 0, io_record, &one[1]) == POOL_SUCCESS);
+    io_wait_results(one, 2);
+    assert(one[0].res == 0 && one[1].res == -EBADF);
+
+    memset(rd, 0, sizeof(rd));
+    for (int i = IO_CHUNKS - 1; i >= 0; i--)
+        assert(pthread_pool_io_read(&pool, fd, in + i * IO_CHUNK, IO_CHUNK, (off_t)i * IO_CHUNK,
+                                    io_record, &rd[i]) == POOL_SUCCESS);
+    io_wait_results(rd, IO_CHUNKS);
+    for (int i = 0; i < IO_CHUNKS; i++)
+        assert(rd[i].res == IO_CHUNK);
+    assert(memcmp(in, out, sizeof(out)) == 0);
+
+#ifdef IO_URING
+    //reaper가 완료를 기다리는 동안 링의 파일 기술자를 다른 파일로 바꿔 둔다. 파이프 하나에 쓰면 reaper가 깨어나
+    //그 완료를 넣은 뒤 다시 기다리려다 오류를 받으므로, 다른 파이프의 읽기는 오류로 끝나야 한다.
+    struct pool_io *io = atomic_load(&pool.io);
+    if (io->ring_fd >= 0) {
+        int null = open("/dev/null", O_RDONLY);
+        assert(null >= 0);
+        memset(one, 0, sizeof(one));
+        for (int i = 0; i < 2; i++) {
+            assert(pipe(pfd[i]) == 0);
+            assert(pthread_pool_io_read(&pool, pfd[i][0], pipe_buf[i], sizeof(pipe_buf[i]), 0,
+                                        io_record, &one[i]) == POOL_SUCCESS);
+        }
+        usleep(20000);
+        assert(dup2(null, io->ring_fd) == io->ring_fd);
+        close(null);
+        assert(write(pfd[0][1], "ring", 4) == 4);
+        io_wait_results(one, 2);
+        assert(one[0].res == 4 && memcmp(pipe_buf[0], "ring", 4) == 0);
+        assert(one[1].res < 0);
+        assert(io->ring_fd == -1);
+        assert(pthread_pool_io_read(&pool, fd, in, IO_CHUNK, 0, io_record, &one[2]) == POOL_SUCCESS);
+        io_wait_results(&one[2], 1);
+        assert(one[2].res == IO_CHUNK && memcmp(in, out, IO_CHUNK) == 0);
+        for (int i = 0; i < 2; i++) {
+            close(pfd[i][0]);
+            close(pfd[i][1]);
+        }
+    }
+#endif
+    assert(pthread_pool_shutdown(&pool, POOL_COMPLETE) == POOL_SUCCESS);
+
+    //파이프에서 읽는 중인 입출력이 있으면 종료는 그 읽기가 끝나고 완료 함수가 실행될 때까지 돌아오지 않는다.
+    struct io_shutdown sd = { &pool, false };
+    pthread_t tid;
+    assert(pthread_pool_init(&pool, 2, 64) == POOL_SUCCESS);
+    assert(pipe(pfd[0]) == 0);
+    memset(one, 0, sizeof(one));
+    assert(pthread_pool_io_read(&pool, pfd[0][0], pipe_buf[0], sizeof(pipe_buf[0]), 0, io_record, &one[0]) ==
+           POOL_SUCCESS);
+    assert(pthread_create(&tid, NULL, io_shutdown_thread, &sd) == 0);
+    usleep(30000);
+    assert(!atomic_load(&sd.returned) && !atomic_load(&one[0].done));
+    assert(write(pfd[0][1], "late", 4) == 4);
+    pthread_join(tid, NULL);
+    assert(atomic_load(&one[0].done) && one[0].res == 4);
+    close(pfd[0][0]);
+    close(pfd[0][1]);
+    close(fd);
+}
+
+/*
+ * 공유 일꾼을 쓰는 스레드풀 하나와 그 스레드풀에서 실행된 작업의 수이다.
+ */
+struct drr_tenant {
+    pthread_pool_t pool;
+    atomic_long ran;
+};
+
+static atomic_bool drr_stop;        /* 켜지면 작업이 자기를 다시 넣지 않는다 */
+
+/*
+ * 잠시 CPU를 쓰고 세어 둔 뒤 같은 스레드풀에 자기를 다시 넣어, 대기열에 늘 같은 수의 작업이 남아 있게 한다.
+ */
+static void drr_work(void *param)
+{
+    struct drr_tenant *t = (struct drr_tenant *)param;
+    uint64_t end = now_ns() + DRR_SPIN_NS;
+
+    while (now_ns() < end)
+        ;
+    atomic_fetch_add(&t->ran, 1);
+    if (!atomic_load(&drr_stop))
+        assert(pthread_pool_submit(&t->pool, drr_work, t, POOL_WAIT) == POOL_SUCCESS);
+}
+
+/*
+ * weight가 1과 3인 두 스레드풀에 depth개씩 작업을 채워 두고 공유 일꾼을 함께 쓰게 한 뒤, 한동안 실행된 작업의 수를 잰다.
+ * 두 스레드풀은 공유 일꾼을 모두 쓸 수 있고 대기열이 비지 않으므로, 실행된 작업의 비는 weight의 비를 따라야 한다.
+ */
+static void drr_run(int queue, int depth, int bees)
+{
+    static struct drr_tenant t[2];
+    pthread_pool_attr_t attr;
+    long base[2];
+
+    atomic_store(&drr_stop, false);
+    for (int i = 0; i < 2; i++) {
+        pthread_pool_attr_init(&attr);
+        attr.shared = true;
+        attr.weight = i == 0 ? 1 : 3;
+        attr.queue = queue;
+        attr.batch = 4;
+        atomic_store(&t[i].ran, 0);
+        assert(pthread_pool_init_attr(&t[i].pool, bees, POOL_MAXQSIZE, &attr) == POOL_SUCCESS);
+    }
+    for (int k = 0; k < depth; k++)
+        for (int i = 0; i < 2; i++)
+            assert(pthread_pool_submit(&t[i].pool, drr_work, &t[i], POOL_WAIT) == POOL_SUCCESS);
+    usleep(20000);
+    for (int i = 0; i < 2; i++)
+        base[i] = atomic_load(&t[i].ran);
+    usleep(200000);
+    long a = atomic_load(&t[0].ran) - base[0], b = atomic_load(&t[1].ran) - base[1];
+    atomic_store(&drr_stop, true);
+    for (int i = 0; i < 2; i++)
+        assert(pthread_pool_shutdown(&t[i].pool, POOL_COMPLETE) == POOL_SUCCESS);
+    assert(a > 0 && 2 * a <= b && b <= 4 * a);
+}
+
+/*
+ * 공유 일꾼의 결손 라운드 로빈을 확인한다. 대기열이 깊을 때는 물론, 락 없는 대기열이 얕아서 공유 일꾼이 차례의 몫보다
+ * 적게 꺼내 갈 때에도 실제로 꺼낸 수만큼만 몫에서 빠지므로 실행 비율이 weight의 비를 따른다.
+ */
+static void test_drr(void)
+{
+    drr_run(POOL_QUEUE_LOCK, POOL_MAXQSIZE / 4, POOL_MAXBSIZE);
+    drr_run(POOL_QUEUE_LOCKFREE, POOL_MAXQSIZE / 4, POOL_MAXBSIZE);
+    drr_run(POOL_QUEUE_LOCKFREE, POOL_MAXBSIZE / 4, POOL_MAXBSIZE);
+}
+
+static atomic_long drain_ran;       /* 실행된 작업의 수 */
+static atomic_long drain_rejected;  /* reject로 알려 온 버린 작업의 수 */
+
+static void drain_work(void *param)
+{
+    usleep(500);
+    atomic_fetch_add(&drain_ran, 1);
+}
+
+static void drain_reject(void (*f)(void *p), void *p, void *ctx)
+{
+    assert(ctx == &drain_rejected);
+    atomic_fetch_add(&drain_rejected, 1);
+}
+
+/*
+ * 속성 attr로 만든 스레드풀에 DRAIN_TASKS개의 작업을 넣고 pthread_pool_shutdown_drain()으로 종료한다.
+ * timeout이 true이면 DRAIN_TIMEOUT_MS 밀리초까지만 기다린다. 버린 작업의 수를 리턴한다.
+ */
+static size_t drain_run(pthread_pool_attr_t *attr, bool timeout)
+{
+    pthread_pool_t pool;
+    struct timespec ts;
+    size_t left = SIZE_MAX;
+
+    atomic_store(&drain_ran, 0);
+    atomic_store(&drain_rejected, 0);
+    assert(pthread_pool_init_attr(&pool, 4, POOL_MAXQSIZE, attr) == POOL_SUCCESS);
+    for (int i = 0; i < DRAIN_TASKS; i++)
+        assert(pthread_pool_submit(&pool, drain_work, NULL, POOL_WAIT) == POOL_SUCCESS);
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_nsec += DRAIN_TIMEOUT_MS * 1000000L;
+    if (ts.tv_nsec >= 1000000000L) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+    }
+    int r = pthread_pool_shutdown_drain(&pool, timeout ? &ts : NULL, &left);
+    assert(r == (left > 0 ? POOL_TIMEOUT : POOL_SUCCESS));
+    assert((size_t)atomic_load(&drain_ran) + left == DRAIN_TASKS);
+    assert((size_t)atomic_load(&drain_rejected) == left);
+    return left;
+}
+
+static atomic_bool drain_started;        /* 늦게 작업을 넣는 작업이 시작했으면 true */
+static atomic_long drain_late_submitted; /* 늦게 넣기에 성공한 작업의 수 */
+
+/*
+ * 기한이 지나 종료가 일꾼을 기다리기 시작한 뒤에 새 작업을 넣는 작업이다.
+ */
+static void drain_late_work(void *param)
+{
+    pthread_pool_t *pool = (pthread_pool_t *)param;
+
+    atomic_store(&drain_started, true);
+    usleep(DRAIN_TIMEOUT_MS * 3 * 1000);
+    if (pthread_pool_submit(pool, drain_work, NULL, POOL_NOWAIT) == POOL_SUCCESS)
+        atomic_fetch_add(&drain_late_submitted, 1);
+    atomic_fetch_add(&drain_ran, 1);
+}
+
+/*
+ * 일꾼이 하나인 스레드풀에서 실행 중인 작업이 기한이 지난 뒤에 넣은 작업도 버린 작업으로 세고 reject로 알려야 한다.
+ */
+static void drain_late(pthread_pool_attr_t *attr)
+{
+    pthread_pool_t pool;
+    struct timespec ts;
+    size_t left = SIZE_MAX;
+
+    atomic_store(&drain_ran, 0);
+    atomic_store(&drain_rejected, 0);
+    atomic_store(&drain_started, false);
+    atomic_store(&drain_late_submitted, 0);
+    assert(pthread_pool_init_attr(&pool, 1, POOL_MAXQSIZE, attr) == POOL_SUCCESS);
+    assert(pthread_pool_submit(&pool, drain_late_work, &pool, POOL_WAIT) == POOL_SUCCESS);
+    while (!atomic_load(&drain_started))
+        usleep(1000);
+    assert(pthread_pool_submit(&pool, drain_work, NULL, POOL_WAIT) == POOL_SUCCESS);
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_nsec += DRAIN_TIMEOUT_MS * 1000000L;
+    if (ts.tv_nsec >= 1000000000L) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+    }
+    assert(pthread_pool_shutdown_drain(&pool, &ts, &left) == POOL_TIMEOUT);
+    assert(atomic_load(&drain_late_submitted) == 1);
+    assert((size_t)atomic_load(&drain_ran) + left == 3);
+    assert((size_t)atomic_load(&drain_rejected) == left);
+}
+
+/*
+ * 남은 작업을 일꾼에게 맡기는 종료를 확인한다. 기한 없이 기다리면 모든 작업이 실행되고 버린 작업은 없다.
+ * 기한이 지나면 실행한 작업과 버린 작업의 수를 더해 넣은 작업의 수가 되고, 버린 작업마다 reject가 불린다.
+ * 기한이 지난 뒤 실행 중이던 작업이 넣은 작업도 마찬가지이다. 작업 배분 방식과 대기열, 공유 일꾼마다 확인한다.
+ */
+static void test_drain(void)
+{
+    for (int mode = 0; mode < 5; mode++) {
+        pthread_pool_attr_t attr;
+        pthread_pool_attr_init(&attr);
+        attr.reject = drain_reject;
+        attr.reject_ctx = &drain_rejected;
+        if (mode == 1 || mode == 3)
+            attr.sched = POOL_SCHED_STEAL;
+        if (mode == 2 || mode == 3)
+            attr.queue = POOL_QUEUE_LOCKFREE;
+        if (mode == 4)
+            attr.shared = true;
+        assert(drain_run(&attr, false) == 0);
+        assert(drain_run(&attr, true) > 0);
+        drain_late(&attr);
+    }
+
+    //POOL_DRAIN으로 종료해도 남은 작업을 모두 실행하며, 일꾼을 시작하지 않은 스레드풀도 바로 종료된다.
+    pthread_pool_t pool;
+    pthread_pool_attr_t attr;
+    pthread_pool_attr_init(&attr);
+    atomic_store(&drain_ran, 0);
+    assert(pthread_pool_init_attr(&pool, 4, POOL_MAXQSIZE, &attr) == POOL_SUCCESS);
+    for (int i = 0; i < DRAIN_TASKS / 10; i++)
+        assert(pthread_pool_submit(&pool, drain_work, NULL, POOL_WAIT) == POOL_SUCCESS);
+    assert(pthread_pool_shutdown(&pool, POOL_DRAIN) == POOL_SUCCESS);
+    assert(atomic_load(&drain_ran) == DRAIN_TASKS / 10);
+    attr.lazy = true;
+    assert(pthread_pool_init_attr(&pool, 4, 16, &attr) == POOL_SUCCESS);
+    assert(pthread_pool_shutdown_drain(&pool, NULL, NULL) == POOL_SUCCESS);
+}
+
+static atomic_int then_ran;         /* 실행된 후속 작업의 수 */
+
+static void then_work(void *param)
+{
+    atomic_fetch_add(&then_ran, 1);
+}
+
+/*
+ * 스레드 캐시를 비워 두고 스레드를 만들지 못하게 하거나, 다시 돌려놓는다.
+ */
+static void then_block_threads(bool block)
+{
+    static struct bee_thread *saved;
+    static int nsaved;
+
+    pthread_mutex_lock(&thread_cache.mutex);
+    if (block) {
+        saved = thread_cache.idle;
+        nsaved = thread_cache.nidle;
+        thread_cache.idle = NULL;
+        thread_cache.nidle = 0;
+    }
+    else if (saved != NULL) {
+        struct bee_thread *t = saved;
+        while (t->next != NULL)
+            t = t->next;
+        t->next = thread_cache.idle;
+        thread_cache.idle = saved;
+        thread_cache.nidle += nsaved;
+        saved = NULL;
+    }
+    pthread_mutex_unlock(&thread_cache.mutex);
+    atomic_store(&create_fails, block);
+}
+
+/*
+ * 후속 작업을 확인한다. 이어 붙인 작업은 차례로 실행되고, 이미 끝난 작업에 붙이면 대기열을 거쳐 실행된다.
+ * 일꾼을 시작하지 못해 후속 작업을 대기열에 넣지 못하면 그 핸들은 버려진 것으로 끝나 기다리는 쪽이 멈추지 않고,
+ * 이미 끝난 작업에 붙이려 하면 POOL_FAIL이 돌아온다. 어느 쪽이든 핸들은 모두 빈 핸들 목록으로 돌아가야 한다.
+ */
+static void test_then(void)
+{
+    pthread_pool_t pool;
+    pool_future_t *f, *g, *h;
+
+    atomic_store(&then_ran, 0);
+    assert(pthread_pool_init(&pool, 2, 16) == POOL_SUCCESS);
+    assert(pthread_pool_submit_future(&pool, then_work, NULL, POOL_WAIT, &f) == POOL_SUCCESS);
+    assert(pthread_pool_future_then(f, then_work, NULL, &g) == POOL_SUCCESS);
+    assert(pthread_pool_future_then(g, then_work, NULL, &h) == POOL_SUCCESS);
+    assert(pthread_pool_future_wait(h) == POOL_SUCCESS && atomic_load(&then_ran) == 3);
+    pthread_pool_future_release(h);
+    assert(pthread_pool_future_then(f, then_work, NULL, &h) == POOL_SUCCESS);
+    assert(pthread_pool_future_wait(h) == POOL_SUCCESS && atomic_load(&then_ran) == 4);
+    pthread_pool_future_release(f);
+    pthread_pool_future_release(g);
+    pthread_pool_future_release(h);
+    assert(pthread_pool_shutdown(&pool, POOL_COMPLETE) == POOL_SUCCESS);
+
+    //일꾼을 시작하지 못하는 lazy 스레드풀에서 끝난 작업의 핸들을 직접 만들어 후속 작업을 붙인다.
+    pthread_pool_attr_t attr;
+    pthread_pool_attr_init(&attr);
+    attr.lazy = true;
+    assert(pthread_pool_init_attr(&pool, 2, 16, &attr) == POOL_SUCCESS);
+    then_block_threads(true);
+    assert(pthread_pool_submit(&pool, then_work, NULL, POOL_WAIT) == POOL_FAIL);
+    struct pool_future *pred = future_get(&pool);
+    assert(pred != NULL);
+    assert(pthread_pool_future_then(pred, then_work, NULL, &g) == POOL_SUCCESS);
+    assert(pthread_pool_future_then(pred, then_work, NULL, &h) == POOL_SUCCESS);
+    //후속 작업 하나는 그 자리에서 실행하라고 돌아오고, 나머지는 대기열에 넣지 못해 버려진다.
+    struct pool_future *run = future_finish(pred, FUTURE_DONE);
+    assert(run == g || run == h);
+    atomic_store(&then_ran, 0);
+    future_run(run);
+    assert(atomic_load(&then_ran) == 1);
+    assert(pthread_pool_future_wait(run) == POOL_SUCCESS);
+    assert(pthread_pool_future_wait(run == g ? h : g) == POOL_FAIL);
+    f = NULL;
+    assert(pthread_pool_future_then(pred, then_work, NULL, &f) == POOL_FAIL && f == NULL);
+    pthread_pool_future_release(g);
+    pthread_pool_future_release(h);
+    pthread_pool_future_release(pred);
+    int free_handles = 0, slabs = 0;
+    for (struct pool_future *p = pool.fut_free; p != NULL; p = p->next)
+        free_handles++;
+    for (struct future_slab *sl = pool.fut_slab; sl != NULL; sl = sl->next)
+        slabs++;
+    assert(free_handles == slabs * FUTURE_SLAB);
+    then_block_threads(false);
+    assert(pthread_pool_shutdown(&pool, POOL_COMPLETE) == POOL_SUCCESS);
+}
+
+/*
+ * 시험의 이름과 함수의 표이다.
+ */
+static const struct {
+    const char *name;
+    void (*run)(void);
+} tests[] = {
+    { "deque", test_deque },
+    { "ring", test_ring },
+    { "strand_order", test_strand_order },
+    { "strand_steal", test_strand_steal },
+    { "token", test_token },
+    { "fiber", test_fiber },
+    { "then", test_then },
+    { "io", test_io },
+    { "drr", test_drr },
+    { "drain", test_drain },
+};
+
+int main(int argc, char *argv[])
+{
+    int ran = 0;
+
+    for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+        bool chosen = argc < 2;
+        for (int j = 1; j < argc; j++)
+            if (strcmp(argv[j], tests[i].name) == 0)
+                chosen = true;
+        if (!chosen)
+            continue;
+        fprintf(stderr, "pool_test: %s\n", tests[i].name);
+        tests[i].run();
+        ran++;
+    }
+    assert(ran > 0);
+    fprintf(stderr, "pool_test: %d passed\n", ran);
+    return 0;
+}
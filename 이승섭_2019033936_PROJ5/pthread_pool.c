@@ -11,192 +11,5275 @@
  * 6월 3일 컴퓨터학부 2019033936 이승섭 - 데드락 발생 및 pthread_pool_shutdown() 함수 수정 완료
  * 6월 3일 컴퓨터학부 2019033936 이승섭 - 데드락 발생 및 pthread_pool_shutdown() 함수 수정 완료
  * 6월 3일 컴퓨터학부 2019033936 이승섭 - 코드 완성
+ * 10월 17일 컴퓨터학부 2019033936 이승섭 - 작업 훔치기(POOL_SCHED_STEAL) 모드와 pthread_pool_init_attr() 추가
+ * 10월 17일 컴퓨터학부 2019033936 이승섭 - 락 없는 공유 대기열(POOL_QUEUE_LOCKFREE)과 futex 대기 추가
+ * 10월 17일 컴퓨터학부 2019033936 이승섭 - 여러 작업을 한 번에 요청하는 pthread_pool_submit_batch() 추가
+ * 10월 17일 컴퓨터학부 2019033936 이승섭 - 일꾼이 대기열에서 여러 작업을 한 번에 가져오는 기능(batch) 추가
+ * 10월 17일 컴퓨터학부 2019033936 이승섭 - 작업 완료를 기다릴 수 있는 pthread_pool_submit_future() 추가
+ * 10월 17일 컴퓨터학부 2019033936 이승섭 - 작업 그룹(pool_group_t)과 기다리는 동안 작업을 돕는 group_wait 추가
+ * 10월 17일 컴퓨터학부 2019033936 이승섭 - 구간을 나눠 실행하는 pthread_pool_parallel_for(), parallel_reduce() 추가
+ * 10월 17일 컴퓨터학부 2019033936 이승섭 - 우선순위 단계별 대기열과 pthread_pool_submit_prio() 추가
+ * 10월 17일 컴퓨터학부 2019033936 이승섭 - 실행 중에 일꾼 수를 바꾸는 pthread_pool_resize()와 자동 조절 추가
+ * 10월 17일 컴퓨터학부 2019033936 이승섭 - 계층형 타이머 휠로 지연/주기 작업(pthread_pool_schedule_after(), _every()) 추가
+ * 10월 17일 컴퓨터학부 2019033936 이승섭 - 일꾼의 CPU 묶기(affinity)와 NUMA 노드별 공유 대기열 추가
+ * 10월 17일 컴퓨터학부 2019033936 이승섭 - 잠들기 전에 잠깐 돌고 양보하는 적응형 기다리기와 pthread_pool_wait_stats() 추가
+ * 10월 17일 컴퓨터학부 2019033936 이승섭 - 일꾼별 카운터와 로그 눈금 히스토그램을 모으는 pthread_pool_stats() 추가
+ * 10월 17일 컴퓨터학부 2019033936 이승섭 - 인자를 작업 안에 복사하는 pthread_pool_submit_inline()과 캐시 라인 크기의 방 추가
+ * 10월 17일 컴퓨터학부 2019033936 이승섭 - 꽉 찬 대기열의 처리 방식(POOL_CALLER_RUNS, POOL_DROP_OLDEST)과 reject 함수 추가
+ * 10월 18일 컴퓨터학부 2019033936 이승섭 - 작업을 넣은 순서대로 하나씩 실행하는 스트랜드(pool_strand_t) 추가
+ * 10월 18일 컴퓨터학부 2019033936 이승섭 - 작업과 그룹을 취소하고 기한을 두는 취소 토큰(pool_token_t) 추가
+ * 10월 18일 컴퓨터학부 2019033936 이승섭 - 일꾼 스레드를 다시 쓰는 스레드 캐시와 첫 작업 때 일꾼을 시작하는 lazy 추가
+ * 10월 18일 컴퓨터학부 2019033936 이승섭 - 스레드풀의 사건을 남기고 Chrome trace JSON으로 쓰는 pthread_pool_trace_dump() 추가
+ * 10월 18일 컴퓨터학부 2019033936 이승섭 - 멈췄다가 아무 일꾼에서나 이어 실행하는 파이버 작업(pthread_pool_submit_fiber())과 pthread_pool_yield() 추가
+ * 10월 18일 컴퓨터학부 2019033936 이승섭 - io_uring으로 읽기/쓰기/fsync를 요청하고 완료를 작업으로 넣는 비동기 입출력(pthread_pool_io_read() 등) 추가
+ * 10월 18일 컴퓨터학부 2019033936 이승섭 - 앞 작업이 끝나면 같은 일꾼이 바로 이어 실행하는 후속 작업(pthread_pool_future_then()) 추가
+ * 10월 18일 컴퓨터학부 2019033936 이승섭 - 여러 스레드풀이 CPU 수만큼의 공유 일꾼을 가중치대로 나눠 쓰는 shared 속성 추가
+ * 10월 18일 컴퓨터학부 2019033936 이승섭 - 일꾼이 남은 작업을 함께 마치고 시간이 지나면 나머지를 버리는 pthread_pool_shutdown_drain() 추가
  * 참고 자료 1 https://happytear.tistory.com/entry/Pthread-%EC%93%B0%EB%A0%88%EB%93%9C%ED%92%80-%EC%82%AC%EC%9A%A9%ED%95%98%EA%B8%B0 - 스레드풀 개념 이해
  * 참고 자료 2 https://popcorntree.tistory.com/67 - 스레드풀 코드 구현을 위해 도움을 받았음
+ * 참고 자료 3 Lê et al., "Correct and Efficient Work-Stealing for Weak Memory Models", PPoPP 2013 - Chase-Lev 덱 구현
+ * 참고 자료 4 https://www.1024cores.net/home/lock-free-algorithms/queues/bounded-mpmc-queue - 락 없는 원형 버퍼 구현
+ * 참고 자료 5 Varghese & Lauck, "Hashed and Hierarchical Timing Wheels", SOSP 1987 - 계층형 타이머 휠 구현
  */
+#ifdef __linux__
+#define _GNU_SOURCE                 /* pthread_attr_setaffinity_np()와 sched_getcpu()를 쓰기 위해 필요하다 */
+#endif
 #include "pthread_pool.h"
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <time.h>
+#include <sched.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+#if defined(__linux__) && !defined(POOL_NO_IO_URING) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>) && defined(__NR_io_uring_setup)
+#include <linux/io_uring.h>
+#define IO_URING 1                  /* 비동기 입출력에 io_uring을 쓴다 */
+#endif
+#endif
+
+/*
+ * 락 없는 대기열의 한 칸이다. seq는 이 칸을 다음에 누가 쓸 수 있는지를 나타내는 순번이다.
+ * seq가 위치 pos와 같으면 생산자가, pos + 1이면 소비자가 이 칸을 차지할 수 있다.
+ * 이웃한 칸을 다른 스레드가 동시에 쓰더라도 캐시 라인을 두고 다투지 않도록 칸마다 캐시 라인 경계에서 시작한다.
+ */
+struct ring_cell {
+    _Alignas(64) atomic_size_t seq; /* 칸의 순번 */
+    task_t task;                    /* 칸에 담긴 작업 */
+};
+
+/*
+ * Vyukov 방식의 크기가 고정된 다중 생산자/다중 소비자 원형 버퍼이다.
+ * 생산자와 소비자는 각자 tail과 head를 CAS로 한 칸씩 차지하며, 락을 쓰지 않는다.
+ * head와 tail은 생산자와 소비자가 서로의 캐시 라인을 건드리지 않도록 따로 둔다.
+ * 위치는 계속 증가하며 칸은 size로 나눈 나머지로 고르므로 크기가 2의 거듭제곱일 필요가 없다.
+ */
+struct ring {
+    _Alignas(64) atomic_size_t head;/* 다음에 꺼낼 위치 */
+    _Alignas(64) atomic_size_t tail;/* 다음에 넣을 위치 */
+    _Alignas(64) size_t size;       /* 칸의 수, 스레드풀의 q_size와 같다 */
+    struct ring_cell *cell;         /* 칸 배열 */
+};
+
+/*
+ * 우선순위 단계 하나의 대기열이다. 락을 쓰면 q의 한 구간을 원형 버퍼로 쓰고, 락 없는 대기열이면 ring을 쓴다.
+ * 단계마다 용량이 따로 있으므로 낮은 단계가 꽉 차도 높은 단계에는 작업을 넣을 수 있다.
+ * NUMA 노드마다 대기열을 나누면 노드 n의 단계 l은 lane[n * prio + l]이다.
+ * passed는 작업이 남아 있는데 더 높은 단계에 밀린 횟수이며, age에 이르면 이 단계를 먼저 꺼낸다.
+ */
+struct pool_lane {
+    task_t *q;                      /* 이 단계가 쓰는 q의 구간, 락 없는 대기열이면 NULL */
+    int front;                      /* 다음에 실행될 작업의 위치 */
+    int len;                        /* 이 단계의 대기열 길이 */
+    struct ring *ring;              /* 락 없는 대기열, 락을 쓰면 NULL */
+    atomic_uint passed;             /* 높은 단계에 밀린 횟수 */
+};
+
+/*
+ * 작업 덱으로 사용할 원형 버퍼이다. 크기는 2의 거듭제곱이며 꽉 차면 두 배 크기로 바꾼다.
+ * 바꾸기 전의 버퍼는 도둑이 아직 읽고 있을 수 있으므로 prev로 이어 두었다가 종료할 때 해제한다.
+ */
+struct deque_buf {
+    long mask;                      /* 버퍼 크기 - 1 */
+    struct deque_buf *prev;         /* 키우기 전에 사용하던 버퍼 */
+    _Alignas(64) task_t slot[];     /* 작업을 담는 방, 캐시 라인 경계에서 시작한다 */
+};
+
+/*
+ * 작업 훔치기 모드에서 일꾼 스레드마다 하나씩 두는 Chase-Lev 방식의 작업 덱이다.
+ * 주인 일꾼은 bottom 쪽에서 넣고 꺼내며(LIFO), 다른 일꾼은 top 쪽에서 훔쳐간다(FIFO).
+ * 주인과 도둑이 같은 캐시 라인을 두고 다투지 않도록 top과 bottom을 서로 다른 줄에 둔다.
+ */
+struct bee {
+    _Alignas(64) atomic_long top;   /* 도둑이 훔쳐갈 다음 위치 */
+    _Alignas(64) atomic_long bottom;/* 주인이 다음에 넣을 위치 */
+    _Atomic(struct deque_buf *) buf;/* 덱으로 사용할 원형 버퍼 */
+    pthread_pool_t *pool;           /* 이 일꾼이 속한 스레드풀 */
+    int id;                         /* hive 배열에서의 위치 */
+    unsigned int seed;              /* 훔칠 상대를 고르기 위한 난수 상태 */
+    task_t *claim;                  /* 공유 대기열에서 한꺼번에 가져온 작업을 담는 배열, 크기는 pool->batch */
+    int claim_pos;                  /* claim에서 다음에 실행할 작업의 위치 */
+    int claim_len;                  /* claim에 담긴 작업의 수 */
+    int cpu;                        /* 일꾼을 묶은 CPU, 묶지 않았으면 -1 */
+    int node;                       /* 일꾼이 먼저 쓰는 공유 대기열의 NUMA 노드 */
+    atomic_long gap_ns;             /* 작업을 기다리기 시작해서 작업이 보일 때까지 걸린 시간의 이동 평균 */
+    atomic_long spin_ns;            /* 잠들기 전에 돌며 기다릴 시간 */
+    atomic_ulong waits[3];          /* 기다림이 잠들기, 돌기, 양보하기로 끝난 횟수 */
+    atomic_ulong tasks;             /* 실행한 작업의 수 */
+    atomic_ulong busy_ns;           /* 작업을 실행한 시간 */
+    atomic_ulong idle_ns;           /* 작업을 찾거나 기다린 시간 */
+    atomic_ulong *hist;             /* 대기 시간과 실행 시간의 분포, 통계를 모으지 않으면 NULL */
+    struct trace_buf *trace;        /* 이 일꾼의 사건을 남기는 기록 버퍼, 사건을 남기지 않으면 NULL */
+};
+
+/*
+ * 작업의 완료를 알려주는 핸들이다. 스레드풀이 묶음(slab)으로 미리 만들어 두고 다시 쓴다.
+ * 핸들은 요청한 쪽과 작업 쪽이 하나씩 참조하며, 둘 다 놓으면 빈 핸들 목록으로 돌아간다.
+ * 작업은 future_run()이 핸들에 담긴 함수를 대신 실행하는 방식으로 대기열에 들어가므로
+ * 대기열과 덱은 핸들이 있는지 알 필요가 없다.
+ * 작업 그룹에 속한 작업도 같은 핸들을 쓰며, 이때는 요청한 쪽의 참조 없이 group만 채운다.
+ * 취소 토큰을 붙인 작업도 요청한 쪽의 참조 없이 token만 채운 핸들을 쓴다.
+ * 파이버가 완료를 기다리면 스레드 대신 파이버가 멈춰서 fibers에 들어가고, 작업이 끝나면 목록을 닫으면서 모두 다시 요청한다.
+ * pthread_pool_future_then()으로 이어 붙인 후속 작업은 자기 핸들의 next로 이어 thens에 들어가 있다가 작업이 끝나면
+ * 대기열을 거치지 않고 같은 스레드에서 실행된다.
+ */
+#define FUTURE_PENDING 0            /* 작업이 아직 끝나지 않음 */
+#define FUTURE_DONE 1               /* 작업을 실행해서 끝남 */
+#define FUTURE_DROPPED 2            /* POOL_DISCARD 종료로 작업을 실행하지 않고 버림 */
+#define FUTURE_SLAB 64              /* 한 번에 만들어 두는 핸들의 수 */
+#define THENS_CLOSED ((struct pool_future *)1)  /* 작업이 끝나 더는 후속 작업을 붙일 수 없는 목록의 표시 */
+
+struct pool_future {
+    atomic_uint state;              /* 작업의 상태, futex로 기다리는 값이기도 하다 */
+    atomic_int waiters;             /* 완료를 기다리며 잠든 스레드의 수 */
+    atomic_int refs;                /* 핸들을 참조하는 쪽의 수 */
+    void (*function)(void *param);  /* 실제로 실행할 작업 함수 */
+    void *param;                    /* 작업 함수의 인자 */
+    pool_group_t *group;            /* 작업이 속한 그룹, 없으면 NULL */
+    pool_token_t *token;            /* 작업에 붙인 취소 토큰, 없으면 NULL */
+    pthread_pool_t *pool;           /* 핸들을 만든 스레드풀 */
+    struct pool_future *next;       /* 빈 핸들 목록에서 다음 핸들 */
+    _Atomic(struct pool_fiber *) fibers;    /* 완료를 기다리며 멈춘 파이버의 목록, 끝났으면 FIBERS_CLOSED */
+    _Atomic(struct pool_future *) thens;    /* 끝나면 이어서 실행할 후속 작업의 목록, 끝났으면 THENS_CLOSED */
+};
+
+struct future_slab {
+    struct future_slab *next;       /* 먼저 만든 묶음 */
+    struct pool_future f[FUTURE_SLAB];
+};
+
+/*
+ * 지연 작업과 주기 작업 하나를 나타내는 타이머이다. 시각은 CLOCK_MONOTONIC 기준의 밀리초(틱)로 센다.
+ * 타이머는 휠 쪽과 핸들을 받은 요청 쪽이 하나씩 참조하며, 둘 다 놓으면 해제한다.
+ * 스레드풀을 가리키지 않고도 놓을 수 있으므로 핸들은 스레드풀을 종료한 뒤에 취소해도 된다.
+ */
+struct pool_timer {
+    struct pool_timer *next;        /* 휠의 같은 칸에 있는 다음 타이머 */
+    uint64_t expires;               /* 만료 시각 */
+    uint64_t period;                /* 반복 주기, 0이면 한 번만 실행 */
+    void (*function)(void *param);  /* 실행할 작업 함수 */
+    void *param;                    /* 작업 함수의 인자 */
+    pthread_pool_t *pool;           /* 타이머를 건 스레드풀 */
+    atomic_bool canceled;           /* 취소되었으면 true */
+    atomic_int refs;                /* 타이머를 참조하는 쪽의 수 */
+};
+
+/*
+ * 계층형 타이머 휠이다. 단계 l의 칸 하나는 64^l 틱을 맡으며, 남은 시간이 64^l 이상 64^(l+1) 미만인 타이머가
+ * 만료 시각에 해당하는 칸에 들어간다. 시각이 단계 l의 칸 경계를 지날 때마다 그 칸의 타이머를 한 단계 아래로 옮긴다.
+ * 넣기와 빼기는 O(1)이며, bits는 칸마다 타이머가 있는지 나타내므로 빈 구간은 건너뛰고 다음 만료 시각을 바로 구한다.
+ * 가장 높은 단계의 범위(약 12일)를 넘는 타이머는 가장 먼 칸에 두었다가 옮길 때 다시 자리를 찾는다.
+ */
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_LEVELS 5
+
+struct timer_wheel {
+    uint64_t now;                   /* 다음에 처리할 틱 */
+    uint64_t bits[WHEEL_LEVELS];    /* 단계마다 타이머가 있는 칸의 비트맵 */
+    struct pool_timer *slot[WHEEL_LEVELS][WHEEL_SLOTS];
+};
+
+/*
+ * 자기 스택을 가지고 실행하다가 멈추고, 나중에 아무 일꾼에서나 멈춘 곳부터 이어 실행하는 파이버 작업이다.
+ * x86-64 ELF에서는 호출 규약이 보존하라는 레지스터만 저장하는 pool_fiber_switch()로 스택을 바꾸고,
+ * 다른 곳에서는 swapcontext()를 쓴다. ctx는 멈춘 파이버의 문맥이고, back은 파이버를 실행한 fiber_run()의 문맥이다.
+ * 파이버가 멈출 때 state에 이유를 적는다. FIBER_WAIT이면 실행한 쪽이 스택을 떠난 뒤에 park(파이버, park_arg)를 불러
+ * 파이버를 기다리는 목록에 넣고, park가 false를 리턴하면 기다릴 일이 이미 끝난 것이므로 바로 다시 요청한다.
+ * 멈춰 있는 동안의 취소 토큰은 token에 보관한다. 스택은 mem에서 시작하는 size바이트이며 맨 아래 페이지가 보호 페이지이다.
+ */
+#define FIBER_RUN 0                 /* 실행 중 */
+#define FIBER_YIELD 1               /* pthread_pool_yield()로 차례를 넘김 */
+#define FIBER_WAIT 2                /* 다른 작업의 완료를 기다림 */
+#define FIBER_DONE 3                /* 파이버 함수가 끝남 */
+#define FIBERS_CLOSED ((struct pool_fiber *)1)  /* 작업이 끝나 더는 기다릴 수 없는 목록의 표시 */
+
+#if defined(__x86_64__) && defined(__ELF__)
+#define FIBER_ASM 1
+typedef struct {
+    void *sp;                       /* 저장한 레지스터를 쌓아 둔 스택 위치 */
+} fiber_ctx_t;
+#else
+#include <ucontext.h>
+typedef struct {
+    ucontext_t uc;
+} fiber_ctx_t;
+#endif
+
+struct pool_fiber {
+    fiber_ctx_t ctx;                /* 멈춘 파이버의 문맥 */
+    fiber_ctx_t *back;              /* 파이버를 실행한 쪽의 문맥 */
+    int state;                      /* 파이버가 멈춘 이유 */
+    bool (*park)(struct pool_fiber *fb, void *arg); /* 멈춘 뒤 기다리는 목록에 넣을 함수 */
+    void *park_arg;                 /* park에 넘길 값 */
+    void (*function)(void *param);  /* 파이버에서 실행할 함수 */
+    void *param;                    /* 함수의 인자 */
+    pool_token_t *token;            /* 멈춰 있는 동안 보관하는 취소 토큰 */
+    pthread_pool_t *pool;           /* 파이버를 만든 스레드풀 */
+    struct pool_fiber *next;        /* 빈 파이버 목록이나 기다리는 목록에서 다음 파이버 */
+    struct pool_fiber *all;         /* 스레드풀이 만든 모든 파이버의 목록에서 다음 파이버 */
+    char *mem;                      /* 보호 페이지를 포함한 스택 공간 */
+    size_t size;                    /* mem의 크기 */
+};
+
+/*
+ * 비동기 입출력 요청 하나이다. 커널에 넘기거나 입출력 스레드가 처리하는 동안 살아 있고, 끝나면 결과를 res에 적어
+ * io_done()을 실행하는 작업으로 스레드풀에 넣는다. iov는 io_uring의 READV/WRITEV가 가리키는 버퍼 정보이다.
+ * 링에 들어가 있는 동안에는 next와 prev로 pool_io의 ring_list에 이어져 있다.
+ */
+#define IO_READ 0                   /* pread()와 같은 읽기 */
+#define IO_WRITE 1                  /* pwrite()와 같은 쓰기 */
+#define IO_FSYNC 2                  /* fsync() */
+
+struct io_req {
+    struct io_req *next;            /* 기다리는 목록, 빈 요청 목록, 링에 들어간 요청 목록에서 다음 요청 */
+    struct io_req *prev;            /* 링에 들어간 요청 목록에서 앞 요청 */
+    void (*done)(void *p, long res); /* 입출력이 끝나면 실행할 함수 */
+    void *p;                        /* done에 넘길 인자 */
+    long res;                       /* 옮긴 바이트 수나 -errno */
+    int op;                         /* IO_READ, IO_WRITE, IO_FSYNC */
+    int fd;                         /* 파일 기술자 */
+    struct iovec iov;               /* 읽거나 쓸 버퍼와 길이 */
+    off_t off;                      /* 파일 안의 위치 */
+    struct pool_io *io;             /* 요청을 받은 곳 */
+};
+
+/*
+ * 스레드풀의 비동기 입출력을 처리하는 곳이다. io_uring을 쓸 수 있으면 ring_fd가 io_uring의 파일 기술자이고,
+ * 스레드 하나(reaper)가 완료를 기다렸다가 완료 작업을 스레드풀에 넣는다. 링에는 sq_entries개까지만 넣고
+ * 나머지는 pending에 줄 세워 두었다가 완료된 만큼 넣는다. io_uring을 쓸 수 없으면 ring_fd가 -1이고
+ * nthreads개의 입출력 스레드가 pending에서 요청을 꺼내 막히는 시스템 호출로 처리한다.
+ * count는 받았지만 아직 완료 작업을 스레드풀에 넣지 않은 요청의 수이고, inflight는 그중 링에 들어가 있는 요청의 수이다.
+ * ring_list는 링에 들어가 있는 요청의 목록으로, io_uring을 더 쓸 수 없게 되면 이 요청들을 오류로 끝낸다.
+ * closing이면 새 요청을 받지 않는다. 모든 값은 mutex로 보호한다.
+ */
+struct pool_io {
+    pthread_mutex_t mutex;          /* 입출력 상태를 보호하는 락 */
+    pthread_cond_t work;            /* 입출력 스레드가 요청을 기다리는 조건 */
+    pthread_cond_t idle;            /* 종료하는 쪽이 남은 요청이 끝나기를 기다리는 조건 */
+    pthread_pool_t *pool;           /* 완료 작업을 넣을 스레드풀 */
+    struct io_req *pending;         /* 아직 링이나 입출력 스레드에 넘기지 않은 요청 목록의 앞 */
+    struct io_req *pending_tail;    /* pending의 끝 */
+    struct io_req *free;            /* 다시 쓸 빈 요청 목록 */
+    int count;                      /* 받았지만 완료 작업을 넣지 않은 요청의 수 */
+    int inflight;                   /* 링에 들어가 있는 요청의 수 */
+    struct io_req *ring_list;       /* 링에 들어가 있는 요청의 목록 */
+    bool closing;                   /* 종료 중이면 true */
+    int ring_fd;                    /* io_uring의 파일 기술자, 쓸 수 없으면 -1 */
+    unsigned int sq_entries;        /* 링에 한 번에 넣을 수 있는 요청의 수 */
+    atomic_uint *sq_tail, *cq_head, *cq_tail;           /* 커널과 함께 보는 제출 링의 꼬리, 완료 링의 머리와 꼬리 */
+    unsigned int *sq_mask, *sq_array, *cq_mask;         /* 제출 링의 마스크와 배열, 완료 링의 마스크 */
+    void *sqes;                     /* 제출 항목 배열 */
+    void *cqes;                     /* 완료 항목 배열 */
+    void *sq_ring, *cq_ring;        /* mmap한 링 */
+    size_t sq_ring_size, cq_ring_size, sqes_size;       /* mmap한 크기 */
+    int nthreads;                   /* 만든 스레드의 수 */
+    pthread_t thread[];             /* reaper나 입출력 스레드 */
+};
+
+/*
+ * 현재 스레드가 일꾼이면 자기 덱을, 아니면 NULL을 가리킨다.
+ * 작업 안에서 다시 작업을 요청하면 이 값을 보고 자기 덱에 넣는다.
+ */
+static _Thread_local struct bee *my_bee;
+
+/*
+ * 현재 스레드가 실행 중인 작업에 붙은 취소 토큰을 가리킨다. 토큰이 없는 작업을 실행 중이거나 작업 밖이면 NULL이다.
+ * 실행 중인 작업은 pthread_pool_canceled()로 이 토큰이 만료되었는지 확인한다.
+ */
+static _Thread_local pool_token_t *my_token;
+
+/*
+ * 현재 스레드가 실행 중인 파이버를 가리킨다. 파이버 밖이면 NULL이다.
+ * 파이버는 다른 스레드에서 이어 실행될 수 있으므로 파이버 안에서는 멈췄다 돌아온 뒤 이 값을 다시 읽어야 한다.
+ */
+static _Thread_local struct pool_fiber *my_fiber;
+
+static void fiber_run(void *param);
+static void fiber_put(struct pool_fiber *fb);
+static void fiber_wake(struct pool_fiber *fb, int flag);
+static int fiber_future_wait(struct pool_future *fut, const struct timespec *abstime);
+
+/*
+ * 머신의 NUMA 구성이다. 리눅스에서는 /sys/devices/system/node의 노드마다 cpulist를 읽어 CPU 번호마다 노드를 정한다.
+ * 노드 번호는 CPU가 없는 노드와 비어 있는 번호를 건너뛰고 0부터 다시 매긴다. 노드 정보가 없으면 노드 하나로 본다.
+ * 처음 필요할 때 한 번만 읽어서 모든 스레드풀이 함께 쓴다.
+ */
+#define TOPO_MAXCPU 1024
+#define TOPO_MAXNODE 64
+
+static int topo_nodes = 1;                      /* NUMA 노드의 수 */
+static unsigned char topo_node[TOPO_MAXCPU];    /* CPU 번호마다 속한 노드 */
+static pthread_once_t topo_once = PTHREAD_ONCE_INIT;
+
+static void topo_load(void)
+{
+#ifdef __linux__
+    int nodes = 0;
+
+    for (int n = 0; n < TOPO_MAXNODE; n++) {
+        char path[64], line[4096];
+        bool any = false;
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", n);
+        FILE *fp = fopen(path, "r");
+        if (fp == NULL)
+            continue;
+        //"0-3,8-11" 꼴의 목록을 구간마다 읽는다.
+        if (fgets(line, sizeof(line), fp) != NULL) {
+            char *s = line;
+            while (*s >= '0' && *s <= '9') {
+                long lo = strtol(s, &s, 10), hi = lo;
+                if (*s == '-')
+                    hi = strtol(s + 1, &s, 10);
+                for (long c = lo; c <= hi && c < TOPO_MAXCPU; c++) {
+                    topo_node[c] = nodes;
+                    any = true;
+                }
+                if (*s == ',')
+                    s++;
+            }
+        }
+        fclose(fp);
+        if (any)
+            nodes++;
+    }
+    topo_nodes = nodes > 0 ? nodes : 1;
+#endif
+}
+
+/*
+ * CPU 번호 cpu가 속한 NUMA 노드를 리턴한다. 알 수 없는 CPU는 0번 노드로 본다.
+ */
+static int cpu_node(int cpu)
+{
+    return cpu >= 0 && cpu < TOPO_MAXCPU ? topo_node[cpu] : 0;
+}
+
+/*
+ * 현재 스레드가 먼저 써야 할 공유 대기열의 노드를 리턴한다.
+ * 같은 풀의 일꾼이면 자기 노드를, 아니면 지금 실행 중인 CPU의 노드를 쓴다.
+ */
+static int current_node(pthread_pool_t *pool)
+{
+    if (pool->nodes == 1)
+        return 0;
+    if (my_bee != NULL && my_bee->pool == pool)
+        return my_bee->node;
+#ifdef __linux__
+    return cpu_node(sched_getcpu());
+#else
+    return 0;
+#endif
+}
+
+/*
+ * 캐시 라인 경계에서 시작하는 size바이트의 공간을 할당한다. 실패하면 NULL을 리턴한다.
+ * task_t가 캐시 라인 하나를 채우므로 작업을 담는 배열을 이 공간에 두면 방마다 캐시 라인을 따로 쓴다.
+ * aligned_alloc()은 크기가 정렬 단위의 배수여야 하므로 크기를 올려서 잡는다.
+ */
+static void *line_alloc(size_t size)
+{
+    return aligned_alloc(64, (size + 63) & ~(size_t)63);
+}
+
+/*
+ * 크기가 size인 덱 버퍼를 할당한다. 실패하면 NULL을 리턴한다.
+ */
+static struct deque_buf *deque_buf_alloc(long size)
+{
+    struct deque_buf *d = (struct deque_buf *)line_alloc(sizeof(struct deque_buf) + size * sizeof(task_t));
+
+    if (d != NULL) {
+        d->mask = size - 1;
+        d->prev = NULL;
+    }
+    return d;
+}
+
+/*
+ * 주인 일꾼이 자기 덱의 bottom 쪽에 작업을 넣는다.
+ * 덱이 꽉 차면 두 배 크기의 버퍼로 옮긴다. 공간을 할당하지 못하면 false를 리턴한다.
+ * 작업 안에서 작업을 만드는 일꾼이 꽉 찬 공유 대기열을 기다리다 모두 멈추는 일이 없도록
+ * 덱은 크기 제한 없이 늘어난다.
+ */
+static bool deque_push(struct bee *b, const task_t *task)
+{
+    long bot = atomic_load_explicit(&b->bottom, memory_order_relaxed);
+    long top = atomic_load_explicit(&b->top, memory_order_acquire);
+    struct deque_buf *d = atomic_load_explicit(&b->buf, memory_order_relaxed);
+
+    if (bot - top > d->mask) {
+        struct deque_buf *n = deque_buf_alloc(2 * (d->mask + 1));
+        if (n == NULL)
+            return false;
+        for (long i = top; i < bot; i++)
+            n->slot[i & n->mask] = d->slot[i & d->mask];
+        n->prev = d;
+        atomic_store_explicit(&b->buf, n, memory_order_release);
+        d = n;
+    }
+    d->slot[bot & d->mask] = *task;
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&b->bottom, bot + 1, memory_order_relaxed);
+    return true;
+}
+
+/*
+ * 주인 일꾼이 자기 덱의 bottom 쪽에서 작업을 꺼낸다. 덱이 비었으면 false를 리턴한다.
+ * 마지막 하나를 두고 도둑과 경쟁하면 top에 대한 CAS로 승자를 가린다.
+ */
+static bool deque_pop(struct bee *b, task_t *task)
+{
+    long bot = atomic_load_explicit(&b->bottom, memory_order_relaxed) - 1;
+    atomic_store_explicit(&b->bottom, bot, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    long top = atomic_load_explicit(&b->top, memory_order_relaxed);
+
+    //덱이 비어 있으면 bottom을 원래대로 돌려놓는다.
+    if (top > bot) {
+        atomic_store_explicit(&b->bottom, bot + 1, memory_order_relaxed);
+        return false;
+    }
+    struct deque_buf *d = atomic_load_explicit(&b->buf, memory_order_relaxed);
+    *task = d->slot[bot & d->mask];
+    if (top == bot) {
+        bool won = atomic_compare_exchange_strong_explicit(&b->top, &top, top + 1,
+                                                           memory_order_seq_cst, memory_order_relaxed);
+        atomic_store_explicit(&b->bottom, bot + 1, memory_order_relaxed);
+        return won;
+    }
+    return true;
+}
+
+/*
+ * 다른 일꾼의 덱 top 쪽에서 작업 하나를 훔친다. 덱이 비었거나 경쟁에서 지면 false를 리턴한다.
+ */
+static bool deque_steal(struct bee *b, task_t *task)
+{
+    long top = atomic_load_explicit(&b->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    long bot = atomic_load_explicit(&b->bottom, memory_order_acquire);
+
+    if (top >= bot)
+        return false;
+    struct deque_buf *d = atomic_load_explicit(&b->buf, memory_order_acquire);
+    task_t t = d->slot[top & d->mask];
+    if (!atomic_compare_exchange_strong_explicit(&b->top, &top, top + 1,
+                                                 memory_order_seq_cst, memory_order_relaxed))
+        return false;
+    *task = t;
+    return true;
+}
+
+/*
+ * 덱에 작업이 남아 있는지 확인한다. 잠들기 직전의 일꾼이 마지막으로 확인할 때 사용한다.
+ */
+static bool deque_nonempty(struct bee *b)
+{
+    return atomic_load(&b->top) < atomic_load(&b->bottom);
+}
+
+/*
+ * futex 값이 아직 val이면 다른 스레드가 값을 바꾸고 깨우거나 절대 시각 abstime이 지날 때까지 잠든다.
+ * abstime은 pthread_cond_timedwait()처럼 CLOCK_REALTIME 기준이며 NULL이면 시간 제한 없이 기다린다.
+ * 시간이 지나서 깨어났으면 false를, 그 밖의 이유로 깨어났으면 true를 리턴한다.
+ * 리눅스가 아닌 곳에서는 하나의 뮤텍스와 조건 변수로 같은 동작을 흉내낸다.
+ */
+#ifdef __linux__
+static bool futex_timedwait(atomic_uint *addr, unsigned int val, const struct timespec *abstime)
+{
+    long r = syscall(SYS_futex, addr, FUTEX_WAIT_BITSET_PRIVATE | FUTEX_CLOCK_REALTIME, val,
+                     abstime, NULL, FUTEX_BITSET_MATCH_ANY);
+    return !(r == -1 && errno == ETIMEDOUT);
+}
+
+static void futex_wake(atomic_uint *addr, int n)
+{
+    syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, n, NULL, NULL, 0);
+}
+#else
+static pthread_mutex_t futex_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t futex_cond = PTHREAD_COND_INITIALIZER;
+
+static bool futex_timedwait(atomic_uint *addr, unsigned int val, const struct timespec *abstime)
+{
+    int r = 0;
+
+    pthread_mutex_lock(&futex_mutex);
+    if (atomic_load(addr) == val) {
+        if (abstime == NULL)
+            pthread_cond_wait(&futex_cond, &futex_mutex);
+        else
+            r = pthread_cond_timedwait(&futex_cond, &futex_mutex, abstime);
+    }
+    pthread_mutex_unlock(&futex_mutex);
+    return r != ETIMEDOUT;
+}
+
+static void futex_wake(atomic_uint *addr, int n)
+{
+    pthread_mutex_lock(&futex_mutex);
+    pthread_cond_broadcast(&futex_cond);
+    pthread_mutex_unlock(&futex_mutex);
+}
+#endif
+
+static void futex_wait(atomic_uint *addr, unsigned int val)
+{
+    futex_timedwait(addr, val, NULL);
+}
+
+/*
+ * 크기가 size인 락 없는 원형 버퍼를 할당한다. 칸 i의 순번은 i에서 시작한다.
+ */
+static struct ring *ring_alloc(size_t size)
+{
+    struct ring *r = (struct ring *)aligned_alloc(_Alignof(struct ring), sizeof(struct ring));
+
+    if (r == NULL)
+        return NULL;
+    if ((r->cell = (struct ring_cell *)line_alloc(size * sizeof(struct ring_cell))) == NULL) {
+        free(r);
+        return NULL;
+    }
+    for (size_t i = 0; i < size; i++)
+        atomic_init(&r->cell[i].seq, i);
+    atomic_init(&r->head, 0);
+    atomic_init(&r->tail, 0);
+    r->size = size;
+    return r;
+}
+
+static void ring_free(struct ring *r)
+{
+    if (r != NULL)
+        free(r->cell);
+    free(r);
+}
+
+/*
+ * 원형 버퍼에 작업을 넣는다. 빈 칸이 없으면 false를 리턴한다.
+ */
+static bool ring_push(struct ring *r, const task_t *task)
+{
+    size_t pos = atomic_load_explicit(&r->tail, memory_order_relaxed);
+
+    while (true) {
+        struct ring_cell *c = &r->cell[pos % r->size];
+        size_t seq = atomic_load_explicit(&c->seq, memory_order_acquire);
+        long dif = (long)(seq - pos);
+
+        //순번이 위치와 같으면 빈 칸이므로 tail을 한 칸 밀어서 차지한다.
+        if (dif == 0) {
+            if (atomic_compare_exchange_weak_explicit(&r->tail, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                c->task = *task;
+                atomic_store_explicit(&c->seq, pos + 1, memory_order_release);
+                return true;
+            }
+        }
+        //순번이 뒤처져 있으면 소비자가 아직 한 바퀴 전의 작업을 꺼내지 않은 것이므로 꽉 찬 상태이다.
+        else if (dif < 0)
+            return false;
+        else
+            pos = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    }
+}
+
+/*
+ * 원형 버퍼에 작업을 최대 n개까지 넣고 넣은 개수를 리턴한다.
+ * tail부터 이어지는 빈 칸의 수를 센 다음, 그만큼을 tail에 대한 CAS 한 번으로 한꺼번에 차지한다.
+ * CAS가 성공하면 센 칸은 모두 이 스레드의 것이므로 작업을 채우고 순번을 바꾸기만 하면 된다.
+ */
+static size_t ring_push_many(struct ring *r, const task_t *tasks, size_t n)
+{
+    size_t pos = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    size_t k;
+
+    do {
+        if (n > r->size)
+            n = r->size;
+        for (k = 0; k < n; k++)
+            if (atomic_load_explicit(&r->cell[(pos + k) % r->size].seq, memory_order_acquire) != pos + k)
+                break;
+        if (k == 0) {
+            //첫 칸이 비어 있지 않은 이유가 다른 생산자가 이미 차지했기 때문이면 다시 시도한다.
+            size_t cur = atomic_load_explicit(&r->tail, memory_order_relaxed);
+            if (cur == pos)
+                return 0;
+            pos = cur;
+            continue;
+        }
+    } while (k == 0 || !atomic_compare_exchange_weak_explicit(&r->tail, &pos, pos + k,
+                                                              memory_order_relaxed, memory_order_relaxed));
+
+    for (size_t i = 0; i < k; i++) {
+        struct ring_cell *c = &r->cell[(pos + i) % r->size];
+        c->task = tasks[i];
+        atomic_store_explicit(&c->seq, pos + i + 1, memory_order_release);
+    }
+    return k;
+}
+
+/*
+ * 원형 버퍼에서 작업을 최대 n개까지 꺼내고 꺼낸 개수를 리턴한다.
+ * head부터 이어지는 채워진 칸의 수를 센 다음, 그만큼을 head에 대한 CAS 한 번으로 한꺼번에 차지한다.
+ */
+static size_t ring_pop_many(struct ring *r, task_t *tasks, size_t n)
+{
+    size_t pos = atomic_load_explicit(&r->head, memory_order_relaxed);
+    size_t k;
+
+    do {
+        if (n > r->size)
+            n = r->size;
+        for (k = 0; k < n; k++)
+            if (atomic_load_explicit(&r->cell[(pos + k) % r->size].seq, memory_order_acquire) != pos + k + 1)
+                break;
+        if (k == 0) {
+            size_t cur = atomic_load_explicit(&r->head, memory_order_relaxed);
+            if (cur == pos)
+                return 0;
+            pos = cur;
+            continue;
+        }
+    } while (k == 0 || !atomic_compare_exchange_weak_explicit(&r->head, &pos, pos + k,
+                                                              memory_order_relaxed, memory_order_relaxed));
+
+    for (size_t i = 0; i < k; i++) {
+        struct ring_cell *c = &r->cell[(pos + i) % r->size];
+        tasks[i] = c->task;
+        atomic_store_explicit(&c->seq, pos + i + r->size, memory_order_release);
+    }
+    return k;
+}
+
+/*
+ * 원형 버퍼에 작업이 들어 있거나 들어오는 중인지 확인한다. 잠들기 직전에 마지막으로 확인할 때 사용한다.
+ */
+static bool ring_nonempty(struct ring *r)
+{
+    return atomic_load(&r->tail) != atomic_load(&r->head);
+}
+
+/*
+ * 원형 버퍼가 꽉 찼는지 확인한다. 빈 자리를 기다리며 잠들기 직전에 마지막으로 확인할 때 사용한다.
+ */
+static bool ring_full(struct ring *r)
+{
+    return atomic_load(&r->tail) - atomic_load(&r->head) >= r->size;
+}
+
+/*
+ * 잠들기 전에 돌거나 양보하며 기다리도록 설정했으면 true를 리턴한다.
+ */
+static bool spin_enabled(pthread_pool_t *pool)
+{
+    return pool->spin_ns > 0 || pool->yields > 0;
+}
+
+/*
+ * 한 스레드만 고치는 카운터 c에 v를 더한다. 읽는 쪽이 따로 있으므로 원자적으로 읽고 쓰지만,
+ * 고치는 쪽이 하나뿐이라 fetch_add 같은 비싼 명령 없이 보통의 덧셈과 같은 비용이 든다.
+ */
+static void stat_add(atomic_ulong *c, unsigned long v)
+{
+    atomic_store_explicit(c, atomic_load_explicit(c, memory_order_relaxed) + v, memory_order_relaxed);
+}
+
+/*
+ * 값 v(나노초)가 들어갈 히스토그램의 칸을 리턴한다. 8보다 작은 값은 값마다 한 칸씩이고,
+ * 그보다 큰 값은 2^e 이상 2^(e+1) 미만의 구간을 8칸으로 나눠 v의 상위 4비트로 칸을 고른다.
+ * 범위를 넘는 값은 마지막 칸에 넣는다.
+ */
+#define HIST_SUB_BITS 3
+
+static int hist_bucket(long v)
+{
+    if (v < (1 << HIST_SUB_BITS))
+        return v < 0 ? 0 : (int)v;
+    int e = 63 - __builtin_clzl((unsigned long)v);
+    int b = ((e - HIST_SUB_BITS + 1) << HIST_SUB_BITS) | (int)((v >> (e - HIST_SUB_BITS)) & ((1 << HIST_SUB_BITS) - 1));
+    return b < POOL_HIST_BUCKETS ? b : POOL_HIST_BUCKETS - 1;
+}
+
+/*
+ * 공유 대기열에 쌓인 작업의 수 len을 보고 최댓값 q_high를 고친다. 보통은 읽기 한 번으로 끝난다.
+ */
+static void depth_note(pthread_pool_t *pool, int len)
+{
+    int high = atomic_load_explicit(&pool->q_high, memory_order_relaxed);
+
+    while (len > high && !atomic_compare_exchange_weak_explicit(&pool->q_high, &high, len,
+                                                                memory_order_relaxed, memory_order_relaxed))
+        ;
+}
+
+/*
+ * 우선순위 단계 l의 대기열에 작업이 남아 있는지 확인한다. 락을 쓰는 대기열이면 mutex를 잡고 호출한다.
+ */
+static bool lane_nonempty(pthread_pool_t *pool, int l)
+{
+    struct pool_lane *lane = &pool->lane[l];
+
+    return lane->ring != NULL ? ring_nonempty(lane->ring) : lane->len > 0;
+}
+
+/*
+ * 우선순위 단계 l에서 작업이 남아 있는 대기열을 찾아 lane 배열에서의 위치를 리턴한다. 없으면 -1이다.
+ * node의 대기열을 먼저 보고, 비어 있으면 다음 노드부터 차례로 본다.
+ */
+static int lane_find(pthread_pool_t *pool, int node, int l)
+{
+    for (int k = 0; k < pool->nodes; k++) {
+        int i = (node + k) % pool->nodes * pool->prio + l;
+        if (lane_nonempty(pool, i))
+            return i;
+    }
+    return -1;
+}
+
+/*
+ * 다음에 작업을 꺼낼 대기열을 골라 lane 배열에서의 위치를 리턴한다. 모든 대기열이 비어 있으면 -1을 리턴한다.
+ * 보통은 작업이 남아 있는 가장 높은 단계를 고르지만, age번 이상 밀린 단계가 있으면 그 단계를 먼저 고른다.
+ * 고른 단계보다 낮으면서 작업이 남아 있는 단계는 밀린 횟수를 하나씩 늘린다. 밀린 횟수는 node의 대기열에서 센다.
+ * 같은 단계 안에서는 node의 대기열을 먼저 고른다.
+ * 락 없는 대기열에서는 여러 일꾼이 동시에 세므로 횟수가 조금 어긋날 수 있지만, 굶는 단계가 없게 하는 데는 충분하다.
+ */
+static int lane_pick(pthread_pool_t *pool, int node)
+{
+    struct pool_lane *own = &pool->lane[node * pool->prio];
+    int pick = -1;
+
+    if (pool->prio == 1)
+        return lane_find(pool, node, 0);
+    if (pool->age > 0) {
+        for (int l = 1; l < pool->prio && pick < 0; l++)
+            if (atomic_load_explicit(&own[l].passed, memory_order_relaxed) >= (unsigned int)pool->age)
+                pick = lane_find(pool, node, l);
+    }
+    for (int l = 0; l < pool->prio && pick < 0; l++)
+        pick = lane_find(pool, node, l);
+    if (pick < 0 || pool->age == 0)
+        return pick;
+
+    int level = pick % pool->prio;
+    atomic_store_explicit(&own[level].passed, 0, memory_order_relaxed);
+    for (int l = level + 1; l < pool->prio; l++)
+        if (lane_find(pool, node, l) >= 0)
+            atomic_fetch_add_explicit(&own[l].passed, 1, memory_order_relaxed);
+    return pick;
+}
+
+/*
+ * 락 없는 대기열의 어느 노드, 어느 단계에든 작업이 들어 있거나 들어오는 중인지 확인한다.
+ */
+static bool queue_nonempty(pthread_pool_t *pool)
+{
+    for (int i = 0; i < pool->nodes * pool->prio; i++)
+        if (lane_nonempty(pool, i))
+            return true;
+    return false;
+}
+
+/*
+ * lane 배열의 l번째 대기열에서 작업 하나를 꺼낸다. 반드시 mutex를 잡은 상태에서 호출한다.
+ * 대기열이 꽉 차 있다가 자리가 생기면 기다리고 있던 스레드를 깨우고, 돌며 기다리는 스레드가 알 수 있게 notfull을 바꾼다.
+ */
+static void queue_take(pthread_pool_t *pool, int l, task_t *task)
+{
+    struct pool_lane *lane = &pool->lane[l];
+
+    *task = lane->q[lane->front];
+    lane->front = (lane->front + 1) % pool->q_size;
+    lane->len--;
+    pool->q_len--;
+    if (lane->len == pool->q_size - 1) {
+        pthread_cond_broadcast(&pool->full);
+        if (spin_enabled(pool))
+            atomic_fetch_add_explicit(&pool->notfull, 1, memory_order_relaxed);
+    }
+}
+
+/*
+ * lane 배열의 l번째 대기열 끝에 작업을 넣는다. 반드시 mutex를 잡은 상태에서 빈 자리가 있을 때 호출한다.
+ * 모든 대기열이 비어 있다가 작업이 들어오면 돌며 기다리는 일꾼이 알 수 있게 notempty를 바꾼다.
+ */
+static void queue_put(pthread_pool_t *pool, int l, const task_t *task)
+{
+    struct pool_lane *lane = &pool->lane[l];
+
+    lane->q[(lane->front + lane->len) % pool->q_size] = *task;
+    lane->len++;
+    pool->q_len++;
+    depth_note(pool, pool->q_len);
+    if (pool->q_len == 1 && spin_enabled(pool))
+        atomic_fetch_add_explicit(&pool->notempty, 1, memory_order_relaxed);
+}
+
+/*
+ * 빈 핸들 목록에서 핸들 하나를 꺼낸다. 목록이 비어 있으면 FUTURE_SLAB개를 새로 만든다.
+ * 작업마다 공간을 할당하지 않도록 다 쓴 핸들은 목록으로 돌려보내 다시 쓴다. 실패하면 NULL을 리턴한다.
+ */
+static struct pool_future *future_get(pthread_pool_t *pool)
+{
+    struct pool_future *fut;
+
+    pthread_mutex_lock(&pool->fut_mutex);
+    if (pool->fut_free == NULL) {
+        struct future_slab *slab = (struct future_slab *)malloc(sizeof(struct future_slab));
+        if (slab == NULL) {
+            pthread_mutex_unlock(&pool->fut_mutex);
+            return NULL;
+        }
+        slab->next = pool->fut_slab;
+        pool->fut_slab = slab;
+        for (int i = 0; i < FUTURE_SLAB; i++) {
+            slab->f[i].pool = pool;
+            slab->f[i].next = pool->fut_free;
+            pool->fut_free = &slab->f[i];
+        }
+    }
+    fut = pool->fut_free;
+    pool->fut_free = fut->next;
+    pthread_mutex_unlock(&pool->fut_mutex);
+
+    atomic_store(&fut->state, FUTURE_PENDING);
+    atomic_store(&fut->waiters, 0);
+    atomic_store(&fut->refs, 2);
+    fut->group = NULL;
+    fut->token = NULL;
+    atomic_store(&fut->fibers, NULL);
+    atomic_store(&fut->thens, NULL);
+    return fut;
+}
+
+/*
+ * 핸들에 대한 참조 하나를 놓는다. 마지막 참조였으면 빈 핸들 목록으로 돌려보낸다.
+ */
+static void future_put(struct pool_future *fut)
+{
+    if (atomic_fetch_sub(&fut->refs, 1) == 1) {
+        pthread_pool_t *pool = fut->pool;
+        pthread_mutex_lock(&pool->fut_mutex);
+        fut->next = pool->fut_free;
+        pool->fut_free = fut;
+        pthread_mutex_unlock(&pool->fut_mutex);
+    }
+}
+
+static void future_run(void *param);
+static int future_submit(struct pool_future *fut);
+
+/*
+ * 핸들의 상태를 state로 정하고 기다리는 스레드와 파이버를 모두 깨운 뒤 작업 쪽의 참조를 놓는다.
+ * 작업을 실행해서 끝났으면 붙어 있던 후속 작업 하나를 리턴하여 호출한 쪽이 그 자리에서 이어 실행하게 하고,
+ * 나머지 후속 작업은 대기열에 넣는다. 버려졌으면 후속 작업과 그 뒤에 붙은 작업까지 모두 버리고 NULL을 리턴한다.
+ * 후속 작업이 길게 이어져도 스택이 자라지 않도록 버릴 작업은 되부르지 않고 목록에 모아 차례로 처리한다.
+ */
+static struct pool_future *future_finish(struct pool_future *fut, unsigned int state)
+{
+    struct pool_future *run = NULL, *drop = NULL;
+
+    for (;;) {
+        atomic_store(&fut->state, state);
+        if (atomic_load(&fut->waiters) > 0)
+            futex_wake(&fut->state, INT_MAX);
+
+        //완료를 기다리며 멈춘 파이버를 모두 다시 요청한다. 목록을 닫아 두므로 뒤늦게 멈추려는 파이버는 들어오지 못한다.
+        struct pool_fiber *fb = atomic_exchange(&fut->fibers, FIBERS_CLOSED);
+        while (fb != NULL) {
+            struct pool_fiber *next = fb->next;
+            fiber_wake(fb, POOL_NOWAIT);
+            fb = next;
+        }
+
+        //후속 작업 목록도 같은 방식으로 닫는다. 닫은 뒤에 붙이려는 쪽은 상태를 보고 직접 처리한다.
+        struct pool_future *then = atomic_exchange(&fut->thens, THENS_CLOSED);
+        future_put(fut);
+        while (then != NULL) {
+            struct pool_future *next = then->next;
+            if (state != FUTURE_DONE) {
+                then->next = drop;
+                drop = then;
+            }
+            else if (run == NULL)
+                run = then;
+            else
+                future_submit(then);
+            then = next;
+        }
+        if (drop == NULL)
+            return run;
+        fut = drop;
+        drop = drop->next;
+    }
+}
+
+/*
+ * 그룹에 속한 작업 하나가 끝났음을 알린다. 마지막 작업이면 group_wait에서 잠든 스레드를 깨운다.
+ * 카운터가 0이 되는 순간 그룹을 기다리던 쪽이 그룹을 없앨 수 있으므로, 그 뒤에는 그룹의 필드를 읽지 않고
+ * 주소만으로 깨운다.
+ */
+static void group_done(pool_group_t *group)
+{
+    if (atomic_fetch_sub(&group->pending, 1) == 1)
+        futex_wake(&group->pending, INT_MAX);
+}
+
+/*
+ * 핸들이 달린 작업을 대기열에 넣을 때 쓰는 작업 함수이다. 실제 작업을 실행한 뒤 완료를 알린다.
+ * 작업에 붙인 취소 토큰이 이미 만료되었으면 실행하지 않고 버려졌다고 알린다.
+ * 끝난 작업에 후속 작업이 붙어 있으면 대기열을 거치지 않고 이 자리에서 이어 실행한다.
+ * 되부르지 않고 반복하므로 후속 작업이 아무리 길게 이어져도 스택은 자라지 않는다.
+ */
+static void future_run(void *param)
+{
+    struct pool_future *fut = (struct pool_future *)param;
+
+    while (fut != NULL) {
+        pool_group_t *group = fut->group;
+        pool_token_t *token = fut->token;
+
+        //토큰이 만료되었으면 실행하지 않고 버린다.
+        if (token != NULL && pthread_pool_token_expired(token)) {
+            atomic_fetch_add_explicit(&fut->pool->canceled, 1, memory_order_relaxed);
+            if (group != NULL)
+                group_done(group);
+            fut = future_finish(fut, FUTURE_DROPPED);
+            continue;
+        }
+
+        //작업 안에서 토큰을 확인할 수 있도록 실행하는 동안 my_token에 걸어 둔다.
+        //작업이 다른 작업의 완료를 기다리며 작업을 대신 실행할 수 있으므로 앞의 값을 되돌려 놓는다.
+        pool_token_t *saved = my_token;
+        my_token = token;
+        fut->function(fut->param);
+        my_token = saved;
+        if (group != NULL)
+            group_done(group);
+        fut = future_finish(fut, FUTURE_DONE);
+    }
+}
+
+static void timer_run(void *param);
+static void timer_put(struct pool_timer *t);
+static void strand_run(void *param);
+static void strand_drop(pool_strand_t *strand);
+static void io_done(void *param);
+static void io_put(struct io_req *req);
+static void io_ring_unmap(struct pool_io *io);
+static void io_free(struct pool_io *io);
+
+/*
+ * pthread_pool_submit_inline()으로 넣은 작업의 param이 가리키는 표시이다. 주소만 쓰며 값은 의미가 없다.
+ */
+static const char inline_mark;
+
+/*
+ * 작업 task를 실행한다. 인자를 작업 안에 복사해 둔 작업이면 param 대신 task의 arg 주소를 넘긴다.
+ * task는 대기열에서 꺼내 온 사본이므로 함수가 끝날 때까지 arg가 그대로 남아 있다.
+ */
+static void task_call(task_t *task)
+{
+    task->function(task->param == &inline_mark ? (void *)task->arg : task->param);
+}
+
+/*
+ * 실행하지 않고 버리는 작업을 정리한다. 핸들이 달린 작업이면 버려졌다고 알려서 기다리는 스레드가 멈추지 않게 한다.
+ * 그룹에 속한 작업이면 그룹의 카운터도 줄이고, 타이머가 실행하려던 작업이면 타이머를 놓는다.
+ * 스트랜드를 실행하는 작업이면 스트랜드에 남은 작업도 함께 버린다.
+ * 파이버를 실행하는 작업이면 파이버를 빈 목록으로 돌려보낸다. 멈춰 있던 파이버는 나머지를 실행하지 못한다.
+ * 입출력 완료 작업이면 완료 함수를 부르지 않고 요청을 빈 목록으로 돌려보낸다.
+ */
+static void task_drop(const task_t *task)
+{
+    if (task->function == future_run) {
+        struct pool_future *fut = (struct pool_future *)task->param;
+        if (fut->group != NULL)
+            group_done(fut->group);
+        future_finish(fut, FUTURE_DROPPED);
+    }
+    else if (task->function == timer_run)
+        timer_put((struct pool_timer *)task->param);
+    else if (task->function == strand_run)
+        strand_drop((pool_strand_t *)task->param);
+    else if (task->function == fiber_run)
+        fiber_put((struct pool_fiber *)task->param);
+    else if (task->function == io_done)
+        io_put((struct io_req *)task->param);
+}
+
+/*
+ * 버리는 작업 task의 함수와 인자를 reject 함수로 알린다. reject 함수가 없으면 아무것도 하지 않는다.
+ * 핸들이나 타이머를 거쳐 들어온 작업이면 요청한 쪽이 넘긴 함수와 인자를 알려 준다.
+ * reject 안에서 다시 작업을 요청할 수 있으므로 반드시 락을 모두 푼 상태에서 호출한다.
+ */
+static void task_report(pthread_pool_t *pool, const task_t *task)
+{
+    void (*f)(void *p) = task->function;
+    void *p = task->param == &inline_mark ? (void *)task->arg : task->param;
+
+    if (pool->reject == NULL)
+        return;
+    if (f == future_run) {
+        struct pool_future *fut = (struct pool_future *)p;
+        f = fut->function;
+        p = fut->param;
+    }
+    else if (f == timer_run) {
+        struct pool_timer *t = (struct pool_timer *)p;
+        f = t->function;
+        p = t->param;
+    }
+    pool->reject(f, p, pool->reject_ctx);
+}
+
+/*
+ * POOL_DROP_OLDEST로 대기열에서 빼낸 작업 task를 버린다. reject 함수가 있으면 먼저 task_report()로 작업의 함수와 인자를
+ * 알려 준 뒤 task_drop()으로 정리한다.
+ * 스트랜드를 실행하는 작업은 버리면 스트랜드에 남은 작업까지 모두 버려지므로, 버리는 대신 이 자리에서 실행한다.
+ * 멈춰 있던 파이버를 이어 실행하는 작업도 버리면 파이버가 하다 만 일이 사라지므로 마찬가지로 실행한다.
+ * 입출력 완료 작업은 입출력이 이미 끝났으므로 결과를 알리도록 실행한다.
+ * reject 안에서 다시 작업을 요청할 수 있으므로 반드시 락을 모두 푼 상태에서 호출한다.
+ */
+static void task_reject(pthread_pool_t *pool, task_t *task)
+{
+    void (*f)(void *p) = task->function;
+    void *p = task->param == &inline_mark ? (void *)task->arg : task->param;
+
+    if (f == strand_run || f == fiber_run || f == io_done) {
+        f(p);
+        return;
+    }
+    atomic_fetch_add_explicit(&pool->dropped, 1, memory_order_relaxed);
+    task_report(pool, task);
+    task_drop(task);
+}
+
+/*
+ * 종료하면서 실행하지 않기로 한 작업 task를 버리고 discarded에 센다.
+ * pthread_pool_shutdown_drain()이 시간을 넘겨 버리는 작업이면 task_report()로 reject 함수에 알린다.
+ */
+static void shutdown_drop(pthread_pool_t *pool, const task_t *task)
+{
+    atomic_fetch_add_explicit(&pool->discarded, 1, memory_order_relaxed);
+    if (atomic_load(&pool->draining))
+        task_report(pool, task);
+    task_drop(task);
+}
+
+/*
+ * 스레드풀에서 일어난 사건을 남기는 기록 버퍼이다. 최근 사건을 크기만큼 원형으로 남기며 오래된 사건부터 덮어쓴다.
+ * 일꾼의 버퍼는 그 일꾼 혼자 쓰고, 스레드풀의 trace는 일꾼이 아닌 스레드들이 head를 fetch_add로 나눠 쓴다.
+ * 칸의 seq에는 그 칸에 쓴 사건의 순번 + 1을 적고 쓰는 동안에는 0으로 둔다. 읽는 쪽은 사건을 복사하기 전후의 seq를 비교해
+ * 그 사이 덮어쓴 칸을 버리므로, 사건을 남기는 쪽은 락을 잡거나 기다리지 않는다.
+ * 시각은 값싼 시계 값(x86이면 TSC)으로 적어 두고 파일에 쓸 때 나노초로 바꾼다.
+ */
+#define TRACE_SUBMIT 0              /* 작업을 요청함, n은 함께 넣은 작업의 수 */
+#define TRACE_DEQUEUE 1             /* 공유 대기열에서 작업을 꺼냄, n은 꺼낸 작업의 수 */
+#define TRACE_STEAL 2               /* 다른 일꾼의 덱에서 작업을 훔침, n은 훔쳐 온 일꾼의 번호 */
+#define TRACE_START 3               /* 작업을 시작함 */
+#define TRACE_END 4                 /* 작업이 끝남 */
+#define TRACE_PARK 5                /* 일꾼이 잠듦 */
+#define TRACE_UNPARK 6              /* 일꾼이 깨어남 */
+
+struct trace_event {
+    atomic_ulong seq;               /* 이 칸에 쓴 사건의 순번 + 1, 쓰는 동안에는 0 */
+    unsigned long long tick;        /* 사건이 일어난 시계 값 */
+    void (*function)(void *p);      /* 사건과 관련된 작업의 함수 */
+    long n;                         /* 사건마다 뜻이 다른 값 */
+    int tid;                        /* 사건을 남긴 스레드의 번호, 일꾼이면 hive에서의 위치 */
+    int type;                       /* 사건의 종류 */
+};
+
+struct trace_buf {
+    atomic_ulong head;              /* 다음에 쓸 사건의 순번 */
+    unsigned long mask;             /* 칸의 수 - 1 */
+    struct trace_event ev[];        /* 사건을 담는 칸 */
+};
+
+static _Thread_local int trace_tid;     /* 일꾼이 아닌 스레드의 번호, 0이면 아직 받지 않음 */
+static atomic_int trace_tids;           /* 일꾼이 아닌 스레드에게 준 번호의 수 */
+
+/*
+ * 사건에 적을 시계 값을 리턴한다. x86이면 TSC를 읽고, 아니면 CLOCK_MONOTONIC 기준의 나노초를 쓴다.
+ */
+static unsigned long long trace_clock(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+/*
+ * 사건 size개(2의 거듭제곱)를 남길 수 있는 기록 버퍼를 할당한다.
+ */
+static struct trace_buf *trace_alloc(int size)
+{
+    struct trace_buf *t = (struct trace_buf *)calloc(1, sizeof(struct trace_buf) + size * sizeof(struct trace_event));
+
+    if (t != NULL)
+        t->mask = size - 1;
+    return t;
+}
+
+/*
+ * 현재 스레드가 pool에서 일어난 사건 type을 남긴다. f는 관련된 작업의 함수이고 n은 사건마다 뜻이 다른 값이다.
+ * 이 풀의 일꾼이면 자기 버퍼에 쓰고, 아니면 스레드풀의 공용 버퍼에서 칸을 차지해 쓴다.
+ * 호출하는 쪽이 pool->trace가 NULL이 아닌지 먼저 확인하므로, 사건을 남기지 않으면 분기 하나만 든다.
+ */
+static void trace_note(pthread_pool_t *pool, int type, void (*f)(void *p), long n)
+{
+    struct bee *self = my_bee;
+    struct trace_buf *t;
+    unsigned long i;
+    int tid;
+
+    if (self != NULL && self->pool == pool) {
+        t = self->trace;
+        i = atomic_load_explicit(&t->head, memory_order_relaxed);
+        atomic_store_explicit(&t->head, i + 1, memory_order_relaxed);
+        tid = self->id;
+    }
+    else {
+        if (trace_tid == 0)
+            trace_tid = atomic_fetch_add_explicit(&trace_tids, 1, memory_order_relaxed) + 1;
+        t = pool->trace;
+        i = atomic_fetch_add_explicit(&t->head, 1, memory_order_relaxed);
+        tid = POOL_MAXBSIZE + trace_tid;
+    }
+
+    struct trace_event *e = &t->ev[i & t->mask];
+    atomic_store_explicit(&e->seq, 0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    e->tick = trace_clock();
+    e->function = f;
+    e->n = n;
+    e->tid = tid;
+    e->type = type;
+    atomic_store_explicit(&e->seq, i + 1, memory_order_release);
+}
+
+/*
+ * 사건에 적을 작업 task의 함수를 리턴한다. 핸들이나 타이머를 거쳐 들어온 작업이나 파이버이면 요청한 쪽이 넘긴 함수를 리턴한다.
+ */
+static void (*trace_function(const task_t *task))(void *p)
+{
+    if (task->function == future_run)
+        return ((struct pool_future *)task->param)->function;
+    if (task->function == timer_run)
+        return ((struct pool_timer *)task->param)->function;
+    if (task->function == fiber_run)
+        return ((struct pool_fiber *)task->param)->function;
+    return task->function;
+}
+
+/*
+ * 작업 task를 시작한다는 사건을 남기고 사건에 적은 함수를 리턴한다. 작업이 끝나면 이 함수로 TRACE_END를 남긴다.
+ * 작업이 끝난 뒤에는 핸들이 다른 작업에 다시 쓰일 수 있으므로 함수를 미리 받아 둔다.
+ */
+static void (*trace_start(pthread_pool_t *pool, const task_t *task))(void *p)
+{
+    void (*f)(void *p) = trace_function(task);
+
+    trace_note(pool, TRACE_START, f, 0);
+    return f;
+}
+
+/*
+ * 한 번에 가져갈 작업의 수를 정한다. 대기열이 깊을 때만 여러 개를 가져가도록,
+ * 남은 작업을 일꾼 수로 나눈 몫과 max 가운데 작은 값을 쓰되 적어도 하나는 가져간다.
+ */
+static size_t claim_share(pthread_pool_t *pool, size_t len, size_t max)
+{
+    int bees = atomic_load(&pool->bee_size);
+    size_t share = bees > 0 ? len / bees : len;
+
+    if (share > max)
+        share = max;
+    return share > 0 ? share : 1;
+}
+
+/*
+ * 공유 대기열 q에서 작업을 최대 max개까지 꺼내 tasks에 담고 꺼낸 수를 리턴한다.
+ * 한 번에 꺼내는 작업은 모두 lane_pick()이 node를 기준으로 고른 한 대기열에서 가져온다.
+ * 반드시 mutex를 잡은 상태에서 호출한다.
+ */
+static size_t queue_take_many(pthread_pool_t *pool, int node, task_t *tasks, size_t max)
+{
+    int l;
+
+    if (pool->q_len == 0 || (l = lane_pick(pool, node)) < 0)
+        return 0;
+
+    size_t k = claim_share(pool, pool->lane[l].len, max);
+    for (size_t i = 0; i < k; i++)
+        queue_take(pool, l, &tasks[i]);
+    return k;
+}
+
+/*
+ * 공유 대기열에서 작업을 최대 max개까지 꺼내 tasks에 담고 꺼낸 수를 리턴한다. 꺼낼 작업이 없으면 0이다.
+ * 락을 쓰는 대기열이면 한 번의 임계구역에서, 락 없는 대기열이면 한 번의 CAS로 가져온다.
+ * 락 없는 대기열에서 작업을 꺼낸 뒤 빈 자리를 기다리며 잠든 요청 스레드가 있으면 모두 깨운다.
+ * NUMA 노드마다 대기열을 나눴으면 현재 스레드의 노드에서 먼저 꺼낸다.
+ */
+static size_t queue_claim(pthread_pool_t *pool, task_t *tasks, size_t max)
+{
+    int node = current_node(pool);
+    size_t k;
+
+    if (pool->ring != NULL) {
+        int l = lane_pick(pool, node);
+        if (l < 0)
+            return 0;
+        struct ring *r = pool->lane[l].ring;
+        size_t len = atomic_load(&r->tail) - atomic_load(&r->head);
+        if ((k = ring_pop_many(r, tasks, claim_share(pool, len, max))) == 0)
+            return 0;
+        atomic_thread_fence(memory_order_seq_cst);
+        if (atomic_load(&pool->blocked) > 0) {
+            atomic_fetch_add(&pool->notfull, 1);
+            futex_wake(&pool->notfull, INT_MAX);
+        }
+    }
+    else {
+        pthread_mutex_lock(&pool->mutex);
+        k = queue_take_many(pool, node, tasks, max);
+        pthread_mutex_unlock(&pool->mutex);
+    }
+    if (pool->trace != NULL && k > 0)
+        trace_note(pool, TRACE_DEQUEUE, trace_function(&tasks[0]), k);
+    return k;
+}
+
+/*
+ * 공유 대기열에서 작업 하나를 꺼낸다. 꺼낼 작업이 없으면 false를 리턴한다.
+ */
+static bool queue_trypop(pthread_pool_t *pool, task_t *task)
+{
+    return queue_claim(pool, task, 1) == 1;
+}
+
+/*
+ * 작업 훔치기 모드에서 어느 일꾼의 덱이든 작업이 남아 있는지 확인한다.
+ */
+static bool hive_nonempty(pthread_pool_t *pool)
+{
+    if (pool->sched != POOL_SCHED_STEAL)
+        return false;
+    for (int i = 0; i < pool->bee_size; i++)
+        if (deque_nonempty(pool->hive[i]))
+            return true;
+    return false;
+}
+
+/*
+ * 프로세스 전체가 함께 쓰는 공유 일꾼이다. 처음 shared 스레드풀을 만들 때 CPU 수만큼 스레드를 만들고,
+ * 스레드 캐시의 스레드처럼 스레드풀이 모두 종료되어도 끝내지 않고 잠들어 있다가 다음 스레드풀에 다시 쓴다.
+ * 공유 일꾼을 쓰는 스레드풀은 cursor에서 시작하는 원형 목록을 이루며, 목록과 스레드풀의 deficit, busy는 mutex로 보호한다.
+ * 잠든 공유 일꾼은 seq를 futex로 기다린다. 작업을 넣는 쪽은 락을 잡지 않고 idle을 본 뒤 seq를 바꿔 깨우므로,
+ * 스레드풀의 락을 잡은 채로 깨워도 된다. left는 종료하는 스레드풀의 작업을 실행 중인 공유 일꾼이 끝나기를 기다리는 조건이다.
+ */
+static struct {
+    pthread_mutex_t mutex;          /* 목록을 보호하는 상호배타 락 */
+    pthread_cond_t left;            /* 목록에서 빠진 스레드풀의 busy가 0이 되기를 기다리는 조건 */
+    pthread_pool_t *cursor;         /* 원형 목록에서 다음 차례의 스레드풀, 목록이 비었으면 NULL */
+    int tenants;                    /* 목록에 있는 스레드풀의 수 */
+    int nthreads;                   /* 만든 공유 일꾼의 수 */
+    atomic_int idle;                /* 잠들려고 하거나 잠든 공유 일꾼의 수 */
+    atomic_uint seq;                /* 작업이 들어올 때마다 바뀌는 futex 값 */
+} shared_bees = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, NULL, 0, 0, 0, 0 };
+
+/*
+ * 잠든 공유 일꾼을 최대 n명까지 깨운다. 잠드는 쪽은 idle을 올린 뒤 다시 찾아보고, 깨우는 쪽은 작업을 넣은 뒤 idle을 보므로
+ * 깨우기를 놓치지 않는다.
+ */
+static void shared_wake(int n)
+{
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load(&shared_bees.idle) > 0 && n > 0) {
+        atomic_fetch_add(&shared_bees.seq, 1);
+        futex_wake(&shared_bees.seq, n);
+    }
+}
+
+/*
+ * 작업을 n개 넣은 뒤 잠든 일꾼이 있으면 최대 n명까지 깨운다.
+ * 잠드는 쪽은 idle을 올린 뒤 대기열과 덱을 다시 확인하고, 넣는 쪽은 넣은 뒤 idle을 확인하므로
+ * 둘 중 적어도 한 쪽은 상대를 보게 되어 깨우기를 놓치지 않는다. 공유 일꾼을 쓰면 공유 일꾼을 깨운다.
+ */
+static void wake_idle_bees(pthread_pool_t *pool, size_t n)
+{
+    if (pool->shared) {
+        shared_wake(n < INT_MAX ? (int)n : INT_MAX);
+        return;
+    }
+    atomic_thread_fence(memory_order_seq_cst);
+    int idle = atomic_load(&pool->idle);
+    if (idle > 0 && n > 0) {
+        int k = n < (size_t)idle ? (int)n : idle;
+        if (pool->ring != NULL) {
+            atomic_fetch_add(&pool->notempty, 1);
+            futex_wake(&pool->notempty, k);
+        }
+        else {
+            pthread_mutex_lock(&pool->mutex);
+            while (k-- > 0)
+                pthread_cond_signal(&pool->empty);
+            pthread_mutex_unlock(&pool->mutex);
+        }
+    }
+}
+
+/*
+ * 락 없는 대기열의 원형 버퍼 r에 빈 자리가 생길 때까지 잠든다. 깨어나면 다시 넣기를 시도해야 한다.
+ * 잠들기 전에 blocked를 올리고 다시 확인해야 꺼내는 쪽이 깨우기를 놓치지 않는다.
+ * 어느 단계에서 꺼내든 notfull이 바뀌므로, 다른 단계 때문에 깨어났으면 다시 확인하고 잠든다.
+ */
+static void ring_wait_space(pthread_pool_t *pool, struct ring *r)
+{
+    unsigned int key = atomic_load(&pool->notfull);
+
+    atomic_fetch_add(&pool->blocked, 1);
+    if (ring_full(r))
+        futex_wait(&pool->notfull, key);
+    atomic_fetch_sub(&pool->blocked, 1);
+}
+
+/*
+ * 잠든 일꾼을 모두 깨운다. 일꾼 수를 줄이라는 요청이 있거나 일꾼이 물러났을 때,
+ * 다음으로 물러날 일꾼이 잠든 채로 남지 않게 한다. 공유 일꾼을 쓰면 공유 일꾼을 모두 깨운다.
+ */
+static void wake_all_bees(pthread_pool_t *pool)
+{
+    if (pool->shared)
+        shared_wake(INT_MAX);
+    else if (pool->ring != NULL) {
+        atomic_fetch_add(&pool->notempty, 1);
+        futex_wake(&pool->notempty, INT_MAX);
+    }
+    else {
+        pthread_mutex_lock(&pool->mutex);
+        pthread_cond_broadcast(&pool->empty);
+        pthread_mutex_unlock(&pool->mutex);
+    }
+}
+
+/*
+ * CLOCK_MONOTONIC 기준의 현재 시각을 밀리초 단위의 틱으로 리턴한다.
+ */
+static uint64_t now_tick(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*
+ * 지금부터 ms 밀리초 뒤의 CLOCK_REALTIME 기준 절대 시각을 ts에 채운다. 조건 변수와 futex를 기다릴 때 쓴다.
+ */
+static void abstime_after(struct timespec *ts, uint64_t ms)
+{
+    clock_gettime(CLOCK_REALTIME, ts);
+    ts->tv_sec += ms / 1000;
+    ts->tv_nsec += (ms % 1000) * 1000000L;
+    if (ts->tv_nsec >= 1000000000L) {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000L;
+    }
+}
+
+/*
+ * 타이머에 대한 참조 하나를 놓는다. 마지막 참조였으면 해제한다.
+ */
+static void timer_put(struct pool_timer *t)
+{
+    if (atomic_fetch_sub(&t->refs, 1) == 1)
+        free(t);
+}
+
+/*
+ * 휠에 타이머를 넣는다. 남은 시간에 맞는 단계를 고르고, 만료 시각으로 그 단계의 칸을 정한다.
+ * 이미 지난 타이머는 다음에 처리할 틱의 칸에 넣는다.
+ */
+static void wheel_insert(struct timer_wheel *w, struct pool_timer *t)
+{
+    uint64_t e = t->expires > w->now ? t->expires : w->now;
+    uint64_t d = e - w->now;
+    int l = 0;
+
+    while (l < WHEEL_LEVELS - 1 && d >= (uint64_t)1 << (WHEEL_BITS * (l + 1)))
+        l++;
+    if (d >= (uint64_t)1 << (WHEEL_BITS * WHEEL_LEVELS))
+        e = w->now + ((uint64_t)1 << (WHEEL_BITS * WHEEL_LEVELS)) - 1;
+
+    int i = (e >> (WHEEL_BITS * l)) & (WHEEL_SLOTS - 1);
+    t->next = w->slot[l][i];
+    w->slot[l][i] = t;
+    w->bits[l] |= (uint64_t)1 << i;
+}
+
+/*
+ * 단계 0이 한 바퀴를 돌아 새로 시작할 때, 위 단계에서 이번 구간에 해당하는 칸의 타이머를 아래 단계로 옮긴다.
+ * 단계 l의 칸 번호가 0이 되었을 때만 그 위 단계도 옮긴다.
+ */
+static void wheel_cascade(struct timer_wheel *w)
+{
+    for (int l = 1; l < WHEEL_LEVELS; l++) {
+        int i = (w->now >> (WHEEL_BITS * l)) & (WHEEL_SLOTS - 1);
+        struct pool_timer *t = w->slot[l][i];
+        w->slot[l][i] = NULL;
+        w->bits[l] &= ~((uint64_t)1 << i);
+        while (t != NULL) {
+            struct pool_timer *next = t->next;
+            wheel_insert(w, t);
+            t = next;
+        }
+        if (i != 0)
+            break;
+    }
+}
+
+/*
+ * 휠의 시각을 target까지 옮기며 만료된 타이머를 모두 빼서 목록으로 리턴하고, 뺀 수를 fired에 더한다.
+ * 단계 0에서 남은 칸이 비어 있으면 다음 타이머나 다음 바퀴의 처음으로 한 번에 건너뛴다.
+ */
+static struct pool_timer *wheel_advance(struct timer_wheel *w, uint64_t target, int *fired)
+{
+    struct pool_timer *list = NULL;
+
+    while (w->now <= target) {
+        int i = w->now & (WHEEL_SLOTS - 1);
+        if (i == 0)
+            wheel_cascade(w);
+        if (w->bits[0] & ((uint64_t)1 << i)) {
+            struct pool_timer *t = w->slot[0][i];
+            w->slot[0][i] = NULL;
+            w->bits[0] &= ~((uint64_t)1 << i);
+            while (t != NULL) {
+                struct pool_timer *next = t->next;
+                t->next = list;
+                list = t;
+                (*fired)++;
+                t = next;
+            }
+        }
+        uint64_t rest = i == WHEEL_SLOTS - 1 ? 0 : w->bits[0] >> (i + 1);
+        uint64_t next = rest != 0 ? w->now + 1 + __builtin_ctzll(rest) : (w->now | (WHEEL_SLOTS - 1)) + 1;
+        w->now = next <= target ? next : target + 1;
+    }
+    return list;
+}
+
+/*
+ * 비트맵 bits를 칸 from부터 차례로 보았을 때 처음으로 타이머가 있는 칸까지의 거리를 리턴한다. bits는 0이 아니어야 한다.
+ */
+static int wheel_distance(uint64_t bits, int from)
+{
+    uint64_t rot = from == 0 ? bits : (bits >> from) | (bits << (WHEEL_SLOTS - from));
+    return __builtin_ctzll(rot);
+}
+
+/*
+ * 휠에서 다음에 일이 생기는 틱, 즉 단계 0의 타이머가 만료되거나 위 단계의 칸을 옮겨야 하는 가장 이른 틱을 리턴한다.
+ * 타이머가 없으면 UINT64_MAX를 리턴한다. 일꾼은 이 시각까지 잠든다.
+ */
+static uint64_t wheel_next(struct timer_wheel *w)
+{
+    uint64_t best = UINT64_MAX;
+
+    if (w->bits[0] != 0)
+        best = w->now + wheel_distance(w->bits[0], w->now & (WHEEL_SLOTS - 1));
+    for (int l = 1; l < WHEEL_LEVELS; l++) {
+        if (w->bits[l] == 0)
+            continue;
+        //이번 구간의 칸을 아직 옮기지 않았으면 그 칸부터, 이미 옮겼으면 다음 칸부터 본다.
+        int shift = WHEEL_BITS * l;
+        uint64_t chunk = w->now >> shift;
+        bool pending = (w->now & (((uint64_t)1 << shift) - 1)) == 0;
+        int from = (chunk + (pending ? 0 : 1)) & (WHEEL_SLOTS - 1);
+        uint64_t tick = (chunk + (pending ? 0 : 1) + wheel_distance(w->bits[l], from)) << shift;
+        if (tick < best)
+            best = tick;
+    }
+    return best;
+}
+
+/*
+ * 타이머를 휠에 넣는다. 다음 만료 시각이 앞당겨졌으면 잠든 일꾼을 깨워 새 시각에 맞춰 다시 잠들게 한다.
+ * 넣는 쪽은 timer_next를 바꾼 뒤 idle을 보고, 잠드는 쪽은 idle을 올린 뒤 timer_next를 보므로 깨우기를 놓치지 않는다.
+ */
+static void timer_add(pthread_pool_t *pool, struct pool_timer *t)
+{
+    pthread_mutex_lock(&pool->timer_mutex);
+    wheel_insert(pool->wheel, t);
+    atomic_fetch_add(&pool->timers, 1);
+    uint64_t next = wheel_next(pool->wheel);
+    uint64_t old = atomic_exchange(&pool->timer_next, next);
+    pthread_mutex_unlock(&pool->timer_mutex);
+
+    if (next < old) {
+        atomic_thread_fence(memory_order_seq_cst);
+        if (pool->shared || atomic_load(&pool->idle) > 0)
+            wake_all_bees(pool);
+    }
+}
+
+/*
+ * 타이머가 만료되었을 때 스레드풀의 작업으로 실행되는 함수이다.
+ * 취소되지 않았으면 작업 함수를 실행하고, 주기 작업이면 다음 만료 시각을 정해 휠에 다시 넣는다.
+ * 다음 시각은 앞선 만료 시각에 주기를 더해 정하므로 실행 시간이 쌓여 밀리지 않으며,
+ * 이미 지난 주기는 한꺼번에 몰아서 실행하지 않고 건너뛴다.
+ */
+static void timer_run(void *param)
+{
+    struct pool_timer *t = (struct pool_timer *)param;
+    pthread_pool_t *pool = t->pool;
+
+    if (!atomic_load(&t->canceled))
+        t->function(t->param);
+    if (t->period > 0 && !atomic_load(&t->canceled) && atomic_load(&pool->running)) {
+        uint64_t now = now_tick();
+        t->expires += t->period;
+        if (t->expires <= now)
+            t->expires += ((now - t->expires) / t->period + 1) * t->period;
+        timer_add(pool, t);
+        return;
+    }
+    timer_put(t);
+}
+
+/*
+ * 만료된 타이머가 있으면 휠에서 빼서 작업으로 요청한다. 일꾼이 작업을 꺼내기 전마다 호출한다.
+ * 타이머가 없거나 아직 만료 시각 전이면 시계만 보고 바로 돌아오므로 비용이 작다.
+ * 다른 일꾼이 이미 휠을 옮기고 있으면 그 일꾼에게 맡긴다. 대기열이 꽉 차 있으면 기다리지 않고 이 일꾼이 바로 실행한다.
+ */
+static void timer_poll(pthread_pool_t *pool)
+{
+    struct pool_timer *t;
+    int fired = 0;
+
+    if (atomic_load_explicit(&pool->timers, memory_order_relaxed) == 0)
+        return;
+    uint64_t now = now_tick();
+    if (now < atomic_load(&pool->timer_next) || pthread_mutex_trylock(&pool->timer_mutex) != 0)
+        return;
+    t = wheel_advance(pool->wheel, now, &fired);
+    atomic_fetch_sub(&pool->timers, fired);
+    atomic_store(&pool->timer_next, wheel_next(pool->wheel));
+    pthread_mutex_unlock(&pool->timer_mutex);
+
+    while (t != NULL) {
+        struct pool_timer *next = t->next;
+        if (pthread_pool_submit(pool, timer_run, t, POOL_NOWAIT) != POOL_SUCCESS)
+            timer_run(t);
+        t = next;
+    }
+}
+
+/*
+ * 잠들려는 일꾼이 타이머를 지키는 일꾼(keeper)을 맡을 수 있으면 맡고, 다음 만료 시각을 ts에 채워 true를 리턴한다.
+ * 기다리는 타이머가 있을 때 한 명의 일꾼만 만료 시각에 맞춰 깨어나므로 나머지 일꾼은 시간 제한 없이 잠든다.
+ */
+static bool timer_keep(pthread_pool_t *pool, struct timespec *ts)
+{
+    if (atomic_load(&pool->timers) == 0 || atomic_exchange(&pool->timer_keeper, true))
+        return false;
+    uint64_t next = atomic_load(&pool->timer_next), now = now_tick();
+    abstime_after(ts, next > now ? next - now : 0);
+    return true;
+}
+
+/*
+ * 타이머를 지키던 일꾼이 깨어나 그 역할을 놓는다. 아직 타이머가 남아 있으면 잠든 일꾼 하나를 깨워
+ * 다음 keeper를 맡게 한다. 이 일꾼이 작업을 오래 실행하는 동안 만료된 타이머가 밀리지 않게 하기 위해서이다.
+ */
+static void timer_unkeep(pthread_pool_t *pool)
+{
+    atomic_store(&pool->timer_keeper, false);
+    if (atomic_load(&pool->timers) > 0)
+        wake_idle_bees(pool, 1);
+}
+
+/*
+ * 두 절대 시각 가운데 a가 b보다 이르면 true를 리턴한다.
+ */
+static bool abstime_before(const struct timespec *a, const struct timespec *b)
+{
+    return a->tv_sec < b->tv_sec || (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+/*
+ * 잠들기 전에 잠깐 돌고 양보하며 기다리기(spin-then-park)에 쓰는 값이다.
+ * 기다림은 돌기, 양보하기, 잠들기 가운데 어느 단계에서 끝났는지에 따라 waits 배열의 해당 칸을 센다.
+ */
+#define WAIT_PARK 0                 /* 잠들어서 기다림 */
+#define WAIT_SPIN 1                 /* 돌며 기다리는 동안 해결됨 */
+#define WAIT_YIELD 2                /* CPU를 양보하는 동안 해결됨 */
+#define SPIN_CHECK 16               /* 조건을 한 번 확인할 때마다 쉬는 횟수 */
+
+#if defined(__x86_64__) || defined(__i386__)
+#define cpu_relax() __builtin_ia32_pause()
+#elif defined(__aarch64__)
+#define cpu_relax() __asm__ __volatile__("yield")
+#else
+#define cpu_relax() ((void)0)
+#endif
+
+/*
+ * 기다리는 쪽이 돌면서 확인할 조건이다. key는 기다리기 시작할 때 읽은 notempty나 notfull의 값이고,
+ * ring은 요청 스레드가 빈 자리를 기다리는 락 없는 원형 버퍼이다.
+ */
+struct wait_for {
+    unsigned int key;
+    struct ring *ring;
+};
+
+/*
+ * CLOCK_MONOTONIC 기준의 현재 시각을 나노초로 리턴한다.
+ */
+static long now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long)ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+/*
+ * 일꾼이 꺼낼 작업이 보이면 true를 리턴한다. 락을 쓰는 대기열은 락을 잡지 않도록 notempty가 바뀌었는지로 확인한다.
+ */
+static bool work_ready(pthread_pool_t *pool, const struct wait_for *w)
+{
+    if (pool->ring != NULL ? queue_nonempty(pool)
+                           : atomic_load_explicit(&pool->notempty, memory_order_relaxed) != w->key)
+        return true;
+    return hive_nonempty(pool);
+}
+
+/*
+ * 요청 스레드가 넣을 빈 자리가 보이면 true를 리턴한다. 락을 쓰는 대기열은 notfull이 바뀌었는지로 확인한다.
+ */
+static bool room_ready(pthread_pool_t *pool, const struct wait_for *w)
+{
+    if (w->ring != NULL)
+        return !ring_full(w->ring);
+    return atomic_load_explicit(&pool->notfull, memory_order_relaxed) != w->key;
+}
+
+/*
+ * ready()가 true가 될 때까지 budget 나노초 동안 pause로 쉬며 돌고, 그래도 아니면 yields번까지 CPU를 양보한다.
+ * 어느 단계에서 해결되었는지를 리턴하며, 끝내 해결되지 않았거나 스레드풀이 종료 중이면 WAIT_PARK를 리턴한다.
+ */
+static int spin_wait(pthread_pool_t *pool, long budget,
+                     bool (*ready)(pthread_pool_t *pool, const struct wait_for *w), const struct wait_for *w)
+{
+    long end = now_ns() + budget;
+
+    if (budget > 0) {
+        do {
+            for (int i = 0; i < SPIN_CHECK; i++)
+                cpu_relax();
+            if (ready(pool, w))
+                return WAIT_SPIN;
+        } while (atomic_load_explicit(&pool->running, memory_order_relaxed) && now_ns() < end);
+    }
+    for (int i = 0; i < pool->yields && atomic_load_explicit(&pool->running, memory_order_relaxed); i++) {
+        sched_yield();
+        if (ready(pool, w))
+            return WAIT_YIELD;
+    }
+    return WAIT_PARK;
+}
+
+/*
+ * how 단계에서 ns 나노초 만에 끝난 기다림을 반영해서 다음에 돌며 기다릴 시간 budget을 정한다.
+ * gap은 돌다가 찾았거나 잠들었다 깨어날 때까지 걸린 시간의 이동 평균(최근 값에 1/8의 가중치)이다.
+ * 평균이 spin_ns 안이면 평균의 두 배까지(spin_ns를 넘지 않게) 돌고, 평균이 spin_ns보다 길면 돌아도 헛수고이므로
+ * 돌지 않고 바로 양보하거나 잠든다. 잠든 뒤에 짧은 간격으로 깨어나는 일이 늘면 평균이 줄어 다시 돌게 된다.
+ * 양보하는 동안 해결되었으면 다른 스레드가 이 CPU를 써야 일이 진행된 것이므로, 평균에 넣지 않고 도는 시간을 반으로 줄인다.
+ * 요청 스레드들은 하나의 값을 함께 쓰므로 동시에 고치면 한쪽 값이 사라질 수 있지만, 어림값이므로 상관없다.
+ */
+static void spin_learn(pthread_pool_t *pool, atomic_long *gap, atomic_long *budget, long ns, int how)
+{
+    long g = atomic_load_explicit(gap, memory_order_relaxed);
+
+    if (how == WAIT_YIELD) {
+        atomic_store_explicit(budget, atomic_load_explicit(budget, memory_order_relaxed) / 2, memory_order_relaxed);
+        return;
+    }
+    g += (ns - g) / 8;
+    atomic_store_explicit(gap, g, memory_order_relaxed);
+    atomic_store_explicit(budget, g > pool->spin_ns ? 0 : (2 * g < pool->spin_ns ? 2 * g : pool->spin_ns),
+                          memory_order_relaxed);
+}
+
+/*
+ * 기다림이 how 단계에서 끝났음을 센다. 세는 쪽이 하나뿐인 일꾼의 카운터도 같은 함수로 센다.
+ */
+static void wait_count(atomic_ulong *waits, int how)
+{
+    atomic_fetch_add_explicit(&waits[how], 1, memory_order_relaxed);
+}
+
+/*
+ * 대기열이 꽉 차서 요청 스레드가 빈 자리를 기다린다. 돌아오면 빈 자리가 생겼는지 다시 확인해야 한다.
+ * 잠들기 전에 submit_spin_ns 동안 돌고 yields번 양보하며, 그 사이에 빈 자리가 보이면 잠들지 않고 돌아온다.
+ * 락을 쓰는 대기열이면 mutex를 잡은 상태에서 호출하며, 돌거나 양보하는 동안에는 mutex를 놓았다가 다시 잡는다.
+ * 다시 잡은 뒤에도 notfull이 그대로일 때만 full에서 잠들어야 그 사이의 깨우기를 놓치지 않는다.
+ * 락 없는 대기열이면 r에 빈 자리가 생기기를 기다린다.
+ */
+static void submit_wait(pthread_pool_t *pool, struct ring *r)
+{
+    struct wait_for w = { atomic_load(&pool->notfull), r };
+    long t0 = 0;
+    int how = WAIT_PARK;
+
+    if (spin_enabled(pool)) {
+        t0 = now_ns();
+        if (r == NULL)
+            pthread_mutex_unlock(&pool->mutex);
+        how = spin_wait(pool, atomic_load_explicit(&pool->submit_spin_ns, memory_order_relaxed), room_ready, &w);
+        if (r == NULL)
+            pthread_mutex_lock(&pool->mutex);
+    }
+    if (how == WAIT_PARK) {
+        if (r != NULL)
+            ring_wait_space(pool, r);
+        else if (!room_ready(pool, &w))
+            pthread_cond_wait(&pool->full, &pool->mutex);
+    }
+    wait_count(pool->submit_waits, how);
+    if (spin_enabled(pool))
+        spin_learn(pool, &pool->submit_gap, &pool->submit_spin_ns, now_ns() - t0, how);
+}
+
+/*
+ * 일꾼 self가 잠들 때 깨어날 시각을 ts에 채워 리턴한다. 시간 제한 없이 잠들면 되면 NULL을 리턴한다.
+ * 자동 조절을 할 때 bee_min보다 많은 일꾼 가운데 가장 마지막 일꾼만 idle_ms 뒤에 깨어나 물러날지 정한다.
+ */
+static const struct timespec *bee_deadline(pthread_pool_t *pool, struct bee *self, struct timespec *ts)
+{
+    if (pool->bee_max == 0 || self->id != atomic_load(&pool->bee_size) - 1 || self->id < pool->bee_min)
+        return NULL;
+    abstime_after(ts, pool->idle_ms);
+    return ts;
+}
+
+/*
+ * 할 일이 없는 일꾼 self가 물러나야 하는지 정하고, 물러나야 하면 자리를 비운 뒤 true를 리턴한다.
+ * 일꾼은 항상 앞쪽 bee_size칸을 차지하도록 가장 마지막 일꾼만 물러난다. 일꾼 수를 줄이라는 요청이 있거나,
+ * timed_out이 true로 자동 조절 중에 idle_ms 동안 할 일이 없었으면 물러난다.
+ * 덱과 claim이 비어 있을 때만 호출하므로 물러난 일꾼의 작업이 남지 않는다.
+ * 물러난 일꾼은 my_bee를 지운다. 스레드는 조인 없이 스레드 캐시로 돌아가므로
+ * 그 자리에 곧바로 새 일꾼을 만들 수 있고, 종료할 때는 threads가 0이 되기를 기다린다.
+ */
+static bool bee_retire(pthread_pool_t *pool, struct bee *self, bool timed_out)
+{
+    bool retire = false;
+
+    if (!timed_out && self->id < atomic_load(&pool->bee_target))
+        return false;
+    pthread_mutex_lock(&pool->resize_mutex);
+    int size = atomic_load(&pool->bee_size);
+    if (atomic_load(&pool->running) && self->id == size - 1 &&
+        (self->id >= atomic_load(&pool->bee_target) || (timed_out && size > pool->bee_min))) {
+        atomic_store(&pool->bee_size, size - 1);
+        if (atomic_load(&pool->bee_target) > size - 1)
+            atomic_store(&pool->bee_target, size - 1);
+        retire = true;
+    }
+    pthread_mutex_unlock(&pool->resize_mutex);
+    if (retire)
+        my_bee = NULL;
+    return retire;
+}
+
+/*
+ * pthread_pool_shutdown_drain()이 일꾼이 남은 작업을 마치기를 기다리는 중이면 drain_seq를 바꿔 깨운다.
+ * 일꾼이 잠들려고 idle을 올린 뒤나 공유 일꾼이 작업을 마치고 busy를 내린 뒤에 부른다.
+ */
+static void drain_note(pthread_pool_t *pool)
+{
+    if (atomic_load(&pool->draining)) {
+        atomic_fetch_add(&pool->drain_seq, 1);
+        futex_wake(&pool->drain_seq, 1);
+    }
+}
+
+/*
+ * 일꾼이 할 일을 찾지 못했을 때 잠든다. 깨어나면 다시 작업을 찾아야 한다.
+ * 락 없는 대기열이면 notempty를 futex로 기다리고, 아니면 mutex를 잡고 empty에서 기다린다.
+ * 어느 쪽이든 idle을 올린 뒤에 대기열과 덱을 다시 확인해야 깨우기를 놓치지 않는다.
+ * 한 번만 기다리고 돌아오므로, 깨어난 이유가 작업이든 일꾼 수의 변경이든 호출한 쪽이 다시 확인한다.
+ * idle을 올린 뒤에는 drain_note()로 남은 작업이 끝나기를 기다리는 종료 스레드에 알린다.
+ * 타이머를 지키는 일꾼이면 다음 만료 시각과 bee_deadline()이 정한 시각 가운데 이른 쪽까지 기다린다.
+ * bee_deadline()이 정한 시각까지 아무 일 없이 잠들어 있었으면 false를 리턴한다.
+ */
+static bool bee_park(pthread_pool_t *pool, struct bee *self)
+{
+    struct timespec ts, tts;
+    const struct timespec *idle_at = bee_deadline(pool, self, &ts), *abstime;
+    bool woken = true, keeper;
+
+    if (pool->ring != NULL) {
+        unsigned int key = atomic_load(&pool->notempty);
+        atomic_fetch_add(&pool->idle, 1);
+        drain_note(pool);
+        keeper = timer_keep(pool, &tts);
+        abstime = keeper && (idle_at == NULL || abstime_before(&tts, idle_at)) ? &tts : idle_at;
+        if (atomic_load(&pool->running) && !queue_nonempty(pool) && !hive_nonempty(pool)) {
+            if (pool->trace != NULL)
+                trace_note(pool, TRACE_PARK, NULL, 0);
+            woken = futex_timedwait(&pool->notempty, key, abstime) || abstime != idle_at;
+            if (pool->trace != NULL)
+                trace_note(pool, TRACE_UNPARK, NULL, 0);
+        }
+        atomic_fetch_sub(&pool->idle, 1);
+    }
+    else {
+        //대기열이 비어있고 스레드풀이 실행중이면 기다린다.
+        pthread_mutex_lock(&pool->mutex);
+        atomic_fetch_add(&pool->idle, 1);
+        drain_note(pool);
+        keeper = timer_keep(pool, &tts);
+        abstime = keeper && (idle_at == NULL || abstime_before(&tts, idle_at)) ? &tts : idle_at;
+        if (atomic_load(&pool->running) && pool->q_len == 0 && !hive_nonempty(pool)) {
+            if (pool->trace != NULL)
+                trace_note(pool, TRACE_PARK, NULL, 0);
+            if (abstime == NULL)
+                pthread_cond_wait(&pool->empty, &pool->mutex);
+            else
+                woken = pthread_cond_timedwait(&pool->empty, &pool->mutex, abstime) != ETIMEDOUT ||
+                        abstime != idle_at;
+            if (pool->trace != NULL)
+                trace_note(pool, TRACE_UNPARK, NULL, 0);
+        }
+        atomic_fetch_sub(&pool->idle, 1);
+        pthread_mutex_unlock(&pool->mutex);
+    }
+    if (keeper)
+        timer_unkeep(pool);
+    return woken;
+}
+
+/*
+ * 일꾼 self가 할 일이 없을 때 기다린다. 깨어나면 다시 작업을 찾아야 한다.
+ * 잠들기 전에 self의 spin_ns 동안 돌고 yields번 양보하며, 그 사이에 작업이 보이면 잠들지 않고 돌아온다.
+ * 돌거나 양보하는 동안에는 idle에 들어가지 않으므로 작업을 넣는 쪽이 깨우는 비용을 치르지 않는다.
+ * 그래도 작업이 없으면 bee_park()로 잠들며, 리턴값은 bee_park()와 같다.
+ */
+static bool bee_wait(pthread_pool_t *pool, struct bee *self)
+{
+    if (!spin_enabled(pool)) {
+        wait_count(self->waits, WAIT_PARK);
+        return bee_park(pool, self);
+    }
+
+    struct wait_for w = { atomic_load(&pool->notempty), NULL };
+    long t0 = now_ns();
+    bool woken = true;
+    int how = spin_wait(pool, atomic_load_explicit(&self->spin_ns, memory_order_relaxed), work_ready, &w);
+
+    if (how == WAIT_PARK)
+        woken = bee_park(pool, self);
+    wait_count(self->waits, how);
+    if (woken)
+        spin_learn(pool, &self->gap_ns, &self->spin_ns, now_ns() - t0, how);
+    return woken;
+}
+
+/*
+ * 작업 훔치기 모드의 일꾼이 다음 작업을 구한다.
+ * 자기 덱, 공유 대기열, 다른 일꾼의 덱 순서로 찾고, 어디에도 없으면 잠든다.
+ * 스레드풀이 종료되거나 이 일꾼이 물러나면 false를 리턴한다.
+ */
+static bool steal_next(pthread_pool_t *pool, struct bee *self, task_t *task)
+{
+    bool timed_out = false;
+
+    while (atomic_load(&pool->running)) {
+        //만료된 타이머가 있으면 작업으로 요청해 둔다.
+        timer_poll(pool);
+
+        //자기 덱에서 가장 최근에 넣은 작업을 먼저 꺼낸다. 캐시에 남아 있을 가능성이 크다.
+        if (deque_pop(self, task))
+            return true;
+
+        //스레드풀 밖에서 들어온 작업이 있으면 공유 대기열에서 꺼낸다.
+        //여러 개를 가져왔으면 첫 작업만 실행하고 나머지는 자기 덱에 넣어 다른 일꾼도 훔쳐갈 수 있게 한다.
+        size_t n = queue_claim(pool, self->claim, pool->batch);
+        if (n > 0) {
+            *task = self->claim[0];
+            for (size_t i = 1; i < n; i++)
+                if (!deque_push(self, &self->claim[i]))
+                    task_call(&self->claim[i]);
+            wake_idle_bees(pool, n - 1);
+            return true;
+        }
+
+        //임의의 일꾼부터 시작해서 한 바퀴 돌며 훔칠 작업을 찾는다.
+        int bees = atomic_load(&pool->bee_size);
+        int start = rand_r(&self->seed) % bees;
+        for (int i = 0; i < bees; i++) {
+            struct bee *victim = pool->hive[(start + i) % bees];
+            if (victim != self && deque_steal(victim, task)) {
+                if (pool->trace != NULL)
+                    trace_note(pool, TRACE_STEAL, trace_function(task), victim->id);
+                return true;
+            }
+        }
+
+        //어디에도 작업이 없으면 물러날 차례인지 확인하고, 아니면 잠든다.
+        if (bee_retire(pool, self, timed_out))
+            return false;
+        timed_out = !bee_wait(pool, self);
+    }
+    return false;
+}
+
+/*
+ * 다른 작업의 완료를 기다리는 스레드가 잠드는 대신 실행할 작업을 하나 찾아 실행한다. 실행했으면 true를 리턴한다.
+ * 이 풀의 일꾼이면 자기가 미리 가져간 작업과 자기 덱을 먼저 보고, 그 다음 공유 대기열과 다른 일꾼의 덱을 본다.
+ * 기다리는 작업이 기다리는 쪽의 claim이나 덱에 있을 수 있으므로 그곳부터 봐야 일꾼 수가 적어도 멈추지 않는다.
+ */
+static bool pool_help(pthread_pool_t *pool)
+{
+    struct bee *self = (my_bee != NULL && my_bee->pool == pool) ? my_bee : NULL;
+    task_t task;
+
+    if (self != NULL && self->claim_pos < self->claim_len) {
+        task = self->claim[self->claim_pos++];
+        goto found;
+    }
+    if (self != NULL && pool->sched == POOL_SCHED_STEAL && deque_pop(self, &task))
+        goto found;
+    if (queue_trypop(pool, &task))
+        goto found;
+    if (pool->sched == POOL_SCHED_STEAL) {
+        for (int i = 0; i < pool->bee_size; i++)
+            if (pool->hive[i] != self && deque_steal(pool->hive[i], &task))
+                goto found;
+    }
+    return false;
+
+found:
+    if (pool->trace != NULL) {
+        void (*f)(void *p) = trace_start(pool, &task);
+        task_call(&task);
+        trace_note(pool, TRACE_END, f, 0);
+    }
+    else
+        task_call(&task);
+    return true;
+}
+
+/*
+ * FIFO 모드의 일꾼이 공유 대기열에서 다음 작업을 꺼낸다.
+ * 대기열이 깊으면 최대 batch개를 한 번에 가져와 claim에 담아 두고, 다음부터는 락 없이 claim에서 꺼낸다.
+ * 대기열에 작업이 없으면 새 작업이 들어올 때까지 기다린다. 스레드풀이 종료되거나 이 일꾼이 물러나면 false를 리턴한다.
+ * POOL_DISCARD로 종료되면 claim에 남은 작업도 실행하지 않고 버리며,
+ * POOL_COMPLETE로 종료되면 이미 가져온 작업은 대기열에 없으므로 마저 실행한다.
+ */
+static bool fifo_next(pthread_pool_t *pool, struct bee *self, task_t *task)
+{
+    bool timed_out = false;
+    size_t n;
+
+    //앞서 한꺼번에 가져온 작업이 남아 있으면 대기열을 건드리지 않고 꺼낸다.
+    if (self->claim_pos < self->claim_len) {
+        if (atomic_load(&pool->discard)) {
+            while (self->claim_pos < self->claim_len)
+                shutdown_drop(pool, &self->claim[self->claim_pos++]);
+            self->claim_pos = self->claim_len = 0;
+            return false;
+        }
+        *task = self->claim[self->claim_pos++];
+        return true;
+    }
+
+    //만료된 타이머를 작업으로 요청한 뒤 대기열에서 꺼내기를 시도하고, 정말로 비어 있을 때만 잠든다.
+    //잠든 일꾼의 수는 bee_park()에서 세며, 여러 작업을 한꺼번에 넣는 쪽이 깨울 일꾼 수를 정할 때 쓴다.
+    //기다리는 동안 물러날 차례가 되면 대기열을 건드리지 않고 스레드를 종료한다.
+    //스레드풀이 종료되면 스레드를 종료한다.
+    while (atomic_load(&pool->running)) {
+        timer_poll(pool);
+        if ((n = queue_claim(pool, self->claim, pool->batch)) > 0)
+            goto claimed;
+        if (bee_retire(pool, self, timed_out))
+            return false;
+        timed_out = !bee_wait(pool, self);
+    }
+    return false;
+
+claimed:
+    *task = self->claim[0];
+    self->claim_pos = 1;
+    self->claim_len = n;
+    return true;
+}
+
+/*
+ * 일꾼 self가 작업 task를 실행하면서 통계를 모은다. last는 앞의 작업을 마친 시각이고, 이번 작업을 마친 시각을 리턴한다.
+ * 작업을 넣은 시각부터 시작할 때까지를 대기 시간으로, 시작부터 끝날 때까지를 실행 시간으로 히스토그램에 넣고,
+ * 앞의 작업을 마친 뒤 이번 작업을 시작할 때까지는 쉰 시간으로 센다.
+ */
+static long task_run_timed(struct bee *self, task_t *task, long last)
+{
+    long start = now_ns();
+
+    if (task->stamp != 0)
+        stat_add(&self->hist[hist_bucket(start - task->stamp)], 1);
+    task_call(task);
+
+    long end = now_ns();
+    stat_add(&self->hist[POOL_HIST_BUCKETS + hist_bucket(end - start)], 1);
+    stat_add(&self->idle_ns, start - last);
+    stat_add(&self->busy_ns, end - start);
+    return end;
+}
 
 /*
  * 풀에 있는 일꾼(일벌) 스레드가 수행할 함수이다.
  * FIFO 대기열에서 기다리고 있는 작업을 하나씩 꺼내서 실행한다.
+ * 작업 훔치기 모드에서는 자기 덱을 먼저 보고, 비어 있으면 대기열이나 다른 일꾼의 덱에서 가져온다.
  * 대기열에 작업이 없으면 새 작업이 들어올 때까지 기다린다.
- * 이 과정을 스레드풀이 종료될 때까지 반복한다.
+ * 이 과정을 스레드풀이 종료되거나 일꾼 수가 줄어 이 일꾼이 물러날 때까지 반복한다.
+ * 물러난 일꾼은 다음으로 물러날 일꾼이 잠든 채로 남지 않도록 잠든 일꾼을 모두 깨운 뒤 끝난다.
+ * threads를 줄이는 순간 종료하던 스레드가 스레드풀을 없앨 수 있으므로 그 뒤에는 주소만으로 깨운다.
+ * 스레드는 이 함수가 끝나면 스레드 캐시로 돌아가 다음 일꾼을 기다린다.
+ */
+static void *worker(void *param)
+{
+    //자기 몫의 제어 블록과 이 일꾼이 속한 스레드풀을 가져온다.
+    struct bee *self = (struct bee *)param;
+    pthread_pool_t *pool = self->pool;
+    task_t task;
+
+    my_bee = self;
+    long last = pool->stats ? now_ns() : 0;
+    while (pool->sched == POOL_SCHED_STEAL ? steal_next(pool, self, &task) : fifo_next(pool, self, &task)) {
+        //작업을 실행한다. 통계를 모으면 실행 전후의 시각을 재고, 사건을 남기면 시작과 끝을 적는다.
+        void (*f)(void *p) = pool->trace != NULL ? trace_start(pool, &task) : NULL;
+        if (pool->stats)
+            last = task_run_timed(self, &task, last);
+        else
+            task_call(&task);
+        if (f != NULL)
+            trace_note(pool, TRACE_END, f, 0);
+        stat_add(&self->tasks, 1);
+    }
+    if (pool->stats)
+        stat_add(&self->idle_ns, now_ns() - last);
+
+    //bee_retire()로 물러났으면 my_bee가 지워져 있다.
+    if (my_bee == NULL)
+        wake_all_bees(pool);
+    my_bee = NULL;
+    if (atomic_fetch_sub(&pool->threads, 1) == 1)
+        futex_wake(&pool->threads, INT_MAX);
+    return NULL;
+}
+
+/*
+ * 새 일꾼에게 줄 덱의 크기로, 대기열의 용량 q_size 이상인 가장 작은 2의 거듭제곱을 리턴한다.
+ */
+static long deque_initial_size(pthread_pool_t *pool)
+{
+    long dsize = 1;
+
+    while (dsize < (long)pool->q_size)
+        dsize <<= 1;
+    return dsize;
+}
+
+/*
+ * 일꾼을 배치할 CPU의 순서를 정해 pool->cpus에 담는다. 성공하면 true를 리턴한다.
+ * CPU 목록은 attr->cpus이고, 없으면 현재 스레드가 실행될 수 있는 CPU 전체이다. attr->cpus에는
+ * 현재 스레드가 실행될 수 없는 CPU가 있으면 안 된다.
+ * POOL_AFFINITY_COMPACT이면 목록의 순서를 그대로 쓰고, POOL_AFFINITY_SPREAD이거나 NUMA 노드마다 대기열을 나누면
+ * 노드마다 몇 번째 CPU인지를 먼저, 노드 번호를 다음으로 정렬해서 이웃한 일꾼이 서로 다른 노드에 놓이게 한다.
+ * 일꾼을 묶을 필요가 없으면 pool->cpus를 NULL로 둔다.
+ */
+static int cpu_order_cmp(const void *a, const void *b)
+{
+    long x = *(const long *)a, y = *(const long *)b;
+
+    return (x > y) - (x < y);
+}
+
+static bool cpus_init(pthread_pool_t *pool, const pthread_pool_attr_t *attr)
+{
+    pool->cpus = NULL;
+    pool->ncpus = 0;
+    if (attr->affinity == POOL_AFFINITY_NONE && pool->nodes == 1)
+        return true;
+#ifdef __linux__
+    cpu_set_t allowed;
+    int n = 0;
+
+    if (pthread_getaffinity_np(pthread_self(), sizeof(allowed), &allowed) != 0)
+        return false;
+    if ((pool->cpus = (int *)malloc(TOPO_MAXCPU * sizeof(int))) == NULL)
+        return false;
+    if (attr->cpus != NULL) {
+        for (int i = 0; i < attr->ncpus; i++) {
+            int c = attr->cpus[i];
+            if (c < 0 || c >= TOPO_MAXCPU || !CPU_ISSET(c, &allowed) || n == TOPO_MAXCPU)
+                return false;
+            pool->cpus[n++] = c;
+        }
+    }
+    else {
+        for (int c = 0; c < TOPO_MAXCPU && c < CPU_SETSIZE; c++)
+            if (CPU_ISSET(c, &allowed))
+                pool->cpus[n++] = c;
+    }
+    if (n == 0)
+        return false;
+    pool->ncpus = n;
+
+    //노드 안에서의 순번, 노드, CPU 번호를 하나의 수로 묶어 정렬한다.
+    if (attr->affinity == POOL_AFFINITY_SPREAD || (attr->affinity == POOL_AFFINITY_NONE && pool->nodes > 1)) {
+        long key[TOPO_MAXCPU];
+        int rank[TOPO_MAXNODE] = { 0 };
+        for (int i = 0; i < n; i++) {
+            int node = cpu_node(pool->cpus[i]);
+            key[i] = ((long)rank[node]++ * TOPO_MAXNODE + node) * TOPO_MAXCPU + pool->cpus[i];
+        }
+        qsort(key, n, sizeof(long), cpu_order_cmp);
+        for (int i = 0; i < n; i++)
+            pool->cpus[i] = key[i] % TOPO_MAXCPU;
+    }
+    return true;
+#else
+    return true;
+#endif
+}
+
+/*
+ * node_enter()가 원래 CPU 집합을 담아 두는 공간이다.
+ */
+#ifdef __linux__
+typedef cpu_set_t saved_cpus_t;
+#else
+typedef int saved_cpus_t;
+#endif
+
+#ifdef __linux__
+/*
+ * NUMA 노드 node에 속한 pool->cpus의 CPU를 모두 set에 담는다. 담은 CPU가 없으면 false를 리턴한다.
+ */
+static bool node_cpuset(pthread_pool_t *pool, int node, cpu_set_t *set)
+{
+    bool any = false;
+
+    CPU_ZERO(set);
+    for (int i = 0; i < pool->ncpus; i++) {
+        if (cpu_node(pool->cpus[i]) == node) {
+            CPU_SET(pool->cpus[i], set);
+            any = true;
+        }
+    }
+    return any;
+}
+#endif
+
+/*
+ * 현재 스레드를 잠시 NUMA 노드 node의 CPU로 옮긴다. 리눅스는 메모리를 처음 건드린 CPU의 노드에 놓으므로(first-touch)
+ * 이 동안 할당하고 채운 공간은 그 노드의 메모리에 놓인다. 원래 CPU 집합은 saved에 담아 두었다가 node_leave()로 되돌린다.
+ * 노드를 나누지 않았거나 옮기지 못하면 false를 리턴한다.
+ */
+static bool node_enter(pthread_pool_t *pool, int node, saved_cpus_t *saved)
+{
+#ifdef __linux__
+    cpu_set_t set;
+
+    if (pool->nodes == 1 || !node_cpuset(pool, node, &set))
+        return false;
+    if (pthread_getaffinity_np(pthread_self(), sizeof(*saved), saved) != 0)
+        return false;
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    return false;
+#endif
+}
+
+static void node_leave(bool entered, saved_cpus_t *saved)
+{
+#ifdef __linux__
+    if (entered)
+        pthread_setaffinity_np(pthread_self(), sizeof(*saved), saved);
+#endif
+}
+
+/*
+ * hive의 i번째 자리에 쓸 일꾼의 제어 블록을 할당하고 초기화한다.
+ * 작업 훔치기 모드이면 dsize 크기의 덱을, 어느 모드든 batch 크기의 claim을 함께 할당한다. 실패하면 NULL을 리턴한다.
+ * 일꾼을 묶을 CPU와 노드도 여기서 정하며, 노드를 나눴으면 일꾼의 노드에서 할당해서 노드의 메모리에 놓는다.
+ */
+static struct bee *bee_alloc(pthread_pool_t *pool, int i, long dsize)
+{
+    int cpu = -1, node = 0;
+
+    if (pool->cpus != NULL) {
+        int c = pool->cpus[i % pool->ncpus];
+        if (pool->affinity != POOL_AFFINITY_NONE)
+            cpu = c;
+        if (pool->nodes > 1)
+            node = cpu_node(c);
+    }
+
+    saved_cpus_t saved;
+    bool entered = node_enter(pool, node, &saved);
+    struct bee *b = (struct bee *)aligned_alloc(_Alignof(struct bee), sizeof(struct bee));
+
+    if (b == NULL) {
+        node_leave(entered, &saved);
+        return NULL;
+    }
+    b->cpu = cpu;
+    b->node = node;
+    atomic_init(&b->gap_ns, pool->spin_ns / 2);
+    atomic_init(&b->spin_ns, pool->spin_ns);
+    for (int k = 0; k < 3; k++)
+        atomic_init(&b->waits[k], 0);
+    atomic_init(&b->tasks, 0);
+    atomic_init(&b->busy_ns, 0);
+    atomic_init(&b->idle_ns, 0);
+    b->hist = pool->stats ? (atomic_ulong *)calloc(2 * POOL_HIST_BUCKETS, sizeof(atomic_ulong)) : NULL;
+    b->trace = pool->trace != NULL ? trace_alloc(pool->trace_size) : NULL;
+    atomic_init(&b->top, 0);
+    atomic_init(&b->bottom, 0);
+    atomic_init(&b->buf, NULL);
+    b->pool = pool;
+    b->id = i;
+    b->seed = i + 1;
+    b->claim = (task_t *)line_alloc(pool->batch * sizeof(task_t));
+    b->claim_pos = b->claim_len = 0;
+    if (pool->sched == POOL_SCHED_STEAL)
+        b->buf = deque_buf_alloc(dsize);
+    node_leave(entered, &saved);
+    if (b->claim == NULL || (pool->sched == POOL_SCHED_STEAL && b->buf == NULL) || (pool->stats && b->hist == NULL) ||
+        (pool->trace != NULL && b->trace == NULL)) {
+        free(b->buf);
+        free(b->claim);
+        free(b->hist);
+        free(b->trace);
+        free(b);
+        return NULL;
+    }
+    return b;
+}
+
+/*
+ * 스레드 캐시의 스레드 하나이다. 스레드는 일꾼 하나를 맡아 worker()를 실행하고, 끝나면 캐시로 돌아와
+ * go가 바뀔 때까지 잠든다. 일을 맡기는 쪽은 bee를 채운 뒤 go를 바꾸고 깨운다.
+ * bound는 앞서 맡은 일꾼 때문에 CPU에 묶여 있으면 true이며, 묶지 않는 일꾼을 맡길 때 원래대로 풀어 준다.
+ */
+struct bee_thread {
+    pthread_t tid;                  /* 스레드 ID */
+    atomic_uint go;                 /* 일을 맡길 때마다 바뀌는 futex 값 */
+    struct bee *bee;                /* 맡은 일꾼 */
+    bool bound;                     /* CPU에 묶여 있으면 true */
+    struct bee_thread *next;        /* 캐시에서 다음으로 놀고 있는 스레드 */
+};
+
+/*
+ * 프로세스 전체가 함께 쓰는 스레드 캐시이다. 놀고 있는 스레드를 최대 POOL_THREAD_CACHE개까지 목록으로 둔다.
+ * 스레드풀마다 일꾼 스레드를 만들고 조인하는 대신 여기서 가져가고 돌려주므로, 스레드풀을 자주 만들고 없애도
+ * pthread_create()와 pthread_join()의 비용이 거의 들지 않는다.
+ */
+static struct {
+    pthread_mutex_t mutex;          /* 목록을 보호하는 상호배타 락 */
+    struct bee_thread *idle;        /* 놀고 있는 스레드의 목록 */
+    int nidle;                      /* 목록에 있는 스레드의 수 */
+} thread_cache = { PTHREAD_MUTEX_INITIALIZER, NULL, 0 };
+
+#ifdef __linux__
+static pthread_once_t home_once = PTHREAD_ONCE_INIT;
+static cpu_set_t home_cpus;         /* 묶지 않은 스레드가 쓸 수 있는 CPU, 처음 스레드를 만들 때의 프로세스 값이다 */
+
+static void home_load(void)
+{
+    if (sched_getaffinity(0, sizeof(home_cpus), &home_cpus) != 0) {
+        CPU_ZERO(&home_cpus);
+        for (int c = 0; c < CPU_SETSIZE; c++)
+            CPU_SET(c, &home_cpus);
+    }
+}
+#endif
+
+/*
+ * 일꾼을 마친 스레드 t를 캐시에 돌려놓는다. 캐시가 꽉 찼으면 false를 리턴하며, 이때 스레드는 끝난다.
+ */
+static bool thread_put(struct bee_thread *t)
+{
+    bool kept = false;
+
+    pthread_mutex_lock(&thread_cache.mutex);
+    if (thread_cache.nidle < POOL_THREAD_CACHE) {
+        t->next = thread_cache.idle;
+        thread_cache.idle = t;
+        thread_cache.nidle++;
+        kept = true;
+    }
+    pthread_mutex_unlock(&thread_cache.mutex);
+    return kept;
+}
+
+/*
+ * 캐시에서 놀고 있는 스레드 하나를 꺼낸다. 없으면 NULL을 리턴한다.
+ */
+static struct bee_thread *thread_get(void)
+{
+    struct bee_thread *t;
+
+    pthread_mutex_lock(&thread_cache.mutex);
+    if ((t = thread_cache.idle) != NULL) {
+        thread_cache.idle = t->next;
+        thread_cache.nidle--;
+    }
+    pthread_mutex_unlock(&thread_cache.mutex);
+    return t;
+}
+
+/*
+ * 캐시의 스레드가 수행할 함수이다. 맡은 일꾼의 worker()를 실행하고, 캐시로 돌아가 다음 일꾼을 기다리기를 반복한다.
+ * 캐시가 꽉 차서 돌아갈 자리가 없으면 끝난다. 스레드는 분리된 상태로 만들므로 조인하지 않는다.
+ */
+static void *thread_main(void *param)
+{
+    struct bee_thread *t = (struct bee_thread *)param;
+    unsigned int go = atomic_load(&t->go);
+
+    while (true) {
+        worker(t->bee);
+        t->bee = NULL;
+        if (!thread_put(t))
+            break;
+        while (atomic_load(&t->go) == go)
+            futex_wait(&t->go, go);
+        go = atomic_load(&t->go);
+    }
+    free(t);
+    return NULL;
+}
+
+/*
+ * hive의 i번째 일꾼을 맡을 스레드를 시작한다. 캐시에 놀고 있는 스레드가 있으면 그 스레드에 맡기고,
+ * 없으면 새로 만든다. 일꾼을 묶을 CPU가 있으면 그 CPU에, 노드만 정했으면 노드의 CPU들에 묶는다.
+ * 새로 만드는 스레드는 처음부터 묶어서 만들고, 캐시의 스레드는 맡기기 전에 묶거나 앞서 묶인 것을 푼다.
+ * 성공하면 0을, 스레드를 만들지 못하면 pthread_create()의 리턴값을 리턴한다.
+ */
+static int bee_create(pthread_pool_t *pool, int i)
+{
+    struct bee *b = pool->hive[i];
+    struct bee_thread *t = thread_get();
+    bool bind = false;
+    int ret;
+#ifdef __linux__
+    cpu_set_t set;
+
+    pthread_once(&home_once, home_load);
+    if (b->cpu >= 0) {
+        CPU_ZERO(&set);
+        CPU_SET(b->cpu, &set);
+        bind = true;
+    }
+    else if (pool->nodes > 1)
+        bind = node_cpuset(pool, b->node, &set);
+#endif
+
+    atomic_fetch_add(&pool->threads, 1);
+    if (t != NULL) {
+#ifdef __linux__
+        if (bind)
+            pthread_setaffinity_np(t->tid, sizeof(set), &set);
+        else if (t->bound)
+            pthread_setaffinity_np(t->tid, sizeof(home_cpus), &home_cpus);
+#endif
+        t->bound = bind;
+        t->bee = b;
+        pool->bee[i] = t->tid;
+        atomic_fetch_add(&t->go, 1);
+        futex_wake(&t->go, 1);
+        return 0;
+    }
+
+    if ((t = (struct bee_thread *)malloc(sizeof(struct bee_thread))) == NULL) {
+        atomic_fetch_sub(&pool->threads, 1);
+        return ENOMEM;
+    }
+    atomic_init(&t->go, 0);
+    t->bee = b;
+    t->bound = bind;
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+#ifdef __linux__
+    if (bind)
+        pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+#endif
+    if ((ret = pthread_create(&t->tid, &attr, thread_main, t)) == 0)
+        pool->bee[i] = t->tid;
+    else {
+        atomic_fetch_sub(&pool->threads, 1);
+        free(t);
+    }
+    pthread_attr_destroy(&attr);
+    return ret;
+}
+
+/*
+ * 공유 일꾼이 한 번에 가져오는 작업의 최대 수이다. 스레드풀의 batch와 차례에 남은 몫 가운데 작은 값이 이보다 크면 이 값을 쓴다.
+ */
+#define SHARED_BATCH 32
+
+/*
+ * 공유 일꾼을 쓰는 스레드풀 pool에 꺼낼 작업이나 만료된 타이머가 있으면 true를 리턴한다. 만료되지 않은 타이머가 있으면
+ * 그 시각이 *next보다 이를 때 *next에 적어 둔다. 락을 쓰는 대기열이면 다른 스레드가 락을 잡고 있을 때 작업이 없다고 보고,
+ * 잠드는 공유 일꾼이 락이 풀린 뒤 다시 찾아보도록 *next를 다음 틱으로 당겨 둔다.
+ */
+static bool tenant_ready(pthread_pool_t *pool, uint64_t now, uint64_t *next)
+{
+    if (!atomic_load(&pool->running))
+        return false;
+    if (atomic_load(&pool->timers) > 0) {
+        uint64_t t = atomic_load(&pool->timer_next);
+        if (t <= now)
+            return true;
+        if (t < *next)
+            *next = t;
+    }
+    if (pool->ring != NULL)
+        return queue_nonempty(pool);
+    if (pthread_mutex_trylock(&pool->mutex) != 0) {
+        if (now + 1 < *next)
+            *next = now + 1;
+        return false;
+    }
+    bool ready = pool->q_len > 0;
+    pthread_mutex_unlock(&pool->mutex);
+    return ready;
+}
+
+/*
+ * 결손 라운드 로빈으로 공유 일꾼이 실행할 스레드풀을 고른다. 반드시 shared_bees.mutex를 잡은 상태에서 호출한다.
+ * cursor의 스레드풀에 차례가 처음 오면 deficit에 weight를 더하고, 작업을 가져갈 때마다 가져갈 수만큼 deficit에서
+ * reserved로 옮겨 둔다. 여러 공유 일꾼이 함께 몫을 넘겨 쓰지 않게 하려는 것이며, 실제로 치르는 것은 shared_run()이
+ * 작업을 꺼낸 뒤이다. 차례는 shared_run()이 deficit을 다 치렀을 때 넘어가고, 할 일이 없는 스레드풀은 남은 몫을 버리고 넘긴다.
+ * 이미 bee_size명의 공유 일꾼이 실행 중이거나 남은 몫을 모두 다른 공유 일꾼이 가져간 스레드풀은 몫을 남겨 둔 채 건너뛴다.
+ * 고른 스레드풀의 busy를 올리고 가져갈 작업 수를 *quota에 적어 리턴한다. 고를 스레드풀이 없으면 NULL을 리턴하며,
+ * 이때 *next에 가장 이른 타이머 시각을 적는다.
+ */
+static pthread_pool_t *shared_pick(int *quota, uint64_t *next)
+{
+    pthread_pool_t *pool = shared_bees.cursor;
+    uint64_t now = now_tick();
+
+    *next = UINT64_MAX;
+    for (int i = 0; pool != NULL && i < shared_bees.tenants; i++, pool = shared_bees.cursor) {
+        if (tenant_ready(pool, now, next)) {
+            if (pool->deficit == 0 && pool->reserved == 0)
+                pool->deficit = pool->weight;
+            if (pool->busy < atomic_load(&pool->bee_size) && pool->deficit > 0) {
+                int k = pool->deficit;
+                if (k > pool->batch)
+                    k = pool->batch;
+                if (k > SHARED_BATCH)
+                    k = SHARED_BATCH;
+                pool->deficit -= k;
+                pool->reserved += k;
+                pool->busy++;
+                *quota = k;
+                return pool;
+            }
+        }
+        else
+            pool->deficit = 0;
+        shared_bees.cursor = pool->tenant_next;
+    }
+    return NULL;
+}
+
+/*
+ * 공유 일꾼이 shared_pick()으로 고른 스레드풀 pool에서 작업을 최대 quota개까지 꺼내 실행한다.
+ * 만료된 타이머를 먼저 작업으로 요청하며, POOL_DISCARD로 종료 중이면 꺼내 둔 나머지 작업은 버린다.
+ * 작업을 꺼낸 뒤 미리 빼 둔 quota 가운데 실제로 꺼낸 수만큼만 치르고 나머지는 deficit에 돌려준다.
+ * 하나도 꺼내지 못했으면 할 일이 없는 스레드풀처럼 남은 몫을 버린다.
+ * 치른 뒤 deficit과 reserved가 모두 0이고 아직 이 스레드풀의 차례이면 다음 스레드풀로 차례를 넘긴다.
+ * 끝나면 busy를 내리고, 목록에서 빠진 스레드풀이거나 남은 작업이 끝나기를 기다리는 중이면 종료하는 스레드를 깨운다.
+ * 종료하는 스레드가 busy를 보고 스레드풀을 정리할 수 있으므로 깨우기도 공유 일꾼의 락을 잡은 채로 한다.
+ */
+static void shared_run(pthread_pool_t *pool, int quota)
+{
+    task_t tasks[SHARED_BATCH];
+
+    timer_poll(pool);
+    size_t n = queue_claim(pool, tasks, quota);
+    pthread_mutex_lock(&shared_bees.mutex);
+    pool->reserved -= quota;
+    pool->deficit = n > 0 ? pool->deficit + quota - (int)n : 0;
+    if (pool->deficit == 0 && pool->reserved == 0 && shared_bees.cursor == pool)
+        shared_bees.cursor = pool->tenant_next;
+    pthread_mutex_unlock(&shared_bees.mutex);
+    for (size_t i = 0; i < n; i++) {
+        if (atomic_load(&pool->discard)) {
+            shutdown_drop(pool, &tasks[i]);
+            continue;
+        }
+        if (pool->trace != NULL) {
+            void (*f)(void *p) = trace_start(pool, &tasks[i]);
+            task_call(&tasks[i]);
+            trace_note(pool, TRACE_END, f, 0);
+        }
+        else
+            task_call(&tasks[i]);
+    }
+
+    pthread_mutex_lock(&shared_bees.mutex);
+    if (--pool->busy == 0 && pool->tenant_next == NULL)
+        pthread_cond_broadcast(&shared_bees.left);
+    drain_note(pool);
+    pthread_mutex_unlock(&shared_bees.mutex);
+}
+
+/*
+ * 공유 일꾼 스레드가 수행할 함수이다. 스레드풀을 골라 작업을 실행하기를 끝없이 반복한다.
+ * 고를 스레드풀이 없으면 idle을 올리고 한 번 더 찾아본 뒤, 작업이 들어오거나 가장 이른 타이머의 시각이 될 때까지 잠든다.
+ */
+static void *shared_worker(void *param)
+{
+    pthread_pool_t *pool;
+    uint64_t next;
+    int quota;
+
+    (void)param;
+    while (true) {
+        pthread_mutex_lock(&shared_bees.mutex);
+        pool = shared_pick(&quota, &next);
+        pthread_mutex_unlock(&shared_bees.mutex);
+        if (pool != NULL) {
+            shared_run(pool, quota);
+            continue;
+        }
+
+        unsigned int key = atomic_load(&shared_bees.seq);
+        atomic_fetch_add(&shared_bees.idle, 1);
+        pthread_mutex_lock(&shared_bees.mutex);
+        pool = shared_pick(&quota, &next);
+        pthread_mutex_unlock(&shared_bees.mutex);
+        if (pool == NULL) {
+            struct timespec ts;
+            uint64_t now = now_tick();
+            if (next != UINT64_MAX)
+                abstime_after(&ts, next > now ? next - now : 0);
+            futex_timedwait(&shared_bees.seq, key, next != UINT64_MAX ? &ts : NULL);
+        }
+        atomic_fetch_sub(&shared_bees.idle, 1);
+        if (pool != NULL)
+            shared_run(pool, quota);
+    }
+    return NULL;
+}
+
+/*
+ * 스레드풀 pool을 공유 일꾼의 목록 끝에 넣는다. 공유 일꾼이 아직 없으면 CPU 수만큼 만든다.
+ * 공유 일꾼을 하나도 만들지 못하면 false를 리턴한다.
+ */
+static bool shared_join(pthread_pool_t *pool)
+{
+    pthread_mutex_lock(&shared_bees.mutex);
+    if (shared_bees.nthreads == 0) {
+        long n = sysconf(_SC_NPROCESSORS_ONLN);
+        pthread_attr_t attr;
+        pthread_t tid;
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        for (long i = 0; i < (n > 0 ? n : 1) && i < POOL_MAXBSIZE; i++)
+            if (pthread_create(&tid, &attr, shared_worker, NULL) == 0)
+                shared_bees.nthreads++;
+        pthread_attr_destroy(&attr);
+    }
+    if (shared_bees.nthreads == 0) {
+        pthread_mutex_unlock(&shared_bees.mutex);
+        return false;
+    }
+    if (shared_bees.cursor == NULL) {
+        pool->tenant_next = pool->tenant_prev = pool;
+        shared_bees.cursor = pool;
+    }
+    else {
+        pool->tenant_next = shared_bees.cursor;
+        pool->tenant_prev = shared_bees.cursor->tenant_prev;
+        pool->tenant_prev->tenant_next = pool;
+        shared_bees.cursor->tenant_prev = pool;
+    }
+    shared_bees.tenants++;
+    pthread_mutex_unlock(&shared_bees.mutex);
+    return true;
+}
+
+/*
+ * 종료하는 스레드풀 pool을 공유 일꾼의 목록에서 빼고, 그 작업을 실행 중인 공유 일꾼이 모두 끝나기를 기다린다.
+ * 돌아온 뒤에는 공유 일꾼이 pool을 건드리지 않는다.
+ */
+static void shared_leave(pthread_pool_t *pool)
+{
+    pthread_mutex_lock(&shared_bees.mutex);
+    if (pool->tenant_next == pool)
+        shared_bees.cursor = NULL;
+    else {
+        pool->tenant_prev->tenant_next = pool->tenant_next;
+        pool->tenant_next->tenant_prev = pool->tenant_prev;
+        if (shared_bees.cursor == pool)
+            shared_bees.cursor = pool->tenant_next;
+    }
+    pool->tenant_next = pool->tenant_prev = NULL;
+    shared_bees.tenants--;
+    while (pool->busy > 0)
+        pthread_cond_wait(&shared_bees.left, &shared_bees.mutex);
+    pthread_mutex_unlock(&shared_bees.mutex);
+}
+
+/*
+ * 스레드풀에 할당된 공간을 모두 반납한다. 생성 도중에 실패했을 때와 종료할 때 사용한다.
+ * 덱은 키우기 전에 쓰던 버퍼까지 prev를 따라가며 함께 반납한다.
+ * 물러난 일꾼의 제어 블록도 hive에 남아 있으므로 표 전체를 훑는다.
+ */
+static void pool_free(pthread_pool_t *pool)
+{
+    for (int i = 0; pool->hive != NULL && i < POOL_MAXBSIZE; i++) {
+        if (pool->hive[i] == NULL)
+            continue;
+        struct deque_buf *d = pool->hive[i]->buf;
+        while (d != NULL) {
+            struct deque_buf *prev = d->prev;
+            free(d);
+            d = prev;
+        }
+        free(pool->hive[i]->claim);
+        free(pool->hive[i]->hist);
+        free(pool->hive[i]->trace);
+        free(pool->hive[i]);
+    }
+    while (pool->fut_slab != NULL) {
+        struct future_slab *next = pool->fut_slab->next;
+        free(pool->fut_slab);
+        pool->fut_slab = next;
+    }
+    free(pool->hive);
+    for (int i = 0; pool->lane != NULL && i < pool->nodes * pool->prio; i++) {
+        ring_free(pool->lane[i].ring);
+        if (i % pool->prio == 0)
+            free(pool->lane[i].q);
+    }
+    free(pool->lane);
+    free(pool->wheel);
+    free(pool->cpus);
+    free(pool->trace);
+    while (pool->fiber_all != NULL) {
+        struct pool_fiber *next = pool->fiber_all->all;
+        munmap(pool->fiber_all->mem, pool->fiber_all->size);
+        free(pool->fiber_all);
+        pool->fiber_all = next;
+    }
+    io_free(pool->io);
+    free(pool->bee);
+}
+
+/*
+ * 스레드풀 속성을 기본값으로 초기화한다. 기본값은 pthread_pool_init()과 같은 동작을 하도록 정한다.
+ */
+int pthread_pool_attr_init(pthread_pool_attr_t *attr)
+{
+    attr->sched = POOL_SCHED_FIFO;
+    attr->queue = POOL_DEFAULT_QUEUE;
+    attr->batch = 1;
+    attr->prio = 1;
+    attr->age = 8;
+    attr->bee_min = 0;
+    attr->bee_max = 0;
+    attr->grow_len = 0;
+    attr->idle_ms = 1000;
+    attr->affinity = POOL_AFFINITY_NONE;
+    attr->cpus = NULL;
+    attr->ncpus = 0;
+    attr->numa = false;
+    attr->spin_us = 0;
+    attr->yields = 0;
+    attr->stats = false;
+    attr->on_full = POOL_WAIT;
+    attr->reject = NULL;
+    attr->reject_ctx = NULL;
+    attr->lazy = false;
+    attr->trace = 0;
+    attr->fiber_stack = 64 * 1024;
+    attr->io_threads = 2;
+    attr->shared = false;
+    attr->weight = 1;
+    return POOL_SUCCESS;
+}
+
+/*
+ * 스레드풀을 생성한다. bee_size는 일꾼(일벌) 스레드의 개수이고, queue_size는 대기열의 용량이다.
+ * 속성은 모두 기본값을 사용하며 자세한 내용은 pthread_pool_init_attr()와 같다.
+ */
+int pthread_pool_init(pthread_pool_t *pool, size_t bee_size, size_t queue_size)
+{
+    return pthread_pool_init_attr(pool, bee_size, queue_size, NULL);
+}
+
+/*
+ * 스레드풀을 생성한다. bee_size는 일꾼(일벌) 스레드의 개수이고, queue_size는 대기열의 용량이다.
+ * bee_size는 POOL_MAXBSIZE를, queue_size는 POOL_MAXQSIZE를 넘을 수 없다.
+ * 일꾼 스레드와 대기열에 필요한 공간을 할당하고 변수를 초기화한다.
+ * 일꾼 스레드의 동기화를 위해 사용할 상호배타 락과 조건변수도 초기화한다.
+ * 마지막 단계에서는 일꾼 스레드를 생성하여 각 스레드가 worker() 함수를 실행하게 한다.
+ * 대기열로 사용할 원형 버퍼의 용량이 일꾼 스레드의 수보다 작으면 효율을 극대화할 수 없다.
+ * 이런 경우 사용자가 요청한 queue_size를 bee_size로 상향 조정한다.
+ * attr이 NULL이면 기본 속성을 사용한다. 작업 훔치기 모드이면 일꾼마다 queue_size 이상인
+ * 2의 거듭제곱 크기의 덱을 따로 할당한다. 덱은 필요하면 스스로 늘어난다.
+ * 일꾼 스레드의 ID와 제어 블록은 POOL_MAXBSIZE 크기의 표에 두므로 나중에 pthread_pool_resize()로 일꾼 수를 바꿀 수 있다.
+ * NUMA 노드마다 대기열을 나누면 이 스레드를 잠시 노드마다 옮겨 가며 그 노드의 대기열과 일꾼의 제어 블록을 할당한다.
+ * 일꾼 스레드를 하나라도 만들지 못하면 이미 만든 일꾼을 끝내고 자원을 돌려준다.
+ * 성공하면 POOL_SUCCESS를, 실패하면 POOL_FAIL을 리턴한다.
+ */
+int pthread_pool_init_attr(pthread_pool_t *pool, size_t bee_size, size_t queue_size, const pthread_pool_attr_t *attr)
+{
+    pthread_pool_attr_t def;
+
+    if (attr == NULL) {
+        pthread_pool_attr_init(&def);
+        attr = &def;
+    }
+
+    //bee_size 또는 queue_size가 각각 지정된 크기를 넘었으므로 POOL_FAIL을 리턴한다.
+    //공간을 할당하기 전에 검사해야 실패했을 때 새는 메모리가 없다.
+    if (bee_size > POOL_MAXBSIZE || queue_size > POOL_MAXQSIZE)
+        return POOL_FAIL;
+    if (attr->sched != POOL_SCHED_FIFO && attr->sched != POOL_SCHED_STEAL)
+        return POOL_FAIL;
+    if (attr->queue != POOL_QUEUE_LOCK && attr->queue != POOL_QUEUE_LOCKFREE)
+        return POOL_FAIL;
+    if (attr->batch < 1 || attr->batch > POOL_MAXQSIZE)
+        return POOL_FAIL;
+    if (attr->prio < 1 || attr->prio > POOL_MAXPRIO || attr->age < 0)
+        return POOL_FAIL;
+    if (attr->bee_max != 0 && (attr->bee_min < 0 || attr->bee_min > (int)bee_size ||
+                               attr->bee_max < (int)bee_size || attr->bee_max > POOL_MAXBSIZE ||
+                               attr->grow_len < 0 || attr->idle_ms < 1))
+        return POOL_FAIL;
+    if (attr->affinity < POOL_AFFINITY_NONE || attr->affinity > POOL_AFFINITY_SPREAD ||
+        (attr->cpus != NULL && attr->ncpus < 1))
+        return POOL_FAIL;
+    if (attr->spin_us < 0 || attr->spin_us > 1000000 || attr->yields < 0)
+        return POOL_FAIL;
+    if (attr->on_full < POOL_WAIT || attr->on_full > POOL_DROP_OLDEST)
+        return POOL_FAIL;
+    if (attr->trace < 0 || attr->trace > (1 << 24))
+        return POOL_FAIL;
+    if (attr->fiber_stack < 16 * 1024)
+        return POOL_FAIL;
+    if (attr->io_threads < 1 || attr->io_threads > POOL_MAXBSIZE)
+        return POOL_FAIL;
+    if (attr->shared && (attr->sched != POOL_SCHED_FIFO || attr->bee_max != 0 || bee_size < 1 ||
+                         attr->affinity != POOL_AFFINITY_NONE || attr->numa ||
+                         attr->weight < 1 || attr->weight > POOL_MAXQSIZE))
+        return POOL_FAIL;
+
+    //대기열로 사용할 원형 버퍼의 용량이 일꾼 스레드의 수보다 작으면 queue_size를 bee_size로 상향 조정한다.
+    if (queue_size < bee_size)
+        queue_size = bee_size;
+
+    //스레드풀 구조체 초기화를 해준다.
+    pool->running = true;
+    pool->q = NULL;
+    pool->q_size = queue_size;
+    pool->q_len = 0;
+    pool->bee = (pthread_t *)malloc(POOL_MAXBSIZE * sizeof(pthread_t));
+    pool->bee_size = bee_size;
+    pool->sched = attr->sched;
+    pool->hive = (struct bee **)calloc(POOL_MAXBSIZE, sizeof(struct bee *));
+    pool->idle = 0;
+    pool->ring = NULL;
+    pool->notempty = 0;
+    pool->notfull = 0;
+    pool->blocked = 0;
+    pool->batch = attr->batch;
+    pool->discard = false;
+    pool->draining = false;
+    pool->drain_seq = 0;
+    pool->discarded = 0;
+    pool->fut_free = NULL;
+    pool->fut_slab = NULL;
+    pool->prio = attr->prio;
+    pool->age = attr->age;
+    //CPU가 하나뿐이면 도는 동안 작업을 넣을 스레드가 실행될 수 없으므로 돌지 않고 양보만 한다.
+    pool->spin_ns = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? attr->spin_us * 1000L : 0;
+    pool->yields = attr->yields;
+    pool->submit_gap = pool->spin_ns / 2;
+    pool->submit_spin_ns = pool->spin_ns;
+    for (int k = 0; k < 3; k++)
+        pool->submit_waits[k] = 0;
+    pool->stats = attr->stats;
+    pool->q_high = 0;
+    pool->rejected = 0;
+    pool->on_full = attr->on_full;
+    pool->reject = attr->reject;
+    pool->reject_ctx = attr->reject_ctx;
+    pool->caller_ran = 0;
+    pool->dropped = 0;
+    pool->canceled = 0;
+    //사건을 남기면 버퍼의 크기를 2의 거듭제곱으로 올리고, 시계 값을 나노초로 바꿀 기준을 잰다.
+    pool->trace_size = 1;
+    while (pool->trace_size < attr->trace)
+        pool->trace_size <<= 1;
+    pool->trace = attr->trace > 0 ? trace_alloc(pool->trace_size) : NULL;
+    pool->trace_ns = now_ns();
+    pool->trace_tick = trace_clock();
+    pool->fiber_free = NULL;
+    pool->fiber_all = NULL;
+    pool->fiber_stack = (attr->fiber_stack + sysconf(_SC_PAGESIZE) - 1) & ~((size_t)sysconf(_SC_PAGESIZE) - 1);
+    pool->io = NULL;
+    pool->io_threads = attr->io_threads;
+    pool->shared = attr->shared;
+    pool->weight = attr->weight;
+    pool->deficit = 0;
+    pool->reserved = 0;
+    pool->busy = 0;
+    pool->tenant_next = pool->tenant_prev = NULL;
+    pool->nodes = 1;
+    pool->affinity = attr->affinity;
+    if (attr->affinity != POOL_AFFINITY_NONE || attr->numa) {
+        pthread_once(&topo_once, topo_load);
+        if (attr->numa)
+            pool->nodes = topo_nodes;
+    }
+    pool->lane = (struct pool_lane *)calloc(pool->nodes * attr->prio, sizeof(struct pool_lane));
+    pool->bee_target = bee_size;
+    pool->threads = 0;
+    pool->dormant = attr->lazy && !attr->shared;
+    pool->wheel = (struct timer_wheel *)calloc(1, sizeof(struct timer_wheel));
+    pool->timers = 0;
+    pool->timer_next = UINT64_MAX;
+    pool->timer_keeper = false;
+    pool->bee_min = attr->bee_min;
+    pool->bee_max = attr->bee_max;
+    pool->grow_len = attr->grow_len > 0 ? attr->grow_len : (int)queue_size / 2;
+    pool->idle_ms = attr->idle_ms;
+
+    if (pool->wheel != NULL)
+        pool->wheel->now = now_tick();
+
+    //일꾼을 배치할 CPU의 순서를 정한다.
+    bool lanes_ok = pool->lane != NULL;
+    if (!cpus_init(pool, attr))
+        lanes_ok = false;
+
+    //노드마다 q를 할당해서 우선순위 단계마다 q_size개씩 나눠 준다.
+    //락 없는 대기열을 사용하면 q 대신 단계마다 같은 크기의 원형 버퍼를 할당한다.
+    //노드를 나눴으면 그 노드의 CPU로 옮겨서 할당하고 채워 노드의 메모리에 놓이게 한다. 이때 q는 페이지 단위로 잡는다.
+    for (int n = 0; lanes_ok && n < pool->nodes; n++) {
+        saved_cpus_t saved;
+        bool entered = node_enter(pool, n, &saved);
+        task_t *q = NULL;
+        if (attr->queue == POOL_QUEUE_LOCK) {
+            size_t size = attr->prio * queue_size * sizeof(task_t);
+            if (pool->nodes > 1) {
+                size = (size + 4095) & ~(size_t)4095;
+                if ((q = (task_t *)aligned_alloc(4096, size)) != NULL)
+                    memset(q, 0, size);
+            }
+            else
+                q = (task_t *)line_alloc(size);
+        }
+        for (int l = 0; l < pool->prio; l++) {
+            struct pool_lane *lane = &pool->lane[n * pool->prio + l];
+            lane->q = q != NULL ? q + l * queue_size : NULL;
+            lane->front = 0;
+            lane->len = 0;
+            lane->ring = attr->queue == POOL_QUEUE_LOCKFREE ? ring_alloc(queue_size) : NULL;
+            atomic_init(&lane->passed, 0);
+            if (lane->q == NULL && lane->ring == NULL)
+                lanes_ok = false;
+        }
+        node_leave(entered, &saved);
+    }
+    if (lanes_ok) {
+        pool->q = pool->lane[0].q;
+        pool->ring = pool->lane[0].ring;
+    }
+
+    //스레드풀 생성에 실패했으므로 POOL_FAIL을 리턴한다.
+    if (!lanes_ok || pool->bee == NULL || pool->hive == NULL || pool->wheel == NULL ||
+        (attr->trace > 0 && pool->trace == NULL)) {
+        pool_free(pool);
+        return POOL_FAIL;
+    }
+
+    //일꾼마다 제어 블록을 할당한다. 작업 훔치기 모드이면 덱으로 쓸 버퍼를,
+    //한꺼번에 가져온 작업을 담을 claim도 batch 크기로 함께 할당한다. 공유 일꾼을 쓰면 자기 일꾼이 없다.
+    for (int i = 0; !pool->shared && i < bee_size; i++) {
+        if ((pool->hive[i] = bee_alloc(pool, i, deque_initial_size(pool))) == NULL) {
+            pool_free(pool);
+            return POOL_FAIL;
+        }
+    }
+
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_mutex_init(&pool->fut_mutex, NULL);
+    pthread_mutex_init(&pool->fiber_mutex, NULL);
+    pthread_mutex_init(&pool->resize_mutex, NULL);
+    pthread_mutex_init(&pool->timer_mutex, NULL);
+    pthread_cond_init(&pool->full, NULL);
+    pthread_cond_init(&pool->empty, NULL);
+
+    //공유 일꾼을 쓰면 공유 일꾼의 목록에 들어간다. 공유 일꾼을 만들 수 없으면 실패한다.
+    if (pool->shared && !shared_join(pool)) {
+        pthread_mutex_destroy(&pool->mutex);
+        pthread_mutex_destroy(&pool->fut_mutex);
+        pthread_mutex_destroy(&pool->fiber_mutex);
+        pthread_mutex_destroy(&pool->resize_mutex);
+        pthread_mutex_destroy(&pool->timer_mutex);
+        pthread_cond_destroy(&pool->full);
+        pthread_cond_destroy(&pool->empty);
+        pool_free(pool);
+        return POOL_FAIL;
+    }
+
+    //일꾼 스레드를 생성한다. lazy이면 첫 작업이 들어올 때 pool_start()에서 시작한다.
+    //스레드를 만들지 못하면 이미 만든 일꾼만 세어 두고 종료해서 자원을 돌려준 뒤 실패를 알린다.
+    for (int i = 0; !pool->shared && !pool->dormant && i < bee_size; i++) {
+        if (bee_create(pool, i) != 0) {
+            atomic_store(&pool->bee_size, i);
+            atomic_store(&pool->bee_target, i);
+            pthread_pool_shutdown(pool, POOL_DISCARD);
+            return POOL_FAIL;
+        }
+    }
+
+    //스레드풀 생성에 성공했으므로 POOL_SUCCESS를 리턴한다.
+    return POOL_SUCCESS;
+}
+
+/*
+ * lazy로 만들어 아직 일꾼을 시작하지 않은 스레드풀의 일꾼을 시작한다. 작업이나 타이머를 넣기 전과 일꾼 수를 바꾸기 전에 부른다.
+ * 여러 스레드가 동시에 불러도 한 번만 시작한다. 이미 시작했으면 dormant만 보고 바로 돌아오므로 비용이 작다.
+ * 스레드를 만들지 못하면 bee_size와 bee_target을 실제로 시작한 일꾼의 수로 줄인다. 하나도 시작하지 못했으면
+ * dormant를 그대로 두어 다음에 다시 시도하고 false를 리턴한다. 그 밖에는 true를 리턴한다.
+ */
+static bool pool_start(pthread_pool_t *pool)
+{
+    bool started = true;
+
+    if (!atomic_load_explicit(&pool->dormant, memory_order_acquire))
+        return true;
+    pthread_mutex_lock(&pool->resize_mutex);
+    if (atomic_load(&pool->dormant) && atomic_load(&pool->running)) {
+        int i, size = atomic_load(&pool->bee_size);
+        for (i = 0; i < size && bee_create(pool, i) == 0; i++)
+            ;
+        if (i == 0 && size > 0)
+            started = false;
+        else {
+            if (i < size) {
+                atomic_store(&pool->bee_size, i);
+                if (atomic_load(&pool->bee_target) > i)
+                    atomic_store(&pool->bee_target, i);
+            }
+            atomic_store_explicit(&pool->dormant, false, memory_order_release);
+        }
+    }
+    pthread_mutex_unlock(&pool->resize_mutex);
+    return started;
+}
+
+/*
+ * hive의 i번째 자리에 일꾼 스레드를 새로 만든다. 반드시 resize_mutex를 잡은 상태에서 i가 bee_size일 때 호출한다.
+ * 제어 블록이 없으면 할당하고, 전에 물러난 일꾼이 있던 자리이면 그 제어 블록을 다시 쓴다.
+ * 물러난 일꾼의 덱은 비어 있고 도둑이 아직 보고 있을 수 있으므로 top과 bottom은 그대로 이어서 쓴다.
+ * 실패하면 false를 리턴한다.
+ */
+static bool bee_spawn(pthread_pool_t *pool, int i)
+{
+    struct bee *b = pool->hive[i];
+
+    if (b == NULL) {
+        if ((b = bee_alloc(pool, i, deque_initial_size(pool))) == NULL)
+            return false;
+        pool->hive[i] = b;
+    }
+    b->claim_pos = b->claim_len = 0;
+    atomic_store(&pool->bee_size, i + 1);
+    if (bee_create(pool, i) != 0) {
+        atomic_store(&pool->bee_size, i);
+        return false;
+    }
+    return true;
+}
+
+/*
+ * 자동 조절 중에 작업을 넣은 뒤 대기열의 길이 len을 보고 일꾼을 하나 늘릴지 정한다.
+ * 잠든 일꾼이 없는데 대기열이 grow_len보다 길게 쌓여 있으면 일꾼이 모자란 것으로 보고 bee_max까지 늘린다.
+ * 다른 스레드가 이미 일꾼 수를 바꾸고 있으면 그 스레드에 맡기고 기다리지 않는다.
+ */
+static void pool_autogrow(pthread_pool_t *pool, size_t len)
+{
+    if (pool->bee_max == 0 || len <= (size_t)pool->grow_len || atomic_load(&pool->idle) > 0 ||
+        atomic_load(&pool->bee_size) >= pool->bee_max)
+        return;
+    if (pthread_mutex_trylock(&pool->resize_mutex) != 0)
+        return;
+    int size = atomic_load(&pool->bee_size);
+    if (atomic_load(&pool->running) && size < pool->bee_max && bee_spawn(pool, size) &&
+        atomic_load(&pool->bee_target) < size + 1)
+        atomic_store(&pool->bee_target, size + 1);
+    pthread_mutex_unlock(&pool->resize_mutex);
+}
+
+/*
+ * 락 없는 대기열의 모든 단계에 쌓인 작업의 수를 센다. 자동 조절의 기준으로만 쓰므로 대략적인 값이면 된다.
+ */
+static size_t ring_queued(pthread_pool_t *pool)
+{
+    size_t len = 0;
+
+    for (int i = 0; i < pool->nodes * pool->prio; i++) {
+        struct ring *r = pool->lane[i].ring;
+        len += atomic_load(&r->tail) - atomic_load(&r->head);
+    }
+    return len;
+}
+
+/*
+ * 실행 중인 스레드풀의 일꾼 수를 bee_size로 바꾼다. bee_size는 POOL_MAXBSIZE를 넘을 수 없다.
+ * 늘릴 때는 바로 일꾼 스레드를 만들고, 만들지 못하면 그때까지 만든 일꾼만 남기고 POOL_FAIL을 리턴한다.
+ * 줄일 때는 목표만 정하고 기다리지 않는다. 가장 마지막 일꾼부터 하던 작업과 자기 덱의 작업을 마친 뒤
+ * 할 일이 없을 때 차례로 물러나므로, 작업 안에서 호출해도 교착상태가 생기지 않는다.
+ * 자동 조절 중이면 이후의 일꾼 수는 다시 bee_min과 bee_max 사이에서 부하에 따라 바뀐다.
+ * 공유 일꾼을 쓰는 스레드풀이면 스레드를 만들지 않고 동시에 실행할 공유 일꾼의 최대 수만 바꾸며, 이때 bee_size는 1 이상이어야 한다.
+ * 종료 중인 스레드풀이면 POOL_FAIL을, 그 밖에는 POOL_SUCCESS를 리턴한다.
+ */
+int pthread_pool_resize(pthread_pool_t *pool, size_t bee_size)
+{
+    int ret = POOL_SUCCESS;
+    bool shrink;
+
+    if (bee_size > POOL_MAXBSIZE || (pool->shared && bee_size < 1))
+        return POOL_FAIL;
+    if (pool->shared) {
+        pthread_mutex_lock(&pool->resize_mutex);
+        if (atomic_load(&pool->running)) {
+            atomic_store(&pool->bee_size, (int)bee_size);
+            atomic_store(&pool->bee_target, (int)bee_size);
+        }
+        else
+            ret = POOL_FAIL;
+        pthread_mutex_unlock(&pool->resize_mutex);
+        wake_all_bees(pool);
+        return ret;
+    }
+    if (!pool_start(pool))
+        return POOL_FAIL;
+    pthread_mutex_lock(&pool->resize_mutex);
+    if (!atomic_load(&pool->running)) {
+        pthread_mutex_unlock(&pool->resize_mutex);
+        return POOL_FAIL;
+    }
+    atomic_store(&pool->bee_target, (int)bee_size);
+    for (int i = atomic_load(&pool->bee_size); i < (int)bee_size; i++) {
+        if (!bee_spawn(pool, i)) {
+            atomic_store(&pool->bee_target, i);
+            ret = POOL_FAIL;
+            break;
+        }
+    }
+    shrink = atomic_load(&pool->bee_size) > (int)bee_size;
+    pthread_mutex_unlock(&pool->resize_mutex);
+
+    //잠든 일꾼은 깨어나야 물러날 수 있으므로 모두 깨운다.
+    if (shrink)
+        wake_all_bees(pool);
+    return ret;
+}
+
+/*
+ * 일꾼과 요청 스레드의 기다림이 돌기, 양보하기, 잠들기 가운데 어느 단계에서 끝났는지 센 값을 stats에 채운다.
+ * 일꾼의 카운터는 일꾼마다 따로 세고 읽을 때만 모으므로, 세는 비용은 일꾼 자신의 캐시 라인에 한 번 쓰는 것뿐이다.
+ * 물러난 일꾼이 센 값도 합친다. 항상 POOL_SUCCESS를 리턴한다.
+ */
+int pthread_pool_wait_stats(pthread_pool_t *pool, pool_wait_stats_t *stats)
+{
+    unsigned long bee[3] = { 0, 0, 0 };
+
+    pthread_mutex_lock(&pool->resize_mutex);
+    for (int i = 0; i < POOL_MAXBSIZE; i++) {
+        if (pool->hive[i] == NULL)
+            continue;
+        for (int k = 0; k < 3; k++)
+            bee[k] += atomic_load_explicit(&pool->hive[i]->waits[k], memory_order_relaxed);
+    }
+    pthread_mutex_unlock(&pool->resize_mutex);
+    stats->bee.park = bee[WAIT_PARK];
+    stats->bee.spin = bee[WAIT_SPIN];
+    stats->bee.yield = bee[WAIT_YIELD];
+    stats->submit.park = atomic_load_explicit(&pool->submit_waits[WAIT_PARK], memory_order_relaxed);
+    stats->submit.spin = atomic_load_explicit(&pool->submit_waits[WAIT_SPIN], memory_order_relaxed);
+    stats->submit.yield = atomic_load_explicit(&pool->submit_waits[WAIT_YIELD], memory_order_relaxed);
+    return POOL_SUCCESS;
+}
+
+/*
+ * 스레드풀의 통계를 stats에 채운다. 일꾼은 자기 제어 블록의 카운터만 고치고 여기서 읽을 때 모으므로,
+ * 통계를 켜 두어도 작업마다 드는 비용은 시각 두 번 재기와 자기 캐시 라인에 쓰기 몇 번뿐이다.
+ * 일꾼이 고치는 도중에 읽으므로 값끼리 조금 어긋날 수 있다. 항상 POOL_SUCCESS를 리턴한다.
+ */
+int pthread_pool_stats(pthread_pool_t *pool, pool_stats_t *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    pthread_mutex_lock(&pool->resize_mutex);
+    stats->bee_size = atomic_load(&pool->bee_size);
+    for (int i = 0; i < POOL_MAXBSIZE; i++) {
+        struct bee *b = pool->hive[i];
+        if (b == NULL)
+            continue;
+        stats->bee[i].tasks = atomic_load_explicit(&b->tasks, memory_order_relaxed);
+        stats->bee[i].busy_ns = atomic_load_explicit(&b->busy_ns, memory_order_relaxed);
+        stats->bee[i].idle_ns = atomic_load_explicit(&b->idle_ns, memory_order_relaxed);
+        stats->tasks += stats->bee[i].tasks;
+        for (int k = 0; b->hist != NULL && k < POOL_HIST_BUCKETS; k++) {
+            stats->wait_hist[k] += atomic_load_explicit(&b->hist[k], memory_order_relaxed);
+            stats->run_hist[k] += atomic_load_explicit(&b->hist[POOL_HIST_BUCKETS + k], memory_order_relaxed);
+        }
+    }
+    pthread_mutex_unlock(&pool->resize_mutex);
+    stats->rejected = atomic_load_explicit(&pool->rejected, memory_order_relaxed);
+    stats->caller_ran = atomic_load_explicit(&pool->caller_ran, memory_order_relaxed);
+    stats->dropped = atomic_load_explicit(&pool->dropped, memory_order_relaxed);
+    stats->canceled = atomic_load_explicit(&pool->canceled, memory_order_relaxed);
+    stats->queue_high = atomic_load_explicit(&pool->q_high, memory_order_relaxed);
+    return pthread_pool_wait_stats(pool, &stats->wait);
+}
+
+/*
+ * 히스토그램의 칸 bucket이 나타내는 값의 범위에서 가장 작은 값(나노초)을 리턴한다. hist_bucket()의 역이다.
+ */
+unsigned long pthread_pool_hist_value(int bucket)
+{
+    if (bucket < (1 << HIST_SUB_BITS))
+        return bucket < 0 ? 0 : bucket;
+    int e = (bucket >> HIST_SUB_BITS) + HIST_SUB_BITS - 1;
+    return (unsigned long)((1 << HIST_SUB_BITS) | (bucket & ((1 << HIST_SUB_BITS) - 1))) << (e - HIST_SUB_BITS);
+}
+
+/*
+ * 히스토그램 hist에서 p(0에서 100 사이) 백분위수에 해당하는 값을 리턴한다.
+ * 그 값이 들어 있는 칸에서 가장 큰 값을 리턴하므로 실제 값보다 작게 나오지 않는다. 비어 있으면 0을 리턴한다.
+ */
+unsigned long pthread_pool_hist_percentile(const unsigned long *hist, double p)
+{
+    unsigned long total = 0, seen = 0;
+
+    for (int k = 0; k < POOL_HIST_BUCKETS; k++)
+        total += hist[k];
+    if (total == 0)
+        return 0;
+    for (int k = 0; k < POOL_HIST_BUCKETS; k++) {
+        seen += hist[k];
+        if (seen >= total * p / 100.0 && seen > 0)
+            return pthread_pool_hist_value(k + 1) - 1;
+    }
+    return pthread_pool_hist_value(POOL_HIST_BUCKETS) - 1;
+}
+
+/*
+ * 기록 버퍼 t에 남은 사건을 Chrome trace 형식의 JSON 객체로 out에 쓴다. 쓴 사건의 수를 리턴한다.
+ * scale은 시계 값 하나가 몇 나노초인지이고, 시각은 스레드풀을 만든 때부터 잰 마이크로초로 쓴다.
+ * 사건을 남기는 중에도 읽을 수 있으며, 읽는 사이 덮어쓴 칸은 건너뛴다.
+ * 작업의 이름은 함수의 주소이므로 addr2line 같은 도구로 함수 이름을 찾는다.
+ */
+static long trace_write(FILE *out, pthread_pool_t *pool, struct trace_buf *t, double scale, int pid, long count)
+{
+    static const char *const names[] = { "submit", "dequeue", "steal" };
+    unsigned long head = atomic_load_explicit(&t->head, memory_order_acquire);
+    unsigned long from = head > t->mask + 1 ? head - t->mask - 1 : 0;
+
+    for (unsigned long i = from; i < head; i++) {
+        struct trace_event *e = &t->ev[i & t->mask];
+        unsigned long seq = atomic_load_explicit(&e->seq, memory_order_acquire);
+        unsigned long long tick = e->tick;
+        void (*f)(void *p) = e->function;
+        long n = e->n;
+        int tid = e->tid, type = e->type;
+        atomic_thread_fence(memory_order_acquire);
+        if (seq != i + 1 || atomic_load_explicit(&e->seq, memory_order_relaxed) != seq)
+            continue;
+
+        double us = (double)(long long)(tick - pool->trace_tick) * scale / 1000.0;
+        fprintf(out, "%s\n", count++ > 0 ? "," : "");
+        switch (type) {
+        case TRACE_SUBMIT:
+        case TRACE_DEQUEUE:
+        case TRACE_STEAL:
+            fprintf(out, "{\"name\":\"%s\",\"cat\":\"queue\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":%d,\"tid\":%d,"
+                    "\"args\":{\"fn\":\"%p\",\"%s\":%ld}}",
+                    names[type], us, pid, tid, (void *)f, type == TRACE_STEAL ? "from" : "n", n);
+            break;
+        case TRACE_START:
+            fprintf(out, "{\"name\":\"%p\",\"cat\":\"task\",\"ph\":\"B\",\"ts\":%.3f,\"pid\":%d,\"tid\":%d}",
+                    (void *)f, us, pid, tid);
+            break;
+        case TRACE_PARK:
+            fprintf(out, "{\"name\":\"park\",\"cat\":\"wait\",\"ph\":\"B\",\"ts\":%.3f,\"pid\":%d,\"tid\":%d}",
+                    us, pid, tid);
+            break;
+        default:
+            fprintf(out, "{\"ph\":\"E\",\"ts\":%.3f,\"pid\":%d,\"tid\":%d}", us, pid, tid);
+            break;
+        }
+    }
+    return count;
+}
+
+/*
+ * 속성의 trace로 남긴 사건을 Chrome trace 형식(JSON)으로 path 파일에 쓴다. 파일은 Perfetto나 chrome://tracing에서 연다.
+ * 일꾼은 hive에서의 위치를 스레드 번호로 쓰고, 일꾼이 아닌 스레드는 POOL_MAXBSIZE보다 큰 번호를 받는다.
+ * 작업은 시작부터 끝까지의 구간으로, 일꾼이 잠든 동안은 park 구간으로, 요청과 꺼내기와 훔치기는 순간 사건으로 나타난다.
+ * 스레드풀이 실행 중일 때 불러도 되며, 종료한 뒤에는 부를 수 없다.
+ * 시계 값을 나노초로 바꾸는 비율은 스레드풀을 만든 뒤 지난 시간으로 구하므로, 10밀리초가 지나지 않았으면 그때까지 기다린다.
+ * 사건을 남기지 않는 스레드풀이거나 파일을 쓰지 못하면 POOL_FAIL을 리턴한다.
+ */
+int pthread_pool_trace_dump(pthread_pool_t *pool, const char *path)
+{
+    if (pool->trace == NULL)
+        return POOL_FAIL;
+
+    FILE *out = fopen(path, "w");
+    if (out == NULL)
+        return POOL_FAIL;
+
+    long ns = now_ns();
+    while (ns - pool->trace_ns < 10000000L) {
+        struct timespec ts = { 0, 10000000L - (ns - pool->trace_ns) };
+        nanosleep(&ts, NULL);
+        ns = now_ns();
+    }
+    unsigned long long tick = trace_clock();
+    double scale = tick > pool->trace_tick ? (double)(ns - pool->trace_ns) / (double)(tick - pool->trace_tick) : 1.0;
+    int pid = (int)getpid();
+    long count = 1;
+
+    //스레드 이름을 먼저 쓰고, 일꾼의 버퍼와 공용 버퍼의 사건을 차례로 쓴다.
+    fprintf(out, "{\"traceEvents\":[\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"pthread_pool\"}}",
+            pid);
+    for (int i = 0; i < POOL_MAXBSIZE && pool->hive[i] != NULL; i++)
+        fprintf(out, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"bee %d\"}}",
+                pid, i, i);
+    for (int i = 0; i < POOL_MAXBSIZE && pool->hive[i] != NULL; i++)
+        count = trace_write(out, pool, pool->hive[i]->trace, scale, pid, count);
+    trace_write(out, pool, pool->trace, scale, pid, count);
+    fprintf(out, "\n],\"displayTimeUnit\":\"ns\"}\n");
+
+    bool failed = ferror(out) != 0;
+    if (fclose(out) != 0 || failed)
+        return POOL_FAIL;
+    return POOL_SUCCESS;
+}
+
+/*
+ * 우선순위 단계 l에서 빈 자리가 있는 대기열을 찾아 lane 배열에서의 위치를 리턴한다. 모두 꽉 찼으면 -1이다.
+ * node의 대기열을 먼저 보고, 꽉 찼으면 다음 노드부터 차례로 본다. 반드시 mutex를 잡은 상태에서 호출한다.
+ */
+static int lane_room(pthread_pool_t *pool, int node, int l)
+{
+    for (int k = 0; k < pool->nodes; k++) {
+        int i = (node + k) % pool->nodes * pool->prio + l;
+        if (pool->lane[i].len < pool->q_size)
+            return i;
+    }
+    return -1;
+}
+
+/*
+ * 우선순위 단계 l의 락 없는 대기열에 작업을 넣는다. node의 대기열을 먼저 쓰고, 꽉 찼으면 다음 노드부터 차례로 쓴다.
+ * 모두 꽉 찼으면 false를 리턴한다.
+ */
+static bool ring_push_near(pthread_pool_t *pool, int node, int l, const task_t *task)
+{
+    for (int k = 0; k < pool->nodes; k++)
+        if (ring_push(pool->lane[(node + k) % pool->nodes * pool->prio + l].ring, task))
+            return true;
+    return false;
+}
+
+/*
+ * 스레드풀에서 실행시킬 함수와 인자의 주소를 넘겨주며 작업을 요청한다.
+ * 스레드풀의 대기열이 꽉 찬 상황에서 flag이 POOL_NOWAIT이면 즉시 POOL_FULL을 리턴한다.
+ * POOL_WAIT이면 대기열에 빈 자리가 나올 때까지 기다렸다가 넣고 나온다.
+ * POOL_CALLER_RUNS이면 기다리는 대신 요청한 스레드가 그 자리에서 작업을 직접 실행하고 나온다.
+ * 대기열이 꽉 찬 동안 요청하는 쪽이 작업을 하느라 저절로 느려지므로 요청이 한없이 밀리지 않는다.
+ * POOL_DROP_OLDEST이면 대기열에서 가장 오래 기다린 작업을 빼서 버리고 새 작업을 넣는다.
+ * 버린 작업은 속성의 reject 함수로 알려 주며, 핸들이 달린 작업이면 버려졌다고 알린다.
+ * POOL_BY_POLICY이면 스레드풀을 만들 때 속성의 on_full로 정한 방식을 따른다.
+ * 작업 훔치기 모드에서 같은 풀의 일꾼이 요청하면 락 없이 자기 덱에 넣고,
+ * 덱이 꽉 찼을 때만 공유 대기열로 보낸다.
+ * 작업은 가장 높은 우선순위인 0단계에 들어간다.
+ * lazy로 만든 스레드풀의 일꾼을 하나도 시작하지 못하면 POOL_FAIL을 리턴한다.
+ * 작업 요청이 성공하면 POOL_SUCCESS를 리턴한다.
+ */
+int pthread_pool_submit(pthread_pool_t *pool, void (*f)(void *p), void *p, int flag)
+{
+    return pthread_pool_submit_prio(pool, f, p, 0, flag);
+}
+
+/*
+ * 대기열이 꽉 차서 POOL_CALLER_RUNS로 요청한 작업 task를 요청한 스레드에서 직접 실행한다.
+ */
+static int caller_run(pthread_pool_t *pool, const task_t *task)
+{
+    task_t t = *task;
+
+    atomic_fetch_add_explicit(&pool->caller_ran, 1, memory_order_relaxed);
+    if (pool->trace != NULL) {
+        void (*f)(void *p) = trace_start(pool, &t);
+        task_call(&t);
+        trace_note(pool, TRACE_END, f, 0);
+    }
+    else
+        task_call(&t);
+    return POOL_SUCCESS;
+}
+
+/*
+ * submit_task()의 flag에 더하면 작업 훔치기 모드의 일꾼이 요청한 작업이라도 자기 덱 대신 공유 대기열에 넣는다.
+ * 차례를 넘긴 스트랜드나 파이버처럼 자기 덱에 넣으면 곧바로 다시 꺼내게 되는 작업에 쓴다.
+ */
+#define SUBMIT_SHARED 0x100
+
+/*
+ * 작업 task를 우선순위 단계 prio의 대기열에 넣는다. pthread_pool_submit_prio()와 pthread_pool_submit_inline()이 함께 쓴다.
+ * prio는 호출한 쪽이 범위를 확인한다. 나머지 동작은 pthread_pool_submit_prio()와 같다.
+ */
+static int submit_task(pthread_pool_t *pool, const task_t *task, int prio, int flag)
+{
+    bool shared = (flag & SUBMIT_SHARED) != 0;
+
+    if (!pool_start(pool))
+        return POOL_FAIL;
+    flag &= ~SUBMIT_SHARED;
+    if (flag == POOL_BY_POLICY)
+        flag = pool->on_full;
+    if (pool->trace != NULL)
+        trace_note(pool, TRACE_SUBMIT, trace_function(task), 1);
+
+    //같은 풀의 일꾼이 요청한 작업은 자기 덱에 넣고 잠든 일꾼이 있으면 깨워서 훔쳐가게 한다.
+    if (prio == 0 && !shared && pool->sched == POOL_SCHED_STEAL && my_bee != NULL && my_bee->pool == pool) {
+        if (deque_push(my_bee, task)) {
+            wake_idle_bees(pool, 1);
+            return POOL_SUCCESS;
+        }
+    }
+
+    //락 없는 대기열이면 빈 칸을 차지해서 넣는다. 꽉 찬 경우의 처리는 flag에 따라 락을 쓰는 경우와 같다.
+    //모든 노드가 꽉 찼으면 자기 노드의 대기열에 빈 자리가 생기기를 기다린다.
+    //가장 오래된 작업을 버리는 경우에는 자기 노드의 대기열에서 하나를 빼고 다시 넣어 본다.
+    //그 사이 다른 스레드가 빈 칸을 차지하면 다시 하나를 뺀다.
+    int node = current_node(pool);
+    if (pool->ring != NULL) {
+        struct ring *r = pool->lane[node * pool->prio + prio].ring;
+        while (!ring_push_near(pool, node, prio, task)) {
+            if (flag == POOL_NOWAIT) {
+                atomic_fetch_add_explicit(&pool->rejected, 1, memory_order_relaxed);
+                return POOL_FULL;
+            }
+            if (flag == POOL_CALLER_RUNS)
+                return caller_run(pool, task);
+            if (flag == POOL_DROP_OLDEST) {
+                task_t old;
+                if (ring_pop_many(r, &old, 1) == 1)
+                    task_reject(pool, &old);
+                continue;
+            }
+            submit_wait(pool, r);
+        }
+        wake_idle_bees(pool, 1);
+        size_t len = ring_queued(pool);
+        depth_note(pool, len);
+        pool_autogrow(pool, len);
+        return POOL_SUCCESS;
+    }
+
+    pthread_mutex_lock(&pool->mutex);
+
+    //스레드풀의 대기열이 꽉 찬 상황에서 flag의 값에 따라 처리 방식이 바뀐다.
+    //flag 가 POOL_NOWAIT이면 즉시 POOL_FULL을 리턴하는데 이 때 뮤텍스락을 풀어준다.
+    //POOL_CALLER_RUNS이면 락을 풀고 직접 실행하며, POOL_DROP_OLDEST이면 자기 노드의 대기열에서 가장 오래된 작업을 뺀다.
+    int l;
+    task_t old;
+    bool dropped = false;
+    while ((l = lane_room(pool, node, prio)) < 0) {
+        if(flag == POOL_NOWAIT){
+            pthread_mutex_unlock(&pool->mutex); //스레드풀 기본 동작 검증 데드락 해결 방법
+            atomic_fetch_add_explicit(&pool->rejected, 1, memory_order_relaxed);
+            return POOL_FULL;
+        }
+        else if (flag == POOL_CALLER_RUNS) {
+            pthread_mutex_unlock(&pool->mutex);
+            return caller_run(pool, task);
+        }
+        else if (flag == POOL_DROP_OLDEST) {
+            l = node * pool->prio + prio;
+            queue_take(pool, l, &old);
+            dropped = true;
+            break;
+        }
+        // flag가 POOL_WAIT이면 대기열에 빈 자리가 나올때까지 대기한다.
+        else{
+            submit_wait(pool, NULL);
+        }
+    }
+
+    //대기열에 작업을 추가해주며 q_len의 값을 1 증가시킨다.
+    queue_put(pool, l, task);
+    size_t len = pool->q_len;
+
+    //대기 중인 일꾼 스레드에게 시그널을 보내 작업이 가능하다고 알린다. 공유 일꾼을 쓰면 공유 일꾼을 깨운다.
+    pthread_cond_signal(&pool->empty);
+    pthread_mutex_unlock(&pool->mutex);
+    if (pool->shared)
+        shared_wake(1);
+
+    //뺀 작업은 락을 푼 뒤에 버린다.
+    if (dropped)
+        task_reject(pool, &old);
+
+    //자동 조절 중이면 쌓인 작업을 보고 일꾼을 늘린다.
+    pool_autogrow(pool, len);
+
+    //작업 요청이 성공했으므로 POOL_SUCCESS를 리턴한다.
+    return POOL_SUCCESS;
+}
+
+/*
+ * pthread_pool_submit()처럼 작업을 요청하되 우선순위 단계 prio의 대기열에 넣는다. 0단계가 가장 높다.
+ * 대기열은 단계마다 따로 차므로, flag가 POOL_NOWAIT이면 그 단계가 꽉 찼을 때만 POOL_FULL을 리턴하고
+ * 다른 단계의 요청은 막지 않는다. prio가 단계의 범위를 벗어나면 POOL_FAIL을 리턴한다.
+ * 작업 훔치기 모드의 일꾼이 요청한 0단계 작업만 자기 덱에 넣고, 그보다 낮은 단계는 공유 대기열로 보낸다.
+ * NUMA 노드마다 대기열을 나눴으면 요청한 스레드의 노드 대기열에 넣고, 그 대기열이 꽉 찼을 때만 다른 노드의 대기열에 넣는다.
+ * 모든 노드의 대기열이 꽉 차야 꽉 찬 것으로 본다.
+ */
+int pthread_pool_submit_prio(pthread_pool_t *pool, void (*f)(void *p), void *p, int prio, int flag)
+{
+    if (prio < 0 || prio >= pool->prio)
+        return POOL_FAIL;
+
+    //통계를 모으면 작업을 넣은 시각을 함께 적어 둔다. arg는 쓰지 않으므로 채우지 않는다.
+    task_t task;
+    task.function = f;
+    task.param = p;
+    task.stamp = pool->stats ? now_ns() : 0;
+    return submit_task(pool, &task, prio, flag);
+}
+
+/*
+ * pthread_pool_submit()처럼 작업을 요청하되, 인자의 주소 대신 arg가 가리키는 size바이트를 작업 안에 복사해서 넣는다.
+ * 일꾼은 함수에 복사본의 주소를 넘기므로 요청한 쪽은 호출이 끝나자마자 arg의 공간을 다시 써도 되고,
+ * 작업마다 인자를 담을 공간을 할당하거나 작업이 끝날 때까지 살려 둘 필요가 없다.
+ * 복사본은 작업 함수가 실행되는 동안에만 남아 있으므로 함수가 끝난 뒤에도 쓸 값은 다른 곳에 옮겨 두어야 한다.
+ * size가 POOL_INLINE_SIZE보다 크면 POOL_FAIL을 리턴한다. 나머지 리턴값은 pthread_pool_submit()과 같다.
+ */
+int pthread_pool_submit_inline(pthread_pool_t *pool, void (*f)(void *p), const void *arg, size_t size, int flag)
+{
+    if (size > POOL_INLINE_SIZE)
+        return POOL_FAIL;
+
+    task_t task;
+    task.function = f;
+    task.param = (void *)&inline_mark;
+    task.stamp = pool->stats ? now_ns() : 0;
+    memcpy(task.arg, arg, size);
+    return submit_task(pool, &task, 0, flag);
+}
+
+/*
+ * pthread_pool_submit()처럼 작업을 요청하되, 작업이 끝났는지 확인할 수 있는 핸들을 future에 돌려준다.
+ * 핸들은 스레드풀이 미리 만들어 둔 것을 다시 쓰므로 작업마다 공간을 할당하지 않는다.
+ * 핸들로 완료를 기다리거나 확인한 뒤에는 반드시 pthread_pool_future_release()로 놓아야 한다.
+ * 리턴값은 pthread_pool_submit()과 같으며, POOL_SUCCESS가 아니면 future에 핸들을 돌려주지 않는다.
+ * 핸들을 만들 공간이 없으면 POOL_FAIL을 리턴한다.
+ */
+int pthread_pool_submit_future(pthread_pool_t *pool, void (*f)(void *p), void *p, int flag, pool_future_t **future)
+{
+    struct pool_future *fut = future_get(pool);
+    int ret;
+
+    if (fut == NULL)
+        return POOL_FAIL;
+    fut->function = f;
+    fut->param = p;
+    if ((ret = pthread_pool_submit(pool, future_run, fut, flag)) != POOL_SUCCESS) {
+        future_put(fut);
+        future_put(fut);
+        return ret;
+    }
+    *future = fut;
+    return POOL_SUCCESS;
+}
+
+/*
+ * 후속 작업 fut를 대기열에 넣는다. 작업 훔치기 모드의 일꾼이면 자기 덱에 들어가므로 대개 같은 일꾼이 이어서 실행한다.
+ * 일꾼을 시작하지 못해 넣지 못하면 기다리는 쪽이 멈춰 있지 않도록 버려진 것으로 끝내고 POOL_FAIL을 리턴한다.
+ */
+static int future_submit(struct pool_future *fut)
+{
+    pthread_pool_t *pool = fut->pool;
+    task_t task;
+
+    task.function = future_run;
+    task.param = fut;
+    task.stamp = pool->stats ? now_ns() : 0;
+    if (submit_task(pool, &task, 0, POOL_WAIT) != POOL_SUCCESS) {
+        future_finish(fut, FUTURE_DROPPED);
+        return POOL_FAIL;
+    }
+    return POOL_SUCCESS;
+}
+
+/*
+ * 핸들이 가리키는 작업이 끝나면 이어서 f(p)를 실행하도록 후속 작업을 붙인다. 후속 작업은 대기열을 거치지 않고
+ * 앞 작업을 실행한 일꾼이 그 자리에서 바로 실행하므로, 앞 작업 끝에서 다음 단계를 요청하는 것보다 싸고 캐시도 따뜻하다.
+ * 한 작업에 후속 작업을 여러 개 붙이면 하나만 그 자리에서 실행하고 나머지는 그 일꾼의 덱(작업 훔치기 모드가 아니면
+ * 공유 대기열)에 넣는다. 후속 작업이 길게 이어져도 되부르지 않고 차례로 실행하므로 스택이 자라지 않는다.
+ * 앞 작업이 이미 끝났으면 후속 작업을 대기열에 넣는다. 앞 작업이 POOL_DISCARD 종료나 취소 토큰으로 버려지면
+ * 후속 작업도 실행하지 않고 버린다.
+ * next가 NULL이 아니면 후속 작업의 핸들을 돌려주며, 이 핸들에 다시 후속 작업을 붙여 여러 단계를 이을 수 있다.
+ * 돌려받은 핸들은 pthread_pool_future_release()로 놓아야 한다. 호출하는 동안 future를 놓으면 안 된다.
+ * 성공하면 POOL_SUCCESS를, 핸들을 만들 공간이 없거나 앞 작업이 이미 끝났는데 일꾼을 시작하지 못해 후속 작업을
+ * 넣지 못하면 POOL_FAIL을 리턴한다. POOL_FAIL이면 next에 핸들을 돌려주지 않는다.
+ */
+int pthread_pool_future_then(pool_future_t *future, void (*f)(void *p), void *p, pool_future_t **next)
+{
+    struct pool_future *fut = future_get(future->pool);
+
+    if (fut == NULL)
+        return POOL_FAIL;
+    fut->function = f;
+    fut->param = p;
+    if (next == NULL)
+        atomic_store(&fut->refs, 1);
+
+    //앞 작업이 끝나지 않았으면 목록에 넣는다. 이미 닫혔으면 앞 작업의 결과에 따라 대기열에 넣거나 버린다.
+    //대기열에 넣지 못했으면 future_submit()이 작업 쪽의 참조를 놓았으므로 요청한 쪽의 참조도 놓는다.
+    struct pool_future *head = atomic_load(&future->thens);
+    do {
+        if (head == THENS_CLOSED) {
+            if (atomic_load(&future->state) != FUTURE_DONE)
+                future_finish(fut, FUTURE_DROPPED);
+            else if (future_submit(fut) != POOL_SUCCESS) {
+                if (next != NULL)
+                    future_put(fut);
+                return POOL_FAIL;
+            }
+            break;
+        }
+        fut->next = head;
+    } while (!atomic_compare_exchange_weak(&future->thens, &head, fut));
+    if (next != NULL)
+        *next = fut;
+    return POOL_SUCCESS;
+}
+
+/*
+ * 핸들이 가리키는 작업이 끝날 때까지 기다린다. abstime이 NULL이 아니면 그 시각까지만 기다린다.
+ * 작업을 실행해서 끝났으면 POOL_SUCCESS를, POOL_DISCARD 종료로 버려졌으면 POOL_FAIL을,
+ * 시간이 지났으면 POOL_TIMEOUT을 리턴한다. 기다리는 동안 핸들을 놓으면 안 된다.
+ * 파이버 안에서 부르면 스레드 대신 파이버가 멈추므로 일꾼은 그동안 다른 작업을 실행한다.
+ */
+int pthread_pool_future_timedwait(pool_future_t *future, const struct timespec *abstime)
+{
+    unsigned int state;
+
+    if (my_fiber != NULL)
+        return fiber_future_wait(future, abstime);
+    atomic_fetch_add(&future->waiters, 1);
+    while ((state = atomic_load(&future->state)) == FUTURE_PENDING) {
+        if (!futex_timedwait(&future->state, FUTURE_PENDING, abstime) &&
+            atomic_load(&future->state) == FUTURE_PENDING) {
+            atomic_fetch_sub(&future->waiters, 1);
+            return POOL_TIMEOUT;
+        }
+    }
+    atomic_fetch_sub(&future->waiters, 1);
+    return state == FUTURE_DONE ? POOL_SUCCESS : POOL_FAIL;
+}
+
+/*
+ * 핸들이 가리키는 작업이 끝날 때까지 기다린다. 리턴값은 pthread_pool_future_timedwait()과 같다.
+ */
+int pthread_pool_future_wait(pool_future_t *future)
+{
+    return pthread_pool_future_timedwait(future, NULL);
+}
+
+/*
+ * 기다리지 않고 작업이 끝났는지(실행했거나 버려졌는지)만 확인한다.
+ */
+bool pthread_pool_future_poll(pool_future_t *future)
+{
+    return atomic_load(&future->state) != FUTURE_PENDING;
+}
+
+/*
+ * 핸들을 놓는다. 작업이 아직 끝나지 않았어도 놓을 수 있으며, 핸들은 작업이 끝난 뒤에 재사용된다.
+ * 놓은 뒤에는 핸들을 사용하면 안 된다.
+ */
+void pthread_pool_future_release(pool_future_t *future)
+{
+    future_put(future);
+}
+
+/*
+ * 작업 그룹을 초기화한다. 그룹의 작업은 pool에서 실행된다.
+ */
+int pthread_pool_group_init(pool_group_t *group, pthread_pool_t *pool)
+{
+    group->pool = pool;
+    atomic_init(&group->pending, 0);
+    return pthread_pool_token_init(&group->token);
+}
+
+/*
+ * 그룹에 작업을 추가하고 스레드풀에 요청한다. 그룹의 카운터는 작업이 끝나거나 버려질 때 줄어든다.
+ * 작업에는 그룹의 취소 토큰이 붙으므로 그룹을 취소하면 아직 시작하지 않은 작업은 실행하지 않는다.
+ * 일꾼이 작업 안에서 요청하다가 대기열이 꽉 찬 채로 기다리면 모든 일꾼이 멈출 수 있으므로,
+ * 대기열이 꽉 차 있으면 기다리지 않고 요청한 스레드에서 바로 실행한다.
+ * 핸들을 만들 공간이 없을 때도 바로 실행하므로 항상 POOL_SUCCESS를 리턴한다.
+ */
+int pthread_pool_group_submit(pool_group_t *group, void (*f)(void *p), void *p)
+{
+    struct pool_future *fut = future_get(group->pool);
+
+    if (fut != NULL) {
+        fut->function = f;
+        fut->param = p;
+        fut->group = group;
+        fut->token = &group->token;
+        atomic_store(&fut->refs, 1);
+        atomic_fetch_add(&group->pending, 1);
+        if (pthread_pool_submit(group->pool, future_run, fut, POOL_NOWAIT) == POOL_SUCCESS)
+            return POOL_SUCCESS;
+        atomic_fetch_sub(&group->pending, 1);
+        future_put(fut);
+    }
+    if (pthread_pool_token_expired(&group->token)) {
+        atomic_fetch_add_explicit(&group->pool->canceled, 1, memory_order_relaxed);
+        return POOL_SUCCESS;
+    }
+    pool_token_t *saved = my_token;
+    my_token = &group->token;
+    f(p);
+    my_token = saved;
+    return POOL_SUCCESS;
+}
+
+/*
+ * 그룹에 추가한 작업이 모두 끝날 때까지 기다린다.
+ * 기다리는 동안 잠들지 않고 스레드풀의 대기열과 덱에서 작업을 찾아 대신 실행한다.
+ * 일꾼이 작업 안에서 그룹을 기다려도 그 그룹의 작업을 스스로 실행하므로, 일꾼 수가 적어도 교착상태가 생기지 않는다.
+ * 실행할 작업이 없을 때만, 남은 작업이 다른 스레드에서 끝나기를 futex로 기다린다.
+ * POOL_DISCARD 종료로 버려진 작업도 끝난 것으로 센다. 모두 끝나면 POOL_SUCCESS를 리턴한다.
+ */
+int pthread_pool_group_wait(pool_group_t *group)
+{
+    unsigned int pending;
+
+    while ((pending = atomic_load(&group->pending)) > 0) {
+        if (!pool_help(group->pool))
+            futex_wait(&group->pending, pending);
+    }
+    return POOL_SUCCESS;
+}
+
+/*
+ * 그룹을 취소한다. 그룹의 작업 가운데 아직 시작하지 않은 작업은 실행하지 않고 끝난 것으로 세며,
+ * 실행 중인 작업은 pthread_pool_canceled()로 취소되었음을 알 수 있다.
+ * 취소한 그룹에 다시 작업을 넣으려면 pthread_pool_group_wait()으로 기다린 뒤 pthread_pool_group_init()으로 다시 초기화한다.
+ */
+int pthread_pool_group_cancel(pool_group_t *group)
+{
+    return pthread_pool_token_cancel(&group->token);
+}
+
+/*
+ * 취소 토큰을 취소되지 않았고 기한도 없는 상태로 초기화한다.
+ */
+int pthread_pool_token_init(pool_token_t *token)
+{
+    atomic_init(&token->canceled, false);
+    atomic_init(&token->deadline, 0);
+    return POOL_SUCCESS;
+}
+
+/*
+ * 토큰을 취소한다. 토큰이 붙은 작업 가운데 아직 시작하지 않은 작업은 일꾼이 꺼내는 대로 버린다.
+ */
+int pthread_pool_token_cancel(pool_token_t *token)
+{
+    atomic_store(&token->canceled, true);
+    return POOL_SUCCESS;
+}
+
+/*
+ * 토큰의 기한을 지금부터 timeout_ms 밀리초 뒤로 정한다. 기한이 지나면 토큰은 취소된 것과 같다.
+ * 앞서 정한 기한은 새 기한으로 바뀐다.
+ */
+int pthread_pool_token_deadline(pool_token_t *token, unsigned long timeout_ms)
+{
+    atomic_store(&token->deadline, now_ns() + (long)timeout_ms * 1000000L);
+    return POOL_SUCCESS;
+}
+
+/*
+ * 토큰이 취소되었거나 기한이 지났으면 true를 리턴한다. 기한이 없으면 시계를 읽지 않는다.
+ */
+bool pthread_pool_token_expired(pool_token_t *token)
+{
+    if (atomic_load_explicit(&token->canceled, memory_order_relaxed))
+        return true;
+    long deadline = atomic_load_explicit(&token->deadline, memory_order_relaxed);
+    return deadline != 0 && now_ns() >= deadline;
+}
+
+/*
+ * 현재 스레드가 실행 중인 작업의 토큰이 만료되었으면 true를 리턴한다.
+ * 오래 걸리는 작업이 중간중간 불러서 더 할 필요가 없어졌으면 스스로 그만두는 데 쓴다. 토큰이 없는 작업이면 항상 false이다.
+ */
+bool pthread_pool_canceled(void)
+{
+    return my_token != NULL && pthread_pool_token_expired(my_token);
+}
+
+/*
+ * pthread_pool_submit()처럼 작업을 요청하되 취소 토큰 token을 붙인다. 일꾼은 작업을 꺼냈을 때 토큰이 만료되었으면
+ * 실행하지 않고 버리며, 버린 작업의 수는 pthread_pool_stats()의 canceled로 센다.
+ * 토큰을 붙이는 데 스레드풀이 만들어 둔 핸들을 쓰므로 작업마다 공간을 할당하지 않는다.
+ * 핸들을 만들 공간이 없으면 POOL_FAIL을 리턴한다. 나머지 리턴값은 pthread_pool_submit()과 같다.
+ */
+int pthread_pool_submit_token(pthread_pool_t *pool, void (*f)(void *p), void *p, pool_token_t *token, int flag)
+{
+    struct pool_future *fut = future_get(pool);
+    int ret;
+
+    if (fut == NULL)
+        return POOL_FAIL;
+    fut->function = f;
+    fut->param = p;
+    fut->token = token;
+    atomic_store(&fut->refs, 1);
+    if ((ret = pthread_pool_submit(pool, future_run, fut, flag)) != POOL_SUCCESS)
+        future_put(fut);
+    return ret;
+}
+
+/*
+ * 스트랜드를 초기화한다. 스트랜드의 작업은 pool에서 실행되며, 차례를 한 번 얻을 때마다 최대 batch개를 이어서 실행한다.
+ * batch가 클수록 작업마다 대기열을 거치는 비용이 줄고, 작을수록 다른 작업에 차례가 빨리 돌아간다.
+ * batch가 1보다 작거나 공간을 할당하지 못하면 POOL_FAIL을 리턴한다.
+ */
+int pthread_pool_strand_init(pool_strand_t *strand, pthread_pool_t *pool, int batch)
+{
+    if (batch < 1)
+        return POOL_FAIL;
+    if ((strand->buf = (task_t *)line_alloc(16 * sizeof(task_t))) == NULL)
+        return POOL_FAIL;
+    pthread_mutex_init(&strand->mutex, NULL);
+    strand->pool = pool;
+    strand->cap = 16;
+    strand->head = 0;
+    strand->len = 0;
+    strand->batch = batch;
+    strand->active = false;
+    atomic_init(&strand->pending, 0);
+    return POOL_SUCCESS;
+}
+
+/*
+ * 스트랜드의 작업 하나가 끝났음을 센다. 마지막 작업이면 기다리는 스레드를 깨운다.
+ * 기다리던 스레드가 곧바로 스트랜드를 정리할 수 있으므로 마지막 작업을 센 뒤에는 스트랜드를 건드리지 않는다.
+ */
+static void strand_done(pool_strand_t *strand, unsigned int n)
+{
+    if (atomic_fetch_sub(&strand->pending, n) == n)
+        futex_wake(&strand->pending, INT_MAX);
+}
+
+/*
+ * 스트랜드를 실행하는 작업이다. 스트랜드의 작업을 넣은 순서대로 하나씩 꺼내 실행한다.
+ * 작업을 실행하는 동안에도 active를 그대로 두어 다른 일꾼이 같은 스트랜드를 동시에 실행하지 않게 하고,
+ * 실행을 마친 뒤 남은 작업이 없을 때만 active를 내린다. batch개를 실행했는데 작업이 남아 있으면 자신을 다시 요청해
+ * 대기열 뒤로 가서 다른 작업에 차례를 넘긴다. 작업 훔치기 모드에서 자기 덱에 넣으면 곧바로 다시 꺼내게 되므로
+ * SUBMIT_SHARED로 공유 대기열에 넣는다. 대기열이 꽉 차서 요청하지 못하면 그대로 이어서 실행한다.
+ */
+static void strand_run(void *param)
+{
+    pool_strand_t *strand = (pool_strand_t *)param;
+    pthread_pool_t *pool = strand->pool;
+    task_t task;
+    int n = 0;
+
+    pthread_mutex_lock(&strand->mutex);
+    while (true) {
+        task = strand->buf[strand->head];
+        strand->head = (strand->head + 1) & (strand->cap - 1);
+        strand->len--;
+        pthread_mutex_unlock(&strand->mutex);
+        task_call(&task);
+        pthread_mutex_lock(&strand->mutex);
+        if (strand->len == 0) {
+            strand->active = false;
+            pthread_mutex_unlock(&strand->mutex);
+            strand_done(strand, 1);
+            return;
+        }
+        strand_done(strand, 1);
+        if (++n == strand->batch) {
+            pthread_mutex_unlock(&strand->mutex);
+            task.function = strand_run;
+            task.param = strand;
+            task.stamp = pool->stats ? now_ns() : 0;
+            if (submit_task(pool, &task, 0, POOL_NOWAIT | SUBMIT_SHARED) == POOL_SUCCESS)
+                return;
+            n = 0;
+            pthread_mutex_lock(&strand->mutex);
+        }
+    }
+}
+
+/*
+ * 스트랜드를 실행하는 작업이 버려졌을 때 스트랜드에 남은 작업을 모두 버린다. 버린 작업도 끝난 것으로 센다.
+ */
+static void strand_drop(pool_strand_t *strand)
+{
+    pthread_mutex_lock(&strand->mutex);
+    unsigned int n = strand->len;
+    strand->head = 0;
+    strand->len = 0;
+    strand->active = false;
+    pthread_mutex_unlock(&strand->mutex);
+    if (n > 0)
+        strand_done(strand, n);
+}
+
+/*
+ * 스트랜드의 원형 버퍼를 두 배 크기로 늘린다. 반드시 mutex를 잡은 상태에서 호출하며, 실패하면 false를 리턴한다.
+ */
+static bool strand_grow(pool_strand_t *strand)
+{
+    task_t *buf = (task_t *)line_alloc(2 * strand->cap * sizeof(task_t));
+
+    if (buf == NULL)
+        return false;
+    for (int i = 0; i < strand->len; i++)
+        buf[i] = strand->buf[(strand->head + i) & (strand->cap - 1)];
+    free(strand->buf);
+    strand->buf = buf;
+    strand->cap *= 2;
+    strand->head = 0;
+    return true;
+}
+
+/*
+ * 스트랜드에 작업을 넣는다. 작업은 같은 스트랜드에 앞서 넣은 작업이 모두 끝난 뒤에 실행된다.
+ * 스트랜드가 쉬고 있었으면 스트랜드를 실행하는 작업을 스레드풀에 요청하고, 이미 실행 중이면 버퍼에 넣기만 한다.
+ * 스레드풀의 대기열이 꽉 차서 요청하지 못하면 그룹처럼 요청한 스레드가 스트랜드를 직접 실행한다.
+ * 버퍼를 늘릴 공간이 없으면 POOL_FAIL을, 그렇지 않으면 POOL_SUCCESS를 리턴한다.
+ */
+int pthread_pool_strand_submit(pool_strand_t *strand, void (*f)(void *p), void *p)
+{
+    bool start;
+
+    pthread_mutex_lock(&strand->mutex);
+    if (strand->len == strand->cap && !strand_grow(strand)) {
+        pthread_mutex_unlock(&strand->mutex);
+        return POOL_FAIL;
+    }
+    task_t *task = &strand->buf[(strand->head + strand->len) & (strand->cap - 1)];
+    task->function = f;
+    task->param = p;
+    strand->len++;
+    atomic_fetch_add(&strand->pending, 1);
+    start = !strand->active;
+    strand->active = true;
+    pthread_mutex_unlock(&strand->mutex);
+
+    if (start && pthread_pool_submit(strand->pool, strand_run, strand, POOL_NOWAIT) != POOL_SUCCESS)
+        strand_run(strand);
+    return POOL_SUCCESS;
+}
+
+/*
+ * 스트랜드에 넣은 작업이 모두 끝날 때까지 기다린다. 그룹처럼 기다리는 동안 스레드풀의 작업을 대신 실행하며,
+ * 실행할 작업이 없을 때만 futex로 기다린다. POOL_DISCARD 종료로 버려진 작업도 끝난 것으로 센다.
+ * 모두 끝나면 POOL_SUCCESS를 리턴한다.
+ */
+int pthread_pool_strand_wait(pool_strand_t *strand)
+{
+    unsigned int pending;
+
+    while ((pending = atomic_load(&strand->pending)) > 0) {
+        if (!pool_help(strand->pool))
+            futex_wait(&strand->pending, pending);
+    }
+    return POOL_SUCCESS;
+}
+
+/*
+ * 스트랜드가 쓰던 자원을 반납한다. 아직 끝나지 않은 작업이 있으면 POOL_FAIL을 리턴하고 아무것도 하지 않는다.
+ */
+int pthread_pool_strand_destroy(pool_strand_t *strand)
+{
+    if (atomic_load(&strand->pending) > 0)
+        return POOL_FAIL;
+    pthread_mutex_destroy(&strand->mutex);
+    free(strand->buf);
+    strand->buf = NULL;
+    return POOL_SUCCESS;
+}
+
+/*
+ * x86-64에서 파이버의 스택을 바꾼다. 호출 규약이 보존하라는 rbx, rbp, r12~r15와 MXCSR, x87 제어 워드를 지금 스택에 쌓고
+ * 그 위치를 *save에 적은 뒤, to가 가리키는 스택에서 같은 순서로 꺼내 그 스택이 멈췄던 곳으로 돌아간다.
+ * 나머지 레지스터는 호출한 쪽이 이미 저장했으므로 swapcontext()와 달리 시그널 마스크를 건드리는 시스템 호출이 없다.
+ */
+#ifdef FIBER_ASM
+void pool_fiber_switch(void **save, void *to) __attribute__((visibility("hidden")));
+__asm__(".text\n"
+        ".globl pool_fiber_switch\n"
+        ".hidden pool_fiber_switch\n"
+        ".type pool_fiber_switch, @function\n"
+        ".p2align 4\n"
+        "pool_fiber_switch:\n"
+        "    pushq %rbp\n"
+        "    pushq %rbx\n"
+        "    pushq %r12\n"
+        "    pushq %r13\n"
+        "    pushq %r14\n"
+        "    pushq %r15\n"
+        "    subq $8, %rsp\n"
+        "    stmxcsr (%rsp)\n"
+        "    fnstcw 4(%rsp)\n"
+        "    movq %rsp, (%rdi)\n"
+        "    movq %rsi, %rsp\n"
+        "    ldmxcsr (%rsp)\n"
+        "    fldcw 4(%rsp)\n"
+        "    addq $8, %rsp\n"
+        "    popq %r15\n"
+        "    popq %r14\n"
+        "    popq %r13\n"
+        "    popq %r12\n"
+        "    popq %rbx\n"
+        "    popq %rbp\n"
+        "    ret\n"
+        ".size pool_fiber_switch, .-pool_fiber_switch\n");
+#endif
+
+/*
+ * 지금 문맥을 from에 저장하고 to의 문맥으로 넘어간다. 나중에 누군가 from으로 넘어오면 여기서 돌아온다.
+ */
+static void fiber_jump(fiber_ctx_t *from, fiber_ctx_t *to)
+{
+#ifdef FIBER_ASM
+    pool_fiber_switch(&from->sp, to->sp);
+#else
+    swapcontext(&from->uc, &to->uc);
+#endif
+}
+
+/*
+ * 현재 스레드가 실행 중인 파이버를 리턴한다. 파이버는 멈췄다가 다른 스레드에서 돌아올 수 있으므로
+ * 컴파일러가 스레드 지역 변수의 주소를 멈추기 전의 값으로 재사용하지 않도록 따로 불러서 읽는다.
+ */
+static __attribute__((noinline)) struct pool_fiber *fiber_self(void)
+{
+    return my_fiber;
+}
+
+/*
+ * 파이버가 처음 실행될 때 시작하는 함수이다. 파이버 함수를 실행하고 끝났다고 적은 뒤 실행한 쪽으로 돌아가며,
+ * 돌아간 뒤에는 스택을 다시 쓰므로 이 함수는 리턴하지 않는다.
+ */
+static void fiber_entry(void)
+{
+    struct pool_fiber *fb = fiber_self();
+
+    fb->function(fb->param);
+    fb->state = FIBER_DONE;
+    fiber_jump(&fb->ctx, fb->back);
+}
+
+/*
+ * 파이버 fb가 처음 넘어왔을 때 fiber_entry()부터 시작하도록 스택을 준비한다.
+ * x86-64에서는 pool_fiber_switch()가 꺼낼 값을 스택 맨 위에 쌓아 두며, 돌아갈 주소 자리에 fiber_entry()를 넣는다.
+ * fiber_entry()가 시작할 때 스택 위치는 호출 규약대로 16바이트 경계에서 8바이트 떨어져 있어야 한다.
+ */
+static void fiber_prepare(struct pool_fiber *fb)
+{
+#ifdef FIBER_ASM
+    uintptr_t top = ((uintptr_t)fb->mem + fb->size) & ~(uintptr_t)15;
+    void **sp = (void **)(top - 9 * sizeof(void *));
+
+    sp[0] = (void *)(uintptr_t)(0x1F80ULL | (0x037FULL << 32));    /* MXCSR과 x87 제어 워드의 기본값 */
+    for (int i = 1; i < 7; i++)
+        sp[i] = NULL;
+    sp[7] = (void *)(uintptr_t)fiber_entry;
+    sp[8] = NULL;
+    fb->ctx.sp = sp;
+#else
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+
+    getcontext(&fb->ctx.uc);
+    fb->ctx.uc.uc_stack.ss_sp = fb->mem + page;
+    fb->ctx.uc.uc_stack.ss_size = fb->size - page;
+    fb->ctx.uc.uc_link = NULL;
+    makecontext(&fb->ctx.uc, fiber_entry, 0);
+#endif
+}
+
+/*
+ * pool의 빈 파이버를 하나 꺼낸다. 빈 파이버가 없으면 보호 페이지를 포함한 스택을 새로 만들고, 만들지 못하면 NULL을 리턴한다.
+ * 스택은 mmap()으로 잡고 맨 아래 페이지를 접근할 수 없게 바꾸므로 스택이 넘치면 다른 메모리를 덮는 대신 바로 멈춘다.
+ */
+static struct pool_fiber *fiber_get(pthread_pool_t *pool)
+{
+    struct pool_fiber *fb;
+
+    pthread_mutex_lock(&pool->fiber_mutex);
+    if ((fb = pool->fiber_free) != NULL)
+        pool->fiber_free = fb->next;
+    pthread_mutex_unlock(&pool->fiber_mutex);
+    if (fb != NULL)
+        return fb;
+
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    if ((fb = (struct pool_fiber *)malloc(sizeof(struct pool_fiber))) == NULL)
+        return NULL;
+    fb->size = pool->fiber_stack + page;
+    fb->mem = (char *)mmap(NULL, fb->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (fb->mem == MAP_FAILED) {
+        free(fb);
+        return NULL;
+    }
+    if (mprotect(fb->mem, page, PROT_NONE) != 0) {
+        munmap(fb->mem, fb->size);
+        free(fb);
+        return NULL;
+    }
+    fb->pool = pool;
+    pthread_mutex_lock(&pool->fiber_mutex);
+    fb->all = pool->fiber_all;
+    pool->fiber_all = fb;
+    pthread_mutex_unlock(&pool->fiber_mutex);
+    return fb;
+}
+
+/*
+ * 다 쓴 파이버 fb를 빈 목록으로 돌려보낸다. 스택은 그대로 두었다가 다음 파이버가 쓴다.
+ */
+static void fiber_put(struct pool_fiber *fb)
+{
+    pthread_pool_t *pool = fb->pool;
+
+    pthread_mutex_lock(&pool->fiber_mutex);
+    fb->next = pool->fiber_free;
+    pool->fiber_free = fb;
+    pthread_mutex_unlock(&pool->fiber_mutex);
+}
+
+/*
+ * 파이버 fb를 실행하는 작업을 flag로 요청하고 submit_task()의 리턴값을 리턴한다.
+ */
+static int fiber_submit(struct pool_fiber *fb, int flag)
+{
+    pthread_pool_t *pool = fb->pool;
+    task_t task;
+
+    task.function = fiber_run;
+    task.param = fb;
+    task.stamp = pool->stats ? now_ns() : 0;
+    return submit_task(pool, &task, 0, flag);
+}
+
+/*
+ * 파이버 fb를 실행하는 작업이다. 파이버의 문맥으로 넘어가서 파이버가 멈추거나 끝날 때까지 실행한다.
+ * 파이버가 끝났으면 빈 목록으로 돌려보내고, 차례를 넘겼으면 공유 대기열의 뒤에 다시 요청한다.
+ * 완료를 기다리면 파이버의 스택을 떠난 여기서 기다리는 목록에 넣는다. 파이버가 멈추기 전에 목록에 들어가면
+ * 다른 일꾼이 아직 멈추지 않은 스택으로 넘어갈 수 있기 때문이다.
+ * 차례를 넘겼는데 대기열이 꽉 찼으면 대기열의 작업을 하나 대신 실행해 자리를 만든 뒤 다시 요청한다.
+ * 그래도 요청하지 못하거나 기다릴 일이 이미 끝났으면 파이버를 잃지 않도록 이 자리에서 이어 실행한다.
+ * 파이버 안에서 다른 파이버를 실행할 수도 있으므로 my_fiber와 my_token은 앞의 값을 되돌려 놓는다.
+ */
+static void fiber_run(void *param)
+{
+    struct pool_fiber *fb = (struct pool_fiber *)param;
+    struct pool_fiber *saved = my_fiber;
+    pool_token_t *token = my_token;
+    fiber_ctx_t back;
+
+    while (true) {
+        fb->back = &back;
+        fb->state = FIBER_RUN;
+        my_fiber = fb;
+        my_token = fb->token;
+        fiber_jump(&back, &fb->ctx);
+        fb->token = my_token;
+        my_token = token;
+        my_fiber = saved;
+
+        if (fb->state == FIBER_DONE) {
+            fiber_put(fb);
+            return;
+        }
+        if (fb->state == FIBER_WAIT && fb->park(fb, fb->park_arg))
+            return;
+        int flag = fb->state == FIBER_YIELD ? POOL_NOWAIT | SUBMIT_SHARED : POOL_NOWAIT;
+        if (fiber_submit(fb, flag) == POOL_SUCCESS)
+            return;
+        if (fb->state == FIBER_YIELD && pool_help(fb->pool) && fiber_submit(fb, flag) == POOL_SUCCESS)
+            return;
+    }
+}
+
+/*
+ * 기다리던 일이 끝난 파이버 fb를 이어 실행하도록 flag로 요청한다.
+ * 대기열이 꽉 차서 요청하지 못하면 파이버를 잃지 않도록 이 자리에서 이어 실행한다.
+ */
+static void fiber_wake(struct pool_fiber *fb, int flag)
+{
+    if (fiber_submit(fb, flag) != POOL_SUCCESS)
+        fiber_run(fb);
+}
+
+/*
+ * 멈춘 파이버 fb를 핸들 arg의 기다리는 목록에 넣는다. 작업이 이미 끝나 목록이 닫혔으면 false를 리턴한다.
+ */
+static bool future_park(struct pool_fiber *fb, void *arg)
+{
+    struct pool_future *fut = (struct pool_future *)arg;
+    struct pool_fiber *head = atomic_load(&fut->fibers);
+
+    do {
+        if (head == FIBERS_CLOSED)
+            return false;
+        fb->next = head;
+    } while (!atomic_compare_exchange_weak(&fut->fibers, &head, fb));
+    return true;
+}
+
+/*
+ * 파이버 안에서 핸들 fut의 작업이 끝나기를 기다린다. 리턴값은 pthread_pool_future_timedwait()과 같다.
+ * 시간 제한이 없으면 파이버를 멈춰 핸들의 목록에 넣고, 작업이 끝나면 그 작업을 마친 일꾼이 다시 요청한다.
+ * 시간 제한이 있으면 목록에서 빼낼 방법이 없으므로 abstime이 지날 때까지 차례를 넘기며 확인한다.
+ */
+static int fiber_future_wait(struct pool_future *fut, const struct timespec *abstime)
+{
+    struct pool_fiber *fb = fiber_self();
+    struct timespec now;
+
+    if (abstime == NULL && atomic_load(&fut->state) == FUTURE_PENDING) {
+        fb->state = FIBER_WAIT;
+        fb->park = future_park;
+        fb->park_arg = fut;
+        fiber_jump(&fb->ctx, fb->back);
+    }
+    while (abstime != NULL && atomic_load(&fut->state) == FUTURE_PENDING) {
+        clock_gettime(CLOCK_REALTIME, &now);
+        if (!abstime_before(&now, abstime))
+            return POOL_TIMEOUT;
+        pthread_pool_yield();
+    }
+    return atomic_load(&fut->state) == FUTURE_DONE ? POOL_SUCCESS : POOL_FAIL;
+}
+
+/*
+ * 함수 f를 자기 스택을 가진 파이버로 실행하도록 요청한다. p는 f에 넘길 인자이고 flag는 pthread_pool_submit()과 같다.
+ * 파이버는 pthread_pool_yield()로 차례를 넘기거나 pthread_pool_future_wait()으로 다른 작업의 완료를 기다리는 동안
+ * 일꾼을 붙잡지 않고 멈춰 있다가, 다시 차례가 오면 아무 일꾼에서나 멈춘 곳부터 이어 실행한다.
+ * 그래서 적은 수의 일꾼으로 기다리는 작업 수천 개를 함께 둘 수 있다. 파이버 밖의 함수를 부르는 동안 스레드가 막히는
+ * 일(입출력, 락)은 여전히 일꾼을 붙잡는다.
+ * 파이버는 멈췄다 돌아오면 다른 스레드에 있을 수 있으므로 errno 같은 스레드 지역 변수의 주소를 멈추기 전후로 함께 쓰거나
+ * 락을 잡은 채 멈추면 안 된다. 스택은 속성의 fiber_stack 크기이며 스레드풀을 종료할 때까지 다시 쓴다.
+ * POOL_DISCARD로 종료하면 아직 끝나지 않은 파이버는 나머지를 실행하지 못한다.
+ * 파이버를 만들 공간이 없으면 POOL_FAIL을 리턴한다. 나머지 리턴값은 pthread_pool_submit()과 같다.
+ */
+int pthread_pool_submit_fiber(pthread_pool_t *pool, void (*f)(void *p), void *p, int flag)
+{
+    struct pool_fiber *fb = fiber_get(pool);
+
+    if (fb == NULL)
+        return POOL_FAIL;
+    fb->function = f;
+    fb->param = p;
+    fb->token = NULL;
+    fiber_prepare(fb);
+
+    int r = fiber_submit(fb, flag);
+    if (r != POOL_SUCCESS)
+        fiber_put(fb);
+    return r;
+}
+
+/*
+ * 실행 중인 파이버가 차례를 넘긴다. 파이버는 공유 대기열의 뒤에 다시 들어가고, 일꾼은 그동안 다른 작업을 실행한다.
+ * 다시 차례가 오면 POOL_SUCCESS를 리턴하며, 그때는 다른 일꾼의 스레드일 수 있다. 파이버 밖에서 부르면 POOL_FAIL을 리턴한다.
+ */
+int pthread_pool_yield(void)
+{
+    struct pool_fiber *fb = fiber_self();
+
+    if (fb == NULL)
+        return POOL_FAIL;
+    fb->state = FIBER_YIELD;
+    fiber_jump(&fb->ctx, fb->back);
+    return POOL_SUCCESS;
+}
+
+/*
+ * io_uring의 링에 한 번에 넣을 수 있는 요청의 수이다. 더 많이 요청하면 완료된 만큼씩 이어서 넣는다.
+ */
+#define IO_DEPTH 64
+
+/*
+ * 종료하는 스레드풀이 아직 입출력을 요청한 적이 없을 때 pool->io에 넣어 두는 표시이다.
+ * closing이 true이므로 종료 도중에 들어온 입출력 요청은 입출력 스레드를 새로 만들지 않고 실패한다.
+ */
+static struct pool_io io_closed = {.mutex = PTHREAD_MUTEX_INITIALIZER, .closing = true, .ring_fd = -1};
+
+/*
+ * 입출력을 마친 요청 req를 실행할 완료 작업을 스레드풀에 넣는다. 대기열이 꽉 찼으면 자리가 날 때까지 기다린다.
+ * 완료 작업을 넣지 못하면 결과를 알릴 곳이 없으므로 io의 락을 잡지 않은 채로 불러야 한다.
+ */
+static void io_complete(struct io_req *req)
+{
+    pthread_pool_t *pool = req->io->pool;
+    task_t task;
+
+    task.function = io_done;
+    task.param = req;
+    task.stamp = pool->stats ? now_ns() : 0;
+    submit_task(pool, &task, 0, POOL_WAIT);
+}
+
+/*
+ * 입출력 요청 req를 막히는 시스템 호출로 처리하고 옮긴 바이트 수나 -errno를 리턴한다. 입출력 스레드가 쓴다.
+ * 파이프나 소켓처럼 위치가 없는 파일은 io_uring처럼 offset을 무시하고 read()/write()로 처리한다.
+ */
+static long io_sync(struct io_req *req)
+{
+    ssize_t r;
+
+    do {
+        if (req->op == IO_READ) {
+            r = pread(req->fd, req->iov.iov_base, req->iov.iov_len, req->off);
+            if (r < 0 && errno == ESPIPE)
+                r = read(req->fd, req->iov.iov_base, req->iov.iov_len);
+        }
+        else if (req->op == IO_WRITE) {
+            r = pwrite(req->fd, req->iov.iov_base, req->iov.iov_len, req->off);
+            if (r < 0 && errno == ESPIPE)
+                r = write(req->fd, req->iov.iov_base, req->iov.iov_len);
+        }
+        else
+            r = fsync(req->fd);
+    } while (r < 0 && errno == EINTR);
+    return r < 0 ? -errno : (long)r;
+}
+
+/*
+ * io_uring을 쓸 수 없을 때 요청을 처리하는 입출력 스레드이다. pending에서 요청을 하나씩 꺼내 처리하고 완료 작업을 넣는다.
+ * 종료 중이고 남은 요청이 없으면 끝난다.
+ */
+static void *io_worker(void *param)
+{
+    struct pool_io *io = (struct pool_io *)param;
+
+    pthread_mutex_lock(&io->mutex);
+    for (;;) {
+        while (io->pending == NULL && !io->closing)
+            pthread_cond_wait(&io->work, &io->mutex);
+        struct io_req *req = io->pending;
+        if (req == NULL)
+            break;
+        io->pending = req->next;
+        pthread_mutex_unlock(&io->mutex);
+        req->res = io_sync(req);
+        io_complete(req);
+        pthread_mutex_lock(&io->mutex);
+        if (--io->count == 0)
+            pthread_cond_broadcast(&io->idle);
+    }
+    pthread_mutex_unlock(&io->mutex);
+    return NULL;
+}
+
+#ifdef IO_URING
+/*
+ * 요청 req를 io_uring의 제출 링에 넣고 커널에 넘긴다. req가 NULL이면 reaper를 멈추는 빈 요청(NOP)을 넣는다.
+ * 반드시 io의 락을 잡고 링에 빈 자리가 있을 때 부른다. 성공하면 0을, 커널이 받지 않으면 넣은 것을 되돌리고 -errno를 리턴한다.
+ */
+static int io_ring_push(struct pool_io *io, struct io_req *req)
+{
+    unsigned int tail = atomic_load_explicit(io->sq_tail, memory_order_relaxed);
+    struct io_uring_sqe *sqe = &((struct io_uring_sqe *)io->sqes)[tail & *io->sq_mask];
+    long r;
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_NOP;
+    if (req != NULL) {
+        sqe->opcode = req->op == IO_READ ? IORING_OP_READV : req->op == IO_WRITE ? IORING_OP_WRITEV : IORING_OP_FSYNC;
+        sqe->fd = req->fd;
+        if (req->op != IO_FSYNC) {
+            sqe->addr = (uintptr_t)&req->iov;
+            sqe->len = 1;
+            sqe->off = req->off;
+        }
+    }
+    sqe->user_data = (uintptr_t)req;
+    //항목을 다 쓴 뒤에 꼬리를 옮겨야 커널이 덜 쓴 항목을 읽지 않는다.
+    atomic_store_explicit(io->sq_tail, tail + 1, memory_order_release);
+    do
+        r = syscall(__NR_io_uring_enter, io->ring_fd, 1, 0, 0, NULL, 0);
+    while (r < 0 && errno == EINTR);
+    if (r != 1) {
+        atomic_store_explicit(io->sq_tail, tail, memory_order_relaxed);
+        return r < 0 ? -errno : -EAGAIN;
+    }
+    io->inflight++;
+    if (req != NULL) {
+        req->prev = NULL;
+        req->next = io->ring_list;
+        if (io->ring_list != NULL)
+            io->ring_list->prev = req;
+        io->ring_list = req;
+    }
+    return 0;
+}
+
+/*
+ * 완료된 요청 req를 링에 들어간 요청 목록에서 뺀다. 반드시 io의 락을 잡고 부른다.
  */
-static void *worker(void *param)
+static void io_ring_unlink(struct pool_io *io, struct io_req *req)
 {
-    //pthread_pool.h 에서 만들어진 구조체에 대한 포인터를 가져온다.
-    pthread_pool_t *pool = (pthread_pool_t *)param;
-    
-    while (true) {
-        pthread_mutex_lock(&pool->mutex);
-        
-        //대기열이 비어있고 스레드풀이 실행중인 동안에는 기다린다.
-        while (pool->q_len == 0 && pool->running) {
-            pthread_cond_wait(&pool->empty, &pool->mutex);
-        }
-        
-        //스레드풀이 종료되면 스레드를 종료한다.
-        if (!pool->running) {
-            pthread_mutex_unlock(&pool->mutex);
-            pthread_exit(NULL);
+    if (req->prev != NULL)
+        req->prev->next = req->next;
+    else
+        io->ring_list = req->next;
+    if (req->next != NULL)
+        req->next->prev = req->prev;
+}
+
+/*
+ * io_uring을 더 쓸 수 없게 되었을 때 reaper가 부른다. 링에 들어가 있던 요청은 커널이 끝내 주지 않으므로
+ * err를 결과로 완료 작업을 넣고, 링을 닫아 ring_fd를 -1로 만든다. 그 뒤로 들어오는 요청과 pending에 남은 요청은
+ * 입출력 스레드처럼 막히는 시스템 호출로 처리하며, reaper가 그 일을 이어 맡는다.
+ */
+static void io_ring_fail(struct pool_io *io, long err)
+{
+    pthread_mutex_lock(&io->mutex);
+    struct io_req *lost = io->ring_list;
+    io->ring_list = NULL;
+    io->inflight = 0;
+    io_ring_unmap(io);
+    pthread_mutex_unlock(&io->mutex);
+
+    int n = 0;
+    while (lost != NULL) {
+        struct io_req *next = lost->next;
+        lost->res = err;
+        io_complete(lost);
+        lost = next;
+        n++;
+    }
+    pthread_mutex_lock(&io->mutex);
+    if ((io->count -= n) == 0)
+        pthread_cond_broadcast(&io->idle);
+    pthread_mutex_unlock(&io->mutex);
+}
+
+/*
+ * io_uring의 완료를 기다리는 reaper 스레드이다. 완료 링에서 결과를 모아 완료 작업을 넣고, 링에 빈 자리가 생긴 만큼
+ * pending의 요청을 이어서 넣는다. 링에 넣지 못한 요청은 그 오류를 결과로 하여 완료 작업을 넣는다.
+ * 요청 대신 NULL이 담긴 완료가 오면 끝난다. 완료를 기다리다 EINTR이나 EAGAIN이 아닌 오류가 나면 링을 더 쓸 수 없는
+ * 것으로 보고 io_ring_fail()로 링에 있던 요청을 끝낸 뒤, 입출력 스레드가 되어 나머지 요청을 처리한다.
+ */
+static void *io_reaper(void *param)
+{
+    struct pool_io *io = (struct pool_io *)param;
+    struct io_uring_cqe *cqes = (struct io_uring_cqe *)io->cqes;
+    bool stop = false;
+
+    while (!stop) {
+        unsigned int head = atomic_load_explicit(io->cq_head, memory_order_relaxed);
+        unsigned int tail = atomic_load_explicit(io->cq_tail, memory_order_acquire);
+        if (head == tail) {
+            if (syscall(__NR_io_uring_enter, io->ring_fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0 &&
+                errno != EINTR && errno != EAGAIN) {
+                io_ring_fail(io, -errno);
+                return io_worker(io);
+            }
+            continue;
         }
 
-        //q_front를 1 증가시켜 다음 작업으로 이동시키고 대기열에 있는 작업의 개수를 감소시킨다.
-        int index = pool->q_front;
-        pool->q_front = (pool->q_front + 1) % pool->q_size;
-        pool->q_len--;
+        //완료 항목의 결과를 요청에 옮겨 적은 뒤 머리를 옮겨서 커널이 그 칸을 다시 쓰게 한다.
+        //끝난 요청은 링에 들어간 요청 목록에서 빼야 하므로 락을 잡고 모은다.
+        struct io_req *done = NULL;
+        int n = 0;
+        pthread_mutex_lock(&io->mutex);
+        for (; head != tail; head++) {
+            struct io_uring_cqe *cqe = &cqes[head & *io->cq_mask];
+            struct io_req *req = (struct io_req *)(uintptr_t)cqe->user_data;
+            if (req == NULL) {
+                stop = true;
+                continue;
+            }
+            io_ring_unlink(io, req);
+            req->res = cqe->res;
+            req->next = done;
+            done = req;
+            n++;
+        }
+        pthread_mutex_unlock(&io->mutex);
+        atomic_store_explicit(io->cq_head, head, memory_order_release);
+        while (done != NULL) {
+            struct io_req *next = done->next;
+            io_complete(done);
+            done = next;
+        }
 
-        //q_len의 값이 q_size값보다 1만큼 작으면 자리가 생겼음을 뜻하므로 대기열이 꽉차 기다리고 있던 스레드에게 signal 을 보낸다.
-        if (pool->q_len == pool->q_size - 1) {
-            pthread_cond_broadcast(&pool->full);
+        //완료 작업을 모두 넣은 뒤에 수를 줄여야 종료하는 쪽이 완료 작업보다 먼저 지나가지 않는다.
+        struct io_req *failed = NULL;
+        int nf = 0;
+        pthread_mutex_lock(&io->mutex);
+        io->inflight -= n;
+        io->count -= n;
+        while (io->pending != NULL && io->inflight < (int)io->sq_entries) {
+            struct io_req *req = io->pending;
+            io->pending = req->next;
+            int e = io_ring_push(io, req);
+            if (e != 0) {
+                req->res = e;
+                req->next = failed;
+                failed = req;
+                nf++;
+            }
         }
-        pthread_mutex_unlock(&pool->mutex);
+        if (io->count == 0)
+            pthread_cond_broadcast(&io->idle);
+        pthread_mutex_unlock(&io->mutex);
+        if (failed != NULL) {
+            while (failed != NULL) {
+                struct io_req *next = failed->next;
+                io_complete(failed);
+                failed = next;
+            }
+            pthread_mutex_lock(&io->mutex);
+            if ((io->count -= nf) == 0)
+                pthread_cond_broadcast(&io->idle);
+            pthread_mutex_unlock(&io->mutex);
+        }
+    }
+    return NULL;
+}
+
+/*
+ * io_uring_setup()으로 만든 ring_fd의 링들을 mmap하고 io의 링 포인터를 채운다. 제출 링의 배열은 항목 번호를
+ * 그대로 가리키도록 한 번만 채워 둔다. 실패하면 false를 리턴하며, 이미 mmap한 것은 io_ring_unmap()이 푼다.
+ */
+static bool io_ring_map(struct pool_io *io, const struct io_uring_params *p)
+{
+    io->sq_entries = p->sq_entries;
+    io->sq_ring_size = p->sq_off.array + p->sq_entries * sizeof(unsigned int);
+    io->cq_ring_size = p->cq_off.cqes + p->cq_entries * sizeof(struct io_uring_cqe);
+    io->sqes_size = p->sq_entries * sizeof(struct io_uring_sqe);
+    io->sq_ring = mmap(NULL, io->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       io->ring_fd, IORING_OFF_SQ_RING);
+    io->cq_ring = mmap(NULL, io->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       io->ring_fd, IORING_OFF_CQ_RING);
+    io->sqes = mmap(NULL, io->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                    io->ring_fd, IORING_OFF_SQES);
+    if (io->sq_ring == MAP_FAILED)
+        io->sq_ring = NULL;
+    if (io->cq_ring == MAP_FAILED)
+        io->cq_ring = NULL;
+    if (io->sqes == MAP_FAILED)
+        io->sqes = NULL;
+    if (io->sq_ring == NULL || io->cq_ring == NULL || io->sqes == NULL)
+        return false;
+
+    char *sq = (char *)io->sq_ring, *cq = (char *)io->cq_ring;
+    io->sq_tail = (atomic_uint *)(sq + p->sq_off.tail);
+    io->sq_mask = (unsigned int *)(sq + p->sq_off.ring_mask);
+    io->sq_array = (unsigned int *)(sq + p->sq_off.array);
+    io->cq_head = (atomic_uint *)(cq + p->cq_off.head);
+    io->cq_tail = (atomic_uint *)(cq + p->cq_off.tail);
+    io->cq_mask = (unsigned int *)(cq + p->cq_off.ring_mask);
+    io->cqes = cq + p->cq_off.cqes;
+    for (unsigned int i = 0; i < p->sq_entries; i++)
+        io->sq_array[i] = i;
+    return true;
+}
+#endif
+
+/*
+ * io가 mmap한 링을 풀고 io_uring을 닫는다. 그 뒤로 io는 입출력 스레드로 요청을 처리하는 상태가 된다.
+ */
+static void io_ring_unmap(struct pool_io *io)
+{
+    if (io->sq_ring != NULL)
+        munmap(io->sq_ring, io->sq_ring_size);
+    if (io->cq_ring != NULL)
+        munmap(io->cq_ring, io->cq_ring_size);
+    if (io->sqes != NULL)
+        munmap(io->sqes, io->sqes_size);
+    if (io->ring_fd >= 0)
+        close(io->ring_fd);
+    io->sq_ring = io->cq_ring = io->sqes = NULL;
+    io->ring_fd = -1;
+}
 
-        //작업을 실행한다.
-        task_t task = pool->q[index];
-        task.function(task.param);
+/*
+ * io가 쓰던 링과 요청을 모두 반납한다. 입출력 스레드가 모두 끝난 뒤나 만들다 실패했을 때 부른다.
+ */
+static void io_free(struct pool_io *io)
+{
+    if (io == NULL || io == &io_closed)
+        return;
+    io_ring_unmap(io);
+    while (io->free != NULL) {
+        struct io_req *next = io->free->next;
+        free(io->free);
+        io->free = next;
     }
+    pthread_mutex_destroy(&io->mutex);
+    pthread_cond_destroy(&io->work);
+    pthread_cond_destroy(&io->idle);
+    free(io);
 }
 
 /*
- * 스레드풀을 생성한다. bee_size는 일꾼(일벌) 스레드의 개수이고, queue_size는 대기열의 용량이다.
- * bee_size는 POOL_MAXBSIZE를, queue_size는 POOL_MAXQSIZE를 넘을 수 없다.
- * 일꾼 스레드와 대기열에 필요한 공간을 할당하고 변수를 초기화한다.
- * 일꾼 스레드의 동기화를 위해 사용할 상호배타 락과 조건변수도 초기화한다.
- * 마지막 단계에서는 일꾼 스레드를 생성하여 각 스레드가 worker() 함수를 실행하게 한다.
- * 대기열로 사용할 원형 버퍼의 용량이 일꾼 스레드의 수보다 작으면 효율을 극대화할 수 없다.
- * 이런 경우 사용자가 요청한 queue_size를 bee_size로 상향 조정한다.
- * 성공하면 POOL_SUCCESS를, 실패하면 POOL_FAIL을 리턴한다.
+ * 스레드풀의 비동기 입출력을 처리할 곳을 만든다. io_uring을 만들 수 있으면 reaper 스레드 하나를,
+ * 커널이 io_uring을 지원하지 않거나 막혀 있으면 io_threads개의 입출력 스레드를 만든다. 실패하면 NULL을 리턴한다.
  */
-int pthread_pool_init(pthread_pool_t *pool, size_t bee_size, size_t queue_size)
+static struct pool_io *io_create(pthread_pool_t *pool)
 {
-    //스레드풀 구조체 초기화를 해준다.
-    pool->running = true;
-    pool->q = (task_t *)malloc(queue_size * sizeof(task_t));
-    pool->q_size = queue_size;
-    pool->q_front = 0;
-    pool->q_len = 0;
-    pool->bee = (pthread_t *)malloc(bee_size * sizeof(pthread_t));
-    pool->bee_size = bee_size;
-    pthread_mutex_init(&pool->mutex, NULL);
-    pthread_cond_init(&pool->full, NULL);
-    pthread_cond_init(&pool->empty, NULL);
-    
-    //스레드풀 생성에 실패했으므로 POOL_FAIL을 리턴한다.
-    if (pool->q == NULL || pool->bee == NULL) {
+    struct pool_io *io = (struct pool_io *)calloc(1, sizeof(struct pool_io) + pool->io_threads * sizeof(pthread_t));
+
+    if (io == NULL)
+        return NULL;
+    pthread_mutex_init(&io->mutex, NULL);
+    pthread_cond_init(&io->work, NULL);
+    pthread_cond_init(&io->idle, NULL);
+    io->pool = pool;
+    io->ring_fd = -1;
+#ifdef IO_URING
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    io->ring_fd = (int)syscall(__NR_io_uring_setup, IO_DEPTH, &params);
+    //링을 mmap하지 못하면 io_uring을 닫고 입출력 스레드를 쓴다.
+    if (io->ring_fd >= 0 && !io_ring_map(io, &params))
+        io_ring_unmap(io);
+#endif
+
+    void *(*start)(void *) = io_worker;
+    int n = pool->io_threads;
+#ifdef IO_URING
+    if (io->ring_fd >= 0) {
+        start = io_reaper;
+        n = 1;
+    }
+#endif
+    for (io->nthreads = 0; io->nthreads < n; io->nthreads++)
+        if (pthread_create(&io->thread[io->nthreads], NULL, start, io) != 0)
+            break;
+    if (io->nthreads == 0) {
+        io_free(io);
+        return NULL;
+    }
+    return io;
+}
+
+/*
+ * 입출력 요청 req를 빈 요청 목록으로 돌려보낸다.
+ */
+static void io_put(struct io_req *req)
+{
+    struct pool_io *io = req->io;
+
+    pthread_mutex_lock(&io->mutex);
+    req->next = io->free;
+    io->free = req;
+    pthread_mutex_unlock(&io->mutex);
+}
+
+/*
+ * 입출력이 끝난 요청의 완료 작업이다. 요청한 쪽의 완료 함수에 결과를 넘긴 뒤 요청을 돌려보낸다.
+ */
+static void io_done(void *param)
+{
+    struct io_req *req = (struct io_req *)param;
+
+    if (req->done != NULL)
+        req->done(req->p, req->res);
+    io_put(req);
+}
+
+/*
+ * 스레드풀의 비동기 입출력을 처리할 곳을 리턴한다. 처음 부르면 resize_mutex를 잡고 만든다. 만들지 못하면 NULL을 리턴한다.
+ */
+static struct pool_io *io_get(pthread_pool_t *pool)
+{
+    struct pool_io *io = atomic_load_explicit(&pool->io, memory_order_acquire);
+
+    if (io != NULL)
+        return io;
+    pthread_mutex_lock(&pool->resize_mutex);
+    if ((io = atomic_load(&pool->io)) == NULL && (io = io_create(pool)) != NULL)
+        atomic_store_explicit(&pool->io, io, memory_order_release);
+    pthread_mutex_unlock(&pool->resize_mutex);
+    return io;
+}
+
+/*
+ * 입출력 요청을 만들어 링에 넣거나 pending에 줄 세운다. 링에 빈 자리가 있고 앞서 기다리는 요청이 없으면 바로 커널에 넘기고,
+ * 아니면 reaper나 입출력 스레드가 차례대로 처리하게 한다. 성공하면 POOL_SUCCESS를 리턴한다.
+ */
+static int io_submit(pthread_pool_t *pool, int op, int fd, void *buf, size_t len, off_t off,
+                     void (*done)(void *p, long res), void *p)
+{
+    struct pool_io *io = io_get(pool);
+    struct io_req *req;
+
+    if (io == NULL)
+        return POOL_FAIL;
+    pthread_mutex_lock(&io->mutex);
+    if (io->closing) {
+        pthread_mutex_unlock(&io->mutex);
         return POOL_FAIL;
     }
-    
-    //bee_size 또는 queue_size가 각각 지정된 크기를 넘었으므로 POOL_FAIL을 리턴한다.
-    if (bee_size > POOL_MAXBSIZE || queue_size > POOL_MAXQSIZE)
+    if ((req = io->free) != NULL)
+        io->free = req->next;
+    else if ((req = (struct io_req *)malloc(sizeof(struct io_req))) == NULL) {
+        pthread_mutex_unlock(&io->mutex);
         return POOL_FAIL;
-    
-    //대기열로 사용할 원형 버퍼의 용량이 일꾼 스레드의 수보다 작으면 queue_size를 bee_size로 상향 조정한다.
-    if (queue_size < bee_size)
-        queue_size = bee_size;
-    
-    //일꾼 스레드를 생성한다.
-    for (int i = 0; i < bee_size; i++) {
-        pthread_create(&pool->bee[i], NULL, worker, pool);
     }
-    
-    //스레드풀 생성에 성공했으므로 POOL_SUCCESS를 리턴한다.
+    req->done = done;
+    req->p = p;
+    req->res = 0;
+    req->op = op;
+    req->fd = fd;
+    req->iov.iov_base = buf;
+    req->iov.iov_len = len;
+    req->off = off;
+    req->io = io;
+#ifdef IO_URING
+    if (io->ring_fd >= 0 && io->pending == NULL && io->inflight < (int)io->sq_entries) {
+        if (io_ring_push(io, req) != 0) {
+            req->next = io->free;
+            io->free = req;
+            pthread_mutex_unlock(&io->mutex);
+            return POOL_FAIL;
+        }
+        io->count++;
+        pthread_mutex_unlock(&io->mutex);
+        return POOL_SUCCESS;
+    }
+#endif
+    req->next = NULL;
+    if (io->pending == NULL)
+        io->pending = req;
+    else
+        io->pending_tail->next = req;
+    io->pending_tail = req;
+    io->count++;
+    if (io->ring_fd < 0)
+        pthread_cond_signal(&io->work);
+    pthread_mutex_unlock(&io->mutex);
     return POOL_SUCCESS;
 }
 
 /*
- * 스레드풀에서 실행시킬 함수와 인자의 주소를 넘겨주며 작업을 요청한다.
- * 스레드풀의 대기열이 꽉 찬 상황에서 flag이 POOL_NOWAIT이면 즉시 POOL_FULL을 리턴한다.
- * POOL_WAIT이면 대기열에 빈 자리가 나올 때까지 기다렸다가 넣고 나온다.
- * 작업 요청이 성공하면 POOL_SUCCESS를 리턴한다.
+ * 파일 기술자 fd의 offset 위치에서 len바이트를 buf로 읽도록 요청한다. 읽기가 끝나면 스레드풀의 일꾼이 done(p, res)를
+ * 실행하며, res는 pread()처럼 읽은 바이트 수이거나 실패했을 때의 -errno이다. 요청한 스레드는 기다리지 않고 바로 돌아온다.
+ * io_uring을 쓸 수 있으면 모든 요청을 스레드풀 하나에 하나뿐인 io_uring에 넣으므로 요청마다 스레드를 붙잡지 않고,
+ * 쓸 수 없으면 속성의 io_threads개의 입출력 스레드가 막히는 호출로 대신 처리한다. 어느 쪽이든 일꾼은 입출력을 기다리지 않는다.
+ * buf는 done이 실행될 때까지 그대로 두어야 한다. POOL_DISCARD로 종료하면 대기열에 남은 완료 작업의 done은 실행되지 않는다.
+ * 요청을 받으면 POOL_SUCCESS를, 스레드풀이 종료 중이거나 요청을 만들 수 없으면 POOL_FAIL을 리턴한다.
  */
-int pthread_pool_submit(pthread_pool_t *pool, void (*f)(void *p), void *p, int flag)
+int pthread_pool_io_read(pthread_pool_t *pool, int fd, void *buf, size_t len, off_t offset,
+                        void (*done)(void *p, long res), void *p)
 {
-    pthread_mutex_lock(&pool->mutex);
-    
-    //스레드풀의 대기열이 꽉 찬 상황에서 flag의 값에 따라 처리 방식이 바뀐다.
-    //flag 가 POOL_NOWAIT이면 즉시 POOL_FULL을 리턴하는데 이 때 뮤텍스락을 풀어준다.
-    while (pool->q_len == pool->q_size) {
-        if(flag == POOL_NOWAIT){
-            pthread_mutex_unlock(&pool->mutex); //스레드풀 기본 동작 검증 데드락 해결 방법
-            return POOL_FULL;
+    return io_submit(pool, IO_READ, fd, buf, len, offset, done, p);
+}
+
+/*
+ * 파일 기술자 fd의 offset 위치에 buf의 len바이트를 쓰도록 요청한다. res는 pwrite()처럼 쓴 바이트 수이거나 -errno이다.
+ * 나머지는 pthread_pool_io_read()와 같다.
+ */
+int pthread_pool_io_write(pthread_pool_t *pool, int fd, const void *buf, size_t len, off_t offset,
+                         void (*done)(void *p, long res), void *p)
+{
+    return io_submit(pool, IO_WRITE, fd, (void *)buf, len, offset, done, p);
+}
+
+/*
+ * 파일 기술자 fd의 내용을 저장 장치에 내려 쓰도록 요청한다. res는 성공하면 0, 실패하면 -errno이다.
+ * 앞서 요청한 쓰기가 끝난 뒤에 실행된다는 보장은 없으므로 쓰기의 done에서 요청한다. 나머지는 pthread_pool_io_read()와 같다.
+ */
+int pthread_pool_io_fsync(pthread_pool_t *pool, int fd, void (*done)(void *p, long res), void *p)
+{
+    return io_submit(pool, IO_FSYNC, fd, NULL, 0, 0, done, p);
+}
+
+/*
+ * 스레드풀을 종료할 때 새 입출력 요청을 막고, 받은 요청의 완료 작업이 모두 대기열에 들어가면 reaper나 입출력 스레드를 끝낸다.
+ * 완료 작업을 실행할 일꾼이 있어야 하므로 일꾼을 멈추기 전에 부른다. 입출력을 요청한 적이 없으면 io_closed를 걸어 둔다.
+ * pthread_pool_shutdown_drain()이 먼저 부른 뒤 pthread_pool_shutdown()이 다시 부르므로, 이미 닫았으면 그냥 돌아온다.
+ */
+static void io_stop(pthread_pool_t *pool)
+{
+    pthread_mutex_lock(&pool->resize_mutex);
+    struct pool_io *io = atomic_load(&pool->io);
+    if (io == NULL)
+        atomic_store(&pool->io, &io_closed);
+    pthread_mutex_unlock(&pool->resize_mutex);
+    if (io == NULL)
+        return;
+
+    pthread_mutex_lock(&io->mutex);
+    if (io->closing) {
+        pthread_mutex_unlock(&io->mutex);
+        return;
+    }
+    io->closing = true;
+    while (io->count > 0)
+        pthread_cond_wait(&io->idle, &io->mutex);
+#ifdef IO_URING
+    //reaper는 완료를 기다리며 커널 안에서 잠들어 있으므로 빈 요청을 넣어 깨운다. 링은 비어 있으므로 자리는 있다.
+    //커널이 잠시 받지 못할 때만 다시 넣는다. 링을 더 쓸 수 없으면 reaper도 기다리던 중에 오류를 받고 입출력 스레드가 된다.
+    int e;
+    if (io->ring_fd >= 0)
+        while ((e = io_ring_push(io, NULL)) == -EAGAIN || e == -EBUSY)
+            sched_yield();
+#endif
+    pthread_cond_broadcast(&io->work);
+    pthread_mutex_unlock(&io->mutex);
+    for (int i = 0; i < io->nthreads; i++)
+        pthread_join(io->thread[i], NULL);
+}
+
+/*
+ * 타이머를 만들어 delay_ms 밀리초 뒤에 처음 만료되도록 휠에 넣는다. period_ms가 0이 아니면 주기 작업이다.
+ * timer가 NULL이 아니면 요청한 쪽의 참조를 하나 더 두고 핸들을 돌려준다.
+ */
+static int timer_schedule(pthread_pool_t *pool, unsigned long delay_ms, unsigned long period_ms,
+                          void (*f)(void *p), void *p, pool_timer_t **timer)
+{
+    struct pool_timer *t = (struct pool_timer *)malloc(sizeof(struct pool_timer));
+
+    if (t == NULL || !pool_start(pool)) {
+        free(t);
+        return POOL_FAIL;
+    }
+    t->expires = now_tick() + delay_ms;
+    t->period = period_ms;
+    t->function = f;
+    t->param = p;
+    t->pool = pool;
+    atomic_init(&t->canceled, false);
+    atomic_init(&t->refs, timer != NULL ? 2 : 1);
+    if (timer != NULL)
+        *timer = t;
+    timer_add(pool, t);
+    return POOL_SUCCESS;
+}
+
+/*
+ * delay_ms 밀리초 뒤에 스레드풀에서 f(p)를 한 번 실행하도록 예약한다.
+ * 타이머마다 잠든 스레드를 두지 않고 스레드풀의 타이머 휠에 넣기만 하므로, 예약이 아주 많아도 넣는 비용은 O(1)이다.
+ * 만료된 작업은 0단계 대기열로 들어가 다른 작업과 같이 실행된다. 시각은 밀리초 단위이며, 일꾼이 모두 바쁘면
+ * 일꾼 하나가 작업을 마칠 때까지 늦어질 수 있다.
+ * timer가 NULL이 아니면 취소할 때 쓸 핸들을 돌려주며, 핸들은 반드시 pthread_pool_timer_cancel()로 놓아야 한다.
+ * 성공하면 POOL_SUCCESS를, 타이머를 만들 공간이 없으면 POOL_FAIL을 리턴한다.
+ */
+int pthread_pool_schedule_after(pthread_pool_t *pool, unsigned long delay_ms, void (*f)(void *p), void *p,
+                                pool_timer_t **timer)
+{
+    return timer_schedule(pool, delay_ms, 0, f, p, timer);
+}
+
+/*
+ * delay_ms 밀리초 뒤부터 period_ms 밀리초마다 스레드풀에서 f(p)를 실행하도록 예약한다.
+ * 다음 실행은 앞선 실행이 끝난 뒤에 예약하므로 같은 타이머의 작업이 겹쳐서 실행되지 않으며,
+ * 실행이 주기보다 오래 걸려 놓친 차례는 건너뛴다. 멈추려면 핸들을 받아 pthread_pool_timer_cancel()을 호출한다.
+ * period_ms가 0이면 POOL_FAIL을 리턴한다. 나머지는 pthread_pool_schedule_after()와 같다.
+ */
+int pthread_pool_schedule_every(pthread_pool_t *pool, unsigned long delay_ms, unsigned long period_ms,
+                                void (*f)(void *p), void *p, pool_timer_t **timer)
+{
+    if (period_ms == 0)
+        return POOL_FAIL;
+    return timer_schedule(pool, delay_ms, period_ms, f, p, timer);
+}
+
+/*
+ * 타이머를 취소하고 핸들을 놓는다. 취소한 뒤에는 작업을 새로 시작하지 않지만, 이미 실행 중인 작업은 마저 끝난다.
+ * 휠에 남은 타이머는 만료 시각에 조용히 사라지므로 취소 비용도 O(1)이다.
+ * 핸들은 스레드풀을 종료한 뒤에 놓아도 되며, 놓은 뒤에는 사용하면 안 된다. 항상 POOL_SUCCESS를 리턴한다.
+ */
+int pthread_pool_timer_cancel(pool_timer_t *timer)
+{
+    atomic_store(&timer->canceled, true);
+    timer_put(timer);
+    return POOL_SUCCESS;
+}
+
+/*
+ * parallel_for와 parallel_reduce가 나눈 구간 하나를 나타낸다.
+ * 구간이 grain보다 크면 반으로 나눠 오른쪽 절반을 그룹 작업으로 요청하고 왼쪽 절반은 직접 처리한다.
+ * acc는 이 구간의 중간 결과를 담을 공간이며, parallel_for에서는 NULL이다.
+ */
+struct range_job {
+    pthread_pool_t *pool;
+    long begin, end, grain;         /* 처리할 구간 [begin, end)와 더 나누지 않을 크기 */
+    void (*fn)(void *ctx, long begin, long end);
+    void (*rfn)(void *ctx, long begin, long end, void *acc);
+    void (*join)(void *ctx, void *acc, const void *other);
+    void *ctx;                      /* 사용자 함수에 넘겨줄 인자 */
+    void *acc;                      /* 이 구간의 중간 결과 */
+    const void *identity;           /* 중간 결과의 초깃값 */
+    size_t size;                    /* 중간 결과의 크기 */
+};
+
+/*
+ * 구간 하나를 처리하는 작업 함수이다. 재귀적으로 반씩 나누므로 깊이는 구간 길이의 로그를 넘지 않는다.
+ * 오른쪽 절반은 작업 훔치기 모드에서는 자기 덱의 밑에 깔리므로, 노는 일꾼은 가장 큰 조각부터 훔쳐간다.
+ * 그래서 조각마다 걸리는 시간이 달라도 먼저 끝난 일꾼이 남은 큰 조각을 나눠 가져간다.
+ */
+static void range_run(void *param)
+{
+    struct range_job *job = (struct range_job *)param;
+
+    if (job->end - job->begin <= job->grain) {
+        if (job->rfn != NULL)
+            job->rfn(job->ctx, job->begin, job->end, job->acc);
+        else
+            job->fn(job->ctx, job->begin, job->end);
+        return;
+    }
+
+    //오른쪽 절반은 따로 중간 결과를 두고 다른 일꾼에게 맡기고, 왼쪽 절반은 이 스레드가 처리한다.
+    unsigned char racc[job->size > 0 ? job->size : 1];
+    struct range_job left = *job, right = *job;
+    pool_group_t group;
+    long mid = job->begin + (job->end - job->begin) / 2;
+
+    left.end = mid;
+    right.begin = mid;
+    if (job->size > 0) {
+        memcpy(racc, job->identity, job->size);
+        right.acc = racc;
+    }
+    pthread_pool_group_init(&group, job->pool);
+    pthread_pool_group_submit(&group, range_run, &right);
+    range_run(&left);
+    pthread_pool_group_wait(&group);
+    if (job->join != NULL)
+        job->join(job->ctx, job->acc, racc);
+}
+
+/*
+ * grain이 0 이하이면 일꾼마다 여덟 조각 정도가 돌아가도록 정한다.
+ */
+static long range_grain(pthread_pool_t *pool, long begin, long end, long grain)
+{
+    if (grain > 0)
+        return grain;
+    grain = (end - begin) / (8 * (pool->bee_size > 0 ? pool->bee_size : 1));
+    return grain > 0 ? grain : 1;
+}
+
+/*
+ * 구간 [begin, end)를 grain 크기 이하의 조각으로 나눠 fn(ctx, 조각의 시작, 조각의 끝)을 병렬로 실행한다.
+ * 구간을 재귀적으로 반씩 나누며, 나눈 조각은 작업 그룹으로 요청하므로 기다리는 동안 다른 조각을 돕는다.
+ * 호출한 스레드도 조각을 처리하며, 모든 조각이 끝나면 POOL_SUCCESS를 리턴한다.
+ * grain이 0 이하이면 일꾼 수에 맞춰 알아서 정한다.
+ */
+int pthread_pool_parallel_for(pthread_pool_t *pool, long begin, long end, long grain,
+                              void (*fn)(void *ctx, long begin, long end), void *ctx)
+{
+    struct range_job job = { pool, begin, end, range_grain(pool, begin, end, grain),
+                             fn, NULL, NULL, ctx, NULL, NULL, 0 };
+
+    if (begin < end)
+        range_run(&job);
+    return POOL_SUCCESS;
+}
+
+/*
+ * parallel_for처럼 구간을 나눠 처리하면서 조각마다 중간 결과를 만들고 하나로 합친다.
+ * result는 size 바이트 크기의 결과 공간이며, 호출할 때 담겨 있는 값을 초깃값(항등원)으로 사용한다.
+ * fn(ctx, 시작, 끝, acc)은 조각을 처리해 acc에 누적하고, join(ctx, acc, other)은 other를 acc에 합친다.
+ * 합치는 순서는 구간의 왼쪽에서 오른쪽 순서를 지키므로 결합법칙만 성립하면 된다.
+ * 중간 결과는 나눌 때마다 스택에 잡으므로 size는 작게 유지하는 것이 좋다. 끝나면 POOL_SUCCESS를 리턴한다.
+ */
+int pthread_pool_parallel_reduce(pthread_pool_t *pool, long begin, long end, long grain,
+                                 void (*fn)(void *ctx, long begin, long end, void *acc),
+                                 void (*join)(void *ctx, void *acc, const void *other),
+                                 void *result, size_t size, void *ctx)
+{
+    unsigned char identity[size > 0 ? size : 1];
+    struct range_job job = { pool, begin, end, range_grain(pool, begin, end, grain),
+                             NULL, fn, join, ctx, result, identity, size };
+
+    memcpy(identity, result, size);
+    if (begin < end)
+        range_run(&job);
+    return POOL_SUCCESS;
+}
+
+/*
+ * 작업 n개를 한꺼번에 요청하고 대기열에 들어간 작업의 수를 리턴한다.
+ * 락을 쓰는 대기열이면 락을 한 번 잡은 채로, 락 없는 대기열이면 CAS 한 번으로 들어갈 수 있는 만큼 자리를 차지한다.
+ * 작업 훔치기 모드에서 같은 풀의 일꾼이 요청하면 모두 자기 덱에 넣는다.
+ * 일꾼은 넣은 작업 수와 잠든 일꾼 수 가운데 작은 수만큼만 깨운다.
+ * 대기열이 꽉 찬 상황에서 flag가 POOL_NOWAIT이면 그때까지 넣은 작업의 수를 바로 리턴하고,
+ * POOL_WAIT이면 빈 자리가 나올 때마다 이어서 넣어 항상 n을 리턴한다.
+ * 넣은 작업은 tasks 배열의 앞쪽부터이므로 리턴값 이후의 작업은 호출한 쪽이 다시 처리하면 된다.
+ * 남은 작업은 이미 호출한 쪽의 몫이므로 POOL_CALLER_RUNS와 POOL_DROP_OLDEST는 POOL_NOWAIT처럼 동작한다.
+ * POOL_BY_POLICY이면 속성의 on_full을 따른다.
+ * 작업은 모두 0단계에 들어간다. NUMA 노드마다 대기열을 나눴으면 요청한 스레드의 노드 대기열에만 넣는다.
+ * 통계를 모으면 tasks의 stamp에 넣은 시각을 적는다. lazy로 만든 스레드풀의 일꾼을 하나도 시작하지 못하면 0을 리턴한다.
+ */
+size_t pthread_pool_submit_batch(pthread_pool_t *pool, task_t *tasks, size_t n, int flag)
+{
+    size_t done = 0;
+    int l = current_node(pool) * pool->prio;
+
+    if (!pool_start(pool))
+        return 0;
+    if (flag == POOL_BY_POLICY)
+        flag = pool->on_full;
+    if (flag == POOL_CALLER_RUNS || flag == POOL_DROP_OLDEST)
+        flag = POOL_NOWAIT;
+
+    if (pool->stats) {
+        long now = now_ns();
+        for (size_t i = 0; i < n; i++)
+            tasks[i].stamp = now;
+    }
+    if (pool->trace != NULL && n > 0)
+        trace_note(pool, TRACE_SUBMIT, trace_function(&tasks[0]), n);
+
+    //같은 풀의 일꾼이 요청한 작업은 자기 덱에 넣는다. 덱에 넣지 못한 나머지는 공유 대기열로 보낸다.
+    if (pool->sched == POOL_SCHED_STEAL && my_bee != NULL && my_bee->pool == pool) {
+        while (done < n && deque_push(my_bee, &tasks[done]))
+            done++;
+        wake_idle_bees(pool, done);
+        if (done == n)
+            return n;
+    }
+
+    //락 없는 대기열이면 빈 칸을 한꺼번에 차지해서 넣고, 넣을 때마다 그만큼 일꾼을 깨운다.
+    if (pool->ring != NULL) {
+        struct ring *r = pool->lane[l].ring;
+        while (done < n) {
+            size_t k = ring_push_many(r, tasks + done, n - done);
+            if (k > 0) {
+                done += k;
+                wake_idle_bees(pool, k);
+            }
+            else if (flag == POOL_NOWAIT)
+                break;
+            else
+                submit_wait(pool, r);
         }
-        // flag가 POOL_WAIT이면 대기열에 빈 자리가 나올때까지 대기한다.
-        else{
-            pthread_cond_wait(&pool->full, &pool->mutex);
+        size_t len = ring_queued(pool);
+        depth_note(pool, len);
+        pool_autogrow(pool, len);
+        if (done < n)
+            atomic_fetch_add_explicit(&pool->rejected, n - done, memory_order_relaxed);
+        return done;
+    }
+
+    pthread_mutex_lock(&pool->mutex);
+    while (done < n) {
+        //대기열이 꽉 차면 flag에 따라 지금까지 넣은 수를 리턴하거나 빈 자리를 기다린다.
+        if (pool->lane[l].len == pool->q_size) {
+            if (flag == POOL_NOWAIT)
+                break;
+            submit_wait(pool, NULL);
+            continue;
         }
+
+        //빈 자리만큼 한꺼번에 채우고, 잠든 일꾼 가운데 넣은 작업 수만큼만 깨운다.
+        size_t k = pool->q_size - pool->lane[l].len;
+        if (k > n - done)
+            k = n - done;
+        for (size_t i = 0; i < k; i++)
+            queue_put(pool, l, &tasks[done + i]);
+        done += k;
+        int wake = atomic_load(&pool->idle);
+        for (size_t i = 0; i < k && wake > 0; i++, wake--)
+            pthread_cond_signal(&pool->empty);
     }
-    
-    //대기열에 작업을 추가해주며 q_len의 값을 1 증가시킨다.
-    int index = (pool->q_front + pool->q_len) % pool->q_size;
-    pool->q[index].function = f;
-    pool->q[index].param = p;
-    pool->q_len++;
-    
-    //대기 중인 일꾼 스레드에게 시그널을 보내 작업이 가능하다고 알린다.
-    pthread_cond_signal(&pool->empty);
+    size_t len = pool->q_len;
     pthread_mutex_unlock(&pool->mutex);
-    
-    //작업 요청이 성공했으므로 POOL_SUCCESS를 리턴한다.
-    return POOL_SUCCESS;
+    if (pool->shared)
+        shared_wake((int)done);
+    pool_autogrow(pool, len);
+    if (done < n)
+        atomic_fetch_add_explicit(&pool->rejected, n - done, memory_order_relaxed);
+    return done;
 }
 
 /*
  * 스레드풀을 종료한다. 일꾼 스레드가 현재 작업 중이면 그 작업을 마치게 한다.
  * how의 값이 POOL_COMPLETE이면 대기열에 남아 있는 모든 작업을 마치고 종료한다.
  * POOL_DISCARD이면 대기열에 새 작업이 남아 있어도 더 이상 수행하지 않고 종료한다.
+ * POOL_DRAIN이면 시간 제한 없이 pthread_pool_shutdown_drain()을 부른 것과 같다.
  * 부모 스레드는 종료된 일꾼 스레드와 조인한 후에 스레드풀에 할당된 자원을 반납한다.
+ * 작업 훔치기 모드에서는 일꾼의 덱에 남은 작업도 대기열과 같은 방식으로 처리한다.
+ * 아직 만료되지 않은 지연 작업과 주기 작업은 how와 상관없이 실행하지 않는다.
+ * 비동기 입출력은 새 요청을 막고 받아 둔 요청이 모두 끝나기를 기다린 뒤 완료 작업을 대기열의 작업과 같이 처리한다.
+ * 공유 일꾼을 쓰면 공유 일꾼의 목록에서 빠지고 이 스레드풀의 작업을 실행 중인 공유 일꾼이 끝나기를 기다린 뒤,
+ * 대기열에 남은 작업은 how에 따라 부모 스레드가 실행하거나 버린다. 다른 스레드풀과 나눠 쓰는 공유 일꾼은 끝내지 않는다.
  * 스레드를 종료시키기 위해 철회를 생각할 수 있으나 바람직하지 않다.
  * 락을 소유한 스레드를 중간에 철회하면 교착상태가 발생하기 쉽기 때문이다.
  * 종료가 완료되면 POOL_SUCCESS를 리턴한다.
  */
 int pthread_pool_shutdown(pthread_pool_t *pool, int how)
 {
+    task_t task;
+
+    if (how == POOL_DRAIN)
+        return pthread_pool_shutdown_drain(pool, NULL, NULL);
+
+    // 새 입출력 요청을 막고 받아 둔 입출력이 끝나 완료 작업이 모두 대기열에 들어가기를 기다린다.
+    io_stop(pool);
+
     pthread_mutex_lock(&pool->mutex);
-    // 스레드풀을 종료한다.
+    // 스레드풀을 종료한다. POOL_DISCARD이면 일꾼이 미리 가져간 작업도 버리게 한다.
+    // 일꾼 수를 바꾸는 쪽은 resize_mutex를 잡고 running을 보므로, 종료한 뒤에는 일꾼이 늘거나 물러나지 않는다.
+    pthread_mutex_lock(&pool->resize_mutex);
+    pool->discard = (how != POOL_COMPLETE);
     pool->running = false;
+    pthread_mutex_unlock(&pool->resize_mutex);
     // 일꾼 스레드가 현재 작업 중이면 그 작업을 마치게 한다.
     pthread_cond_broadcast(&pool->empty);
-        
+    pthread_mutex_unlock(&pool->mutex);
+    // 락 없는 대기열을 사용하면 futex에서 잠든 일꾼도 모두 깨운다.
+    if (pool->ring != NULL) {
+        atomic_fetch_add(&pool->notempty, 1);
+        futex_wake(&pool->notempty, INT_MAX);
+    }
+
+    // 공유 일꾼을 쓰면 더 이상 공유 일꾼이 이 스레드풀의 작업을 꺼내지 않게 한다.
+    if (pool->shared)
+        shared_leave(pool);
+
     // how 가 POOL_COMPLETE 이면 대기열에 남아 있는 모든 작업을 마치고 종료한다.
+    // 남은 작업이 다시 작업을 요청할 수 있으므로 작업을 실행하는 동안에는 락을 풀어 둔다.
+    // 작업 훔치기 모드에서는 일꾼과 조인한 뒤에 덱과 함께 처리한다.
     if (how == POOL_COMPLETE) {
-        while (pool->q_len > 0) {
-            int index = pool->q_front;
-            pool->q_front = (pool->q_front + 1) % pool->q_size;
-            pool->q_len--;
-
-            if (pool->q_len == pool->q_size - 1) {
-                pthread_cond_broadcast(&pool->full);
-            }
-            
-            task_t task = pool->q[index];
-            task.function(task.param);
+        if (pool->sched == POOL_SCHED_FIFO) {
+            while (queue_trypop(pool, &task))
+                task_call(&task);
         }
     }
     // how 가 POOL_DISCARD 이면 대기열에 작업이 남이 있어도 대기열을 비워준다.
-    else{
-        pool->q_front = 0;
-        pool->q_len = 0;
+    else {
+        while (queue_trypop(pool, &task))
+            shutdown_drop(pool, &task);
     }
-    
-        
-    pthread_mutex_unlock(&pool->mutex);
-    
-    //종료된 일꾼 스레드와 조인한다.
-    for (int i = 0; i < pool->bee_size; i++) {
-        pthread_join(pool->bee[i], NULL);
+
+    //일꾼 스레드가 모두 끝나기를 기다린다. 일꾼 스레드는 끝나면 스레드 캐시로 돌아가므로 조인하는 대신
+    //물러난 일꾼까지 포함해 모든 스레드가 스레드풀을 건드리지 않게 될 때까지 기다린다.
+    unsigned int threads;
+    while ((threads = atomic_load(&pool->threads)) > 0)
+        futex_wait(&pool->threads, threads);
+
+    //일꾼이 끝나기 전에 실행 중이던 작업이 새 작업을 넣었을 수 있으므로 FIFO 모드에서도 대기열을 한 번 더 비운다.
+    //일꾼은 running이 false이면 대기열을 보지 않으므로 여기서 처리하지 않으면 그 작업은 실행되지도 버려지지도 않는다.
+    if (pool->sched == POOL_SCHED_FIFO) {
+        while (queue_trypop(pool, &task)) {
+            if (how == POOL_COMPLETE)
+                task_call(&task);
+            else
+                shutdown_drop(pool, &task);
+        }
+    }
+
+    //작업 훔치기 모드이면 대기열과 일꾼이 남기고 간 덱의 작업을 처리한다.
+    //일꾼은 모두 끝났으므로 덱을 다투는 스레드는 없다. 남은 작업이 새 작업을 요청하면
+    //꽉 찬 대기열에서 멈추지 않도록 첫 번째 일꾼의 덱을 빌려 그곳에 넣게 하고, 모두 빌 때까지 반복한다.
+    if (pool->sched == POOL_SCHED_STEAL && pool->hive[0] != NULL) {
+        struct bee *saved = my_bee;
+        bool more = true;
+        my_bee = pool->hive[0];
+        while (more) {
+            more = false;
+            while (queue_trypop(pool, &task)) {
+                more = true;
+                if (how == POOL_COMPLETE)
+                    task_call(&task);
+                else
+                    shutdown_drop(pool, &task);
+            }
+            for (int i = 0; i < POOL_MAXBSIZE && pool->hive[i] != NULL; i++) {
+                while (deque_pop(pool->hive[i], &task)) {
+                    more = true;
+                    if (how == POOL_COMPLETE)
+                        task_call(&task);
+                    else
+                        shutdown_drop(pool, &task);
+                }
+            }
+        }
+        my_bee = saved;
+    }
+
+    // 아직 만료되지 않은 타이머는 실행하지 않고 놓는다. 핸들을 가진 쪽의 참조는 남겨 둔다.
+    for (int l = 0; l < WHEEL_LEVELS; l++) {
+        for (int i = 0; i < WHEEL_SLOTS; i++) {
+            struct pool_timer *t = pool->wheel->slot[l][i];
+            while (t != NULL) {
+                struct pool_timer *next = t->next;
+                timer_put(t);
+                t = next;
+            }
+        }
     }
 
     // 사용한 자원을 해제한다.
     pthread_mutex_destroy(&pool->mutex);
+    pthread_mutex_destroy(&pool->fut_mutex);
+    pthread_mutex_destroy(&pool->fiber_mutex);
+    pthread_mutex_destroy(&pool->resize_mutex);
+    pthread_mutex_destroy(&pool->timer_mutex);
     pthread_cond_destroy(&pool->full);
     pthread_cond_destroy(&pool->empty);
-    
+
     //할당된 공간도 풀어준다.
-    free(pool->q);
-    free(pool->bee);
-    
+    pool_free(pool);
+
     //종료가 완료되었으므로 POOL_SUCCESS를 리턴한다.
     return POOL_SUCCESS;
 }
+
+/*
+ * 일꾼이 남은 작업을 모두 마쳤는지 확인한다. 대기열과 덱이 비어 있고 모든 일꾼이 잠들려고 하면 마친 것이다.
+ * 공유 일꾼을 쓰면 일꾼 대신 이 스레드풀의 작업을 실행 중인 공유 일꾼이 없는지 본다. 일꾼을 시작하지 않았으면 대기열만 본다.
+ * 실행 중인 작업이 새 작업을 넣고 끝나는 경우를 놓치지 않도록 일꾼의 상태를 먼저 읽고 대기열은 그 뒤에 읽는다.
+ */
+static bool pool_drained(pthread_pool_t *pool)
+{
+    if (pool->shared) {
+        pthread_mutex_lock(&shared_bees.mutex);
+        int busy = pool->busy;
+        pthread_mutex_unlock(&shared_bees.mutex);
+        if (busy > 0)
+            return false;
+    }
+    else if (!atomic_load(&pool->dormant) && atomic_load(&pool->idle) < atomic_load(&pool->bee_size))
+        return false;
+
+    if (pool->ring != NULL) {
+        if (queue_nonempty(pool))
+            return false;
+    }
+    else {
+        pthread_mutex_lock(&pool->mutex);
+        int len = pool->q_len;
+        pthread_mutex_unlock(&pool->mutex);
+        if (len > 0)
+            return false;
+    }
+    return !hive_nonempty(pool);
+}
+
+/*
+ * 일꾼이 대기열과 덱에 남은 작업을 모두 마치게 한 뒤 스레드풀을 종료한다.
+ * POOL_COMPLETE로 종료하면 남은 작업을 부모 스레드 혼자 실행하지만, 이 함수는 일꾼을 멈추지 않은 채 기다리므로
+ * 종료에 걸리는 시간이 남은 작업의 양을 일꾼 수로 나눈 만큼으로 줄어든다. 기다리는 동안에도 작업을 요청할 수 있다.
+ * abstime(CLOCK_REALTIME 기준)이 NULL이 아니면 그 시각까지만 기다리고, 그때까지 시작하지 못한 작업은 실행하지 않고 버린다.
+ * 버리는 작업은 reject 함수가 있으면 작업마다 알려 주며, 핸들로 요청한 작업은 버려진 것으로 끝난다.
+ * 이미 실행 중인 작업은 중간에 멈출 수 없으므로 끝나기를 기다린다. 나머지는 pthread_pool_shutdown()과 같다.
+ * left가 NULL이 아니면 버린 작업의 수를 저장한다.
+ * 남은 작업을 모두 마쳤으면 POOL_SUCCESS를, 시간이 지나 남은 작업을 하나라도 버렸으면 POOL_TIMEOUT을 리턴한다.
+ */
+int pthread_pool_shutdown_drain(pthread_pool_t *pool, const struct timespec *abstime, size_t *left)
+{
+    bool drained;
+
+    // 입출력의 완료 작업도 남은 작업에 들어가도록 먼저 받아 둔 입출력이 끝나기를 기다린다.
+    io_stop(pool);
+
+    // 일꾼은 그대로 두고, 잠들 때마다 알려 달라고 한 뒤 모두 마칠 때까지 기다린다.
+    atomic_store(&pool->draining, true);
+    for (;;) {
+        unsigned int key = atomic_load(&pool->drain_seq);
+        if ((drained = pool_drained(pool)))
+            break;
+        if (!futex_timedwait(&pool->drain_seq, key, abstime)) {
+            drained = pool_drained(pool);
+            break;
+        }
+    }
+
+    // 모두 마쳤으면 그 사이에 들어온 작업까지 마치고, 시간이 지났으면 남은 작업을 버리며 종료한다.
+    // 시간이 지났어도 그때 남은 작업이 이미 실행 중이던 것뿐이라 버린 작업이 없으면 모두 마친 것으로 본다.
+    pthread_pool_shutdown(pool, drained ? POOL_COMPLETE : POOL_DISCARD);
+    size_t discarded = (size_t)atomic_load(&pool->discarded);
+    if (left != NULL)
+        *left = discarded;
+    return discarded > 0 ? POOL_TIMEOUT : POOL_SUCCESS;
+}
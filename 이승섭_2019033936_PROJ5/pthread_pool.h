@@ -9,54 +9,468 @@
 
 #include <pthread.h>
 #include <stdbool.h>
+#include <stdatomic.h>
+#include <sys/types.h>
 
 #define POOL_MAXBSIZE 128
 #define POOL_MAXQSIZE 1024
 #define POOL_WAIT 0
 #define POOL_NOWAIT 1
+#define POOL_CALLER_RUNS 2
+#define POOL_DROP_OLDEST 3
+#define POOL_BY_POLICY 4
 #define POOL_SUCCESS 0
 #define POOL_FAIL 1
 #define POOL_FULL 2
+#define POOL_TIMEOUT 3
 #define POOL_DISCARD 0
 #define POOL_COMPLETE 1
+#define POOL_DRAIN 2
+#define POOL_SCHED_FIFO 0
+#define POOL_SCHED_STEAL 1
+#define POOL_QUEUE_LOCK 0
+#define POOL_QUEUE_LOCKFREE 1
+#define POOL_MAXPRIO 8
+#define POOL_AFFINITY_NONE 0
+#define POOL_AFFINITY_COMPACT 1
+#define POOL_AFFINITY_SPREAD 2
+#define POOL_HIST_BUCKETS 272
+
+/*
+ * pthread_pool_init()이 사용할 대기열 구현의 기본값이다.
+ * 컴파일할 때 -DPOOL_DEFAULT_QUEUE=POOL_QUEUE_LOCKFREE를 주면 모든 스레드풀이 락 없는 대기열을 사용한다.
+ */
+#ifndef POOL_DEFAULT_QUEUE
+#define POOL_DEFAULT_QUEUE POOL_QUEUE_LOCK
+#endif
+
+/*
+ * 스레드 캐시에 남겨 둘 수 있는 놀고 있는 스레드의 최대 수이다. 스레드풀을 종료하면 일꾼을 맡았던 스레드는 끝나지 않고
+ * 이 수까지 캐시에서 잠들어 있다가, 다음에 만드는 스레드풀의 일꾼을 맡는다. 0이면 캐시를 쓰지 않는다.
+ */
+#ifndef POOL_THREAD_CACHE
+#define POOL_THREAD_CACHE (4 * POOL_MAXBSIZE)
+#endif
+
+/*
+ * pthread_pool_submit_inline()이 작업 안에 복사해 둘 수 있는 인자의 최대 크기(바이트)이다.
+ * 기본값 40이면 64비트 시스템에서 task_t 하나가 캐시 라인 하나(64바이트)를 꼭 채운다.
+ * 컴파일할 때 -DPOOL_INLINE_SIZE=...로 바꿀 수 있지만, 그러면 작업 하나가 캐시 라인 하나에 맞지 않을 수 있다.
+ */
+#ifndef POOL_INLINE_SIZE
+#define POOL_INLINE_SIZE 40
+#endif
 
 /*
  * 스레드를 통해 실행할 작업 함수와 함수의 인자정보 구조체 타입
+ * stamp는 스레드풀이 통계를 위해 작업을 넣은 시각을 적어 두는 곳으로, 요청하는 쪽은 채우지 않아도 된다.
+ * arg는 pthread_pool_submit_inline()이 인자를 복사해 두는 곳으로, 이때 param은 스레드풀 안의 표시를 가리키고
+ * 일꾼은 param 대신 자기가 꺼낸 작업의 arg 주소를 함수에 넘긴다. 다른 방법으로 요청하는 쪽은 쓰지 않는다.
+ * arg는 포인터 크기 단위로 정렬되어 있다.
  */
 typedef struct {
     void (*function)(void *param);
     void *param;
+    long stamp;
+    unsigned char arg[POOL_INLINE_SIZE];
 } task_t;
 
+/*
+ * 스레드풀을 생성할 때 기본값 대신 사용할 선택사항을 담는 속성 구조체 타입
+ *
+ * sched는 작업 배분 방식이다. POOL_SCHED_FIFO이면 모든 일꾼이 하나의 대기열 q를 공유하고,
+ * POOL_SCHED_STEAL이면 일꾼마다 자기 작업 덱을 두고 일이 없는 일꾼이 다른 일꾼의 덱에서 작업을 훔쳐온다.
+ * queue는 공유 대기열의 구현이다. POOL_QUEUE_LOCK이면 mutex로 보호하는 원형 버퍼 q를,
+ * POOL_QUEUE_LOCKFREE이면 칸마다 순번을 두는 락 없는 다중 생산자/다중 소비자 원형 버퍼를 사용한다.
+ * batch는 일꾼이 공유 대기열에서 한 번에 가져올 수 있는 작업의 최대 수이며 기본값은 1이다.
+ * 대기열이 깊으면 일꾼은 남은 작업을 일꾼 수로 나눈 몫까지 한 번의 임계구역에서 가져가 락 없이 차례로 실행한다.
+ * prio는 우선순위 단계의 수로 1부터 POOL_MAXPRIO까지이며 기본값은 1이다. 단계마다 queue_size 크기의 대기열을 따로 두고,
+ * 0단계가 가장 높다. 일꾼은 높은 단계의 작업부터 꺼내지만, 작업이 남아 있는 낮은 단계가 age번 밀리면 그 단계를 먼저 꺼낸다.
+ * age가 0이면 밀린 횟수를 세지 않고 항상 높은 단계부터 꺼낸다. 기본값은 8이다.
+ * bee_max가 0보다 크면 일꾼 수를 부하에 맞춰 bee_min에서 bee_max 사이로 스스로 조절한다.
+ * 잠든 일꾼이 없는데 대기열의 길이가 grow_len을 넘으면 일꾼을 하나 늘리고,
+ * 가장 마지막 일꾼이 idle_ms 밀리초 동안 할 일이 없으면 물러난다. grow_len이 0이면 queue_size의 절반을 쓴다.
+ * 기본값은 bee_max가 0으로 자동 조절을 하지 않는다.
+ * affinity는 일꾼을 CPU에 묶는 방식이다. POOL_AFFINITY_COMPACT이면 i번째 일꾼을 CPU 목록의 i번째 CPU에 차례로 묶고,
+ * POOL_AFFINITY_SPREAD이면 NUMA 노드를 돌아가며 하나씩 묶는다. CPU 목록은 cpus 배열의 ncpus개 CPU 번호이며,
+ * cpus가 NULL이면 스레드풀을 만드는 스레드가 실행될 수 있는 CPU를 모두 쓴다. 기본값은 POOL_AFFINITY_NONE으로 묶지 않는다.
+ * numa가 true이면 공유 대기열을 NUMA 노드마다 따로 두고, 노드의 대기열 공간은 그 노드의 CPU에서 처음 건드려 노드의 메모리에 놓는다.
+ * 작업을 넣는 스레드와 일꾼은 자기 노드의 대기열을 먼저 쓰고, 그 대기열이 꽉 찼거나 비었을 때만 다른 노드의 대기열을 쓴다.
+ * 이때 affinity가 POOL_AFFINITY_NONE이어도 일꾼은 노드를 돌아가며 그 노드의 CPU에 묶는다. 기본값은 false이다.
+ * CPU 묶기와 NUMA 노드 구분은 리눅스에서만 하며, 다른 시스템에서는 이 값들을 무시한다.
+ * spin_us와 yields는 일꾼이 작업을, 요청 스레드가 꽉 찬 대기열의 빈 자리를 기다리는 방식이다. 잠들기 전에 최대 spin_us
+ * 마이크로초 동안 pause로 쉬며 돌고, 그 다음 yields번까지 CPU를 양보한 뒤에야 잠든다. 실제로 도는 시간은 최근에
+ * 기다린 시간에 맞춰 spin_us 안에서 스스로 줄이거나 늘린다. CPU가 하나뿐이면 돌지 않는다. 둘 다 0이면 바로 잠들며 기본값은 0이다.
+ * stats가 true이면 작업마다 시각을 재서 일꾼의 일한 시간과 쉰 시간, 작업의 대기 시간과 실행 시간 분포를 모은다.
+ * 실행한 작업의 수와 거절한 작업의 수 같은 카운터는 이 값과 상관없이 센다. 기본값은 false이다.
+ * on_full은 작업을 요청할 때 flag로 POOL_BY_POLICY를 주었을 때 쓸 처리 방식으로, 대기열이 꽉 차면 어떻게 할지를 정한다.
+ * POOL_WAIT와 POOL_NOWAIT는 flag로 줄 때와 같고, POOL_CALLER_RUNS이면 요청한 스레드가 그 자리에서 작업을 직접 실행하며,
+ * POOL_DROP_OLDEST이면 넣으려는 대기열에서 가장 오래된 작업을 빼서 버리고 새 작업을 넣는다. 기본값은 POOL_WAIT이다.
+ * reject가 NULL이 아니면 POOL_DROP_OLDEST로 버린 작업마다 그 작업의 함수와 인자, reject_ctx를 넘겨 호출한다.
+ * 호출은 락을 모두 푼 뒤 작업을 요청한 스레드에서 하므로 reject 안에서 다시 작업을 요청해도 된다.
+ * lazy가 true이면 스레드풀을 만들 때 일꾼을 시작하지 않고, 처음으로 작업이나 타이머가 들어오거나 일꾼 수를 바꿀 때 시작한다.
+ * 만들기만 하고 쓰지 않는 스레드풀은 스레드를 하나도 쓰지 않는다. 기본값은 false이다.
+ * trace가 0보다 크면 작업 요청, 대기열에서 꺼내기, 작업의 시작과 끝, 일꾼의 잠들기와 깨어나기를 사건으로 남긴다.
+ * 일꾼마다, 그리고 일꾼이 아닌 스레드들이 함께 쓰는 기록 버퍼를 하나씩 두고 최근 사건을 trace개(2의 거듭제곱으로 올림)까지
+ * 남기며, pthread_pool_trace_dump()로 Chrome trace JSON 파일에 쓴다. 기본값은 0으로 사건을 남기지 않는다.
+ * fiber_stack은 pthread_pool_submit_fiber()로 넣은 파이버 작업 하나가 쓰는 스택의 크기(바이트)로, 16KiB 이상이어야 한다.
+ * 스택 아래에는 넘치면 바로 멈추도록 접근할 수 없는 보호 페이지를 하나 둔다. 기본값은 64KiB이다.
+ * io_threads는 io_uring을 쓸 수 없을 때 pthread_pool_io_read() 같은 비동기 입출력을 대신 처리할 스레드의 수이다.
+ * 이 스레드들은 일꾼과 따로 입출력이 끝날 때까지 막혀 있으므로 일꾼은 입출력을 기다리지 않는다. 기본값은 2이다.
+ * shared가 true이면 스레드풀이 자기 일꾼을 만들지 않고, 프로세스 전체에 CPU 수만큼 두는 공유 일꾼을 다른 shared 스레드풀과 나눠 쓴다.
+ * 대기열, 대기열의 크기, 꽉 찼을 때의 처리 방식, 종료 방식은 스레드풀마다 따로이며, bee_size는 이 스레드풀의 작업을
+ * 동시에 실행할 공유 일꾼의 최대 수가 된다. 공유 일꾼은 결손 라운드 로빈(deficit round robin)으로 스레드풀을 돌아가며,
+ * 차례가 올 때마다 weight개까지 작업을 실행한다. 그래서 바쁜 스레드풀들은 weight에 비례해 일꾼을 나눠 가진다.
+ * 이때 sched는 POOL_SCHED_FIFO여야 하고 자동 조절, CPU 묶기, NUMA 노드 구분은 쓸 수 없으며, 일꾼별 통계는 모으지 않는다.
+ * shared의 기본값은 false이고 weight의 기본값은 1이다.
+ * 속성은 pthread_pool_attr_init()으로 기본값을 채운 뒤 필요한 항목만 바꿔서 사용한다.
+ */
+typedef struct {
+    int sched;              /* 작업 배분 방식, POOL_SCHED_FIFO 또는 POOL_SCHED_STEAL */
+    int queue;              /* 공유 대기열 구현, POOL_QUEUE_LOCK 또는 POOL_QUEUE_LOCKFREE */
+    int batch;              /* 일꾼이 공유 대기열에서 한 번에 가져오는 작업의 최대 수 */
+    int prio;               /* 우선순위 단계의 수 */
+    int age;                /* 낮은 단계가 이만큼 밀리면 먼저 꺼낸다, 0이면 사용하지 않음 */
+    int bee_min;            /* 자동 조절할 때 남겨 둘 일꾼의 최소 수 */
+    int bee_max;            /* 자동 조절할 때 늘릴 수 있는 일꾼의 최대 수, 0이면 자동 조절하지 않음 */
+    int grow_len;           /* 대기열의 길이가 이보다 길면 일꾼을 늘린다 */
+    int idle_ms;            /* 마지막 일꾼이 이만큼 할 일이 없으면 물러난다 */
+    int affinity;           /* 일꾼을 CPU에 묶는 방식, POOL_AFFINITY_NONE, _COMPACT, _SPREAD 가운데 하나 */
+    const int *cpus;        /* 일꾼을 묶을 CPU 번호의 목록, NULL이면 사용할 수 있는 CPU 전체 */
+    int ncpus;              /* cpus 배열의 길이 */
+    bool numa;              /* NUMA 노드마다 공유 대기열을 따로 둘지 여부 */
+    int spin_us;            /* 잠들기 전에 돌며 기다릴 최대 시간(마이크로초) */
+    int yields;             /* 돈 다음 잠들기 전에 CPU를 양보할 횟수 */
+    bool stats;             /* 작업마다 시각을 재는 통계를 모을지 여부 */
+    int on_full;            /* POOL_BY_POLICY로 요청한 작업의 대기열이 꽉 찼을 때의 처리 방식 */
+    void (*reject)(void (*f)(void *p), void *p, void *ctx);    /* 버린 작업을 알려 줄 함수, NULL이면 알리지 않음 */
+    void *reject_ctx;       /* reject에 넘길 값 */
+    bool lazy;              /* 첫 작업이 들어올 때 일꾼을 시작할지 여부 */
+    int trace;              /* 기록 버퍼마다 남길 사건의 수, 0이면 사건을 남기지 않음 */
+    size_t fiber_stack;     /* 파이버 작업 하나의 스택 크기(바이트) */
+    int io_threads;         /* io_uring을 쓸 수 없을 때 입출력을 대신 처리할 스레드의 수 */
+    bool shared;            /* 프로세스 전체의 공유 일꾼을 쓸지 여부 */
+    int weight;             /* 공유 일꾼이 차례마다 이 스레드풀에서 실행할 작업의 수 */
+} pthread_pool_attr_t;
+
+/*
+ * pthread_pool_wait_stats()가 채우는 기다림 통계 구조체 타입
+ *
+ * 기다림 한 번은 돌기(spin), 양보하기(yield), 잠들기(park) 가운데 끝난 단계 하나로 센다.
+ * bee는 일꾼이 작업을 기다린 경우이고, submit은 요청 스레드가 꽉 찬 대기열의 빈 자리를 기다린 경우이다.
+ */
+typedef struct {
+    unsigned long spin;     /* 돌며 기다리는 동안 해결된 횟수 */
+    unsigned long yield;    /* CPU를 양보하는 동안 해결된 횟수 */
+    unsigned long park;     /* 잠들어서 기다린 횟수 */
+} pool_wait_count_t;
+
+typedef struct {
+    pool_wait_count_t bee;      /* 일꾼이 작업을 기다린 횟수 */
+    pool_wait_count_t submit;   /* 요청 스레드가 빈 자리를 기다린 횟수 */
+} pool_wait_stats_t;
+
+/*
+ * pthread_pool_stats()가 채우는 스레드풀 통계 구조체 타입
+ *
+ * bee는 hive의 자리마다 그 자리의 일꾼이 모은 값이며, 물러난 일꾼의 값도 남아 있다.
+ * busy_ns, idle_ns와 두 분포는 속성의 stats가 true일 때만 모으며, 시간은 모두 나노초이다.
+ * 분포는 HDR 히스토그램처럼 2의 거듭제곱 구간마다 8칸으로 나눈 로그 눈금을 쓰므로 어느 값이든 상대 오차가 1/8 안이다.
+ * 칸 b가 나타내는 값의 범위는 pthread_pool_hist_value(b) 이상 pthread_pool_hist_value(b + 1) 미만이며,
+ * 마지막 칸은 그보다 큰 값을 모두 담는다. 백분위수는 pthread_pool_hist_percentile()로 구한다.
+ */
+typedef struct {
+    unsigned long tasks;    /* 실행한 작업의 수 */
+    unsigned long busy_ns;  /* 작업을 실행한 시간 */
+    unsigned long idle_ns;  /* 작업을 찾거나 기다린 시간 */
+} pool_bee_stats_t;
+
+typedef struct {
+    int bee_size;                       /* 통계를 읽을 때의 일꾼 수 */
+    pool_bee_stats_t bee[POOL_MAXBSIZE];/* hive의 자리마다 모은 일꾼의 통계 */
+    unsigned long tasks;                /* 모든 일꾼이 실행한 작업의 수 */
+    unsigned long rejected;             /* 대기열이 꽉 차서 POOL_FULL로 거절한 작업의 수 */
+    unsigned long caller_ran;           /* 대기열이 꽉 차서 POOL_CALLER_RUNS로 요청한 스레드가 직접 실행한 작업의 수 */
+    unsigned long dropped;              /* 대기열이 꽉 차서 POOL_DROP_OLDEST로 버린 작업의 수 */
+    unsigned long canceled;             /* 토큰이 만료되어 실행하지 않고 버린 작업의 수 */
+    int queue_high;                     /* 공유 대기열에 한꺼번에 쌓였던 작업 수의 최댓값 */
+    unsigned long wait_hist[POOL_HIST_BUCKETS];  /* 작업을 넣은 뒤 실행을 시작할 때까지 걸린 시간의 분포 */
+    unsigned long run_hist[POOL_HIST_BUCKETS];   /* 작업을 실행하는 데 걸린 시간의 분포 */
+    pool_wait_stats_t wait;             /* 기다림이 끝난 단계별 횟수 */
+} pool_stats_t;
+
+/*
+ * pthread_pool_submit_future()가 돌려주는 작업 완료 핸들 타입
+ *
+ * 핸들은 스레드풀이 만들어 두고 다시 쓰며, 내부 구조는 pthread_pool.c에만 있다.
+ * pthread_pool_future_wait(), pthread_pool_future_timedwait()으로 완료를 기다리고
+ * pthread_pool_future_poll()로 기다리지 않고 확인한 뒤 pthread_pool_future_release()로 놓는다.
+ * pthread_pool_future_then()으로 작업이 끝나면 이어서 실행할 후속 작업을 붙일 수 있다.
+ * 핸들은 스레드풀을 종료하기 전에 모두 놓아야 한다.
+ */
+typedef struct pool_future pool_future_t;
+
+/*
+ * pthread_pool_schedule_after()와 pthread_pool_schedule_every()가 돌려주는 타이머 핸들 타입
+ *
+ * 내부 구조는 pthread_pool.c에만 있으며, 핸들은 pthread_pool_timer_cancel()로 취소하면서 놓는다.
+ */
+typedef struct pool_timer pool_timer_t;
+
+struct bee;
+struct ring;
+struct pool_lane;
+struct future_slab;
+struct timer_wheel;
+struct trace_buf;
+struct pool_fiber;
+struct pool_io;
+
+/*
+ * 작업을 취소하거나 기한을 두는 데 쓰는 취소 토큰 구조체 타입
+ *
+ * pthread_pool_token_init()으로 초기화하고 pthread_pool_submit_token()으로 작업에 붙인다. 토큰 하나를 여러 작업에
+ * 붙일 수 있으며, 토큰은 붙인 작업이 모두 끝날 때까지 살아 있어야 한다.
+ * pthread_pool_token_cancel()로 취소하거나 pthread_pool_token_deadline()으로 정한 기한이 지나면 토큰이 만료되고,
+ * 일꾼은 만료된 토큰이 붙은 작업을 꺼내면 실행하지 않고 버린다. 이미 실행 중인 작업은 멈추지 않으므로
+ * 오래 걸리는 작업은 중간중간 pthread_pool_canceled()로 자기 토큰이 만료되었는지 확인하고 스스로 그만두어야 한다.
+ * deadline은 CLOCK_MONOTONIC 기준의 나노초이며 0이면 기한이 없다.
+ */
+typedef struct {
+    atomic_bool canceled;       /* 취소되었으면 true */
+    atomic_long deadline;       /* 기한, 0이면 기한 없음 */
+} pool_token_t;
+
+/*
+ * 여러 작업을 묶어서 한꺼번에 끝나기를 기다리는 작업 그룹 구조체 타입
+ *
+ * pthread_pool_group_init()으로 초기화하고 pthread_pool_group_submit()으로 작업을 추가한 뒤
+ * pthread_pool_group_wait()으로 모두 끝나기를 기다린다. 기다리는 동안 스레드풀의 작업을 대신 실행한다.
+ * pending은 아직 끝나지 않은 작업의 수이다. 그룹은 wait이 끝난 뒤 다시 사용할 수 있다.
+ * token은 그룹의 모든 작업에 붙는 취소 토큰이다. pthread_pool_group_cancel()로 취소하면 아직 시작하지 않은 작업은
+ * 실행하지 않고 끝난 것으로 센다. 기한을 두려면 pthread_pool_token_deadline()에 token의 주소를 넘긴다.
+ */
+typedef struct {
+    struct pthread_pool *pool;  /* 그룹의 작업을 실행할 스레드풀 */
+    atomic_uint pending;        /* 아직 끝나지 않은 작업의 수 */
+    pool_token_t token;         /* 그룹의 작업에 붙는 취소 토큰 */
+} pool_group_t;
+
+/*
+ * 같은 스트랜드에 넣은 작업을 넣은 순서대로 하나씩 실행하는 직렬 실행기 구조체 타입
+ *
+ * pthread_pool_strand_init()으로 초기화하고 pthread_pool_strand_submit()으로 작업을 넣는다. 한 스트랜드의 작업은
+ * 넣은 순서대로 실행되며 둘이 동시에 실행되는 일이 없다. 스트랜드끼리는 스레드풀의 일꾼을 나눠 쓰므로
+ * 서로 다른 스트랜드의 작업은 동시에 실행될 수 있다.
+ * 스트랜드에 작업이 있으면 스레드풀에는 스트랜드를 실행하는 작업 하나만 들어간다. 이 작업은 한 번에 최대 batch개를
+ * 차례로 실행하고, 작업이 남아 있으면 자신을 다시 요청해 다른 작업에 차례를 넘긴다.
+ * buf는 아직 실행하지 않은 작업을 담는 크기 cap의 원형 버퍼로, 꽉 차면 두 배로 늘리며 mutex로 보호한다.
+ * active는 스트랜드를 실행하는 작업이 대기열에 있거나 실행 중이면 true이고, pending은 넣었지만 끝나지 않은 작업의 수이다.
+ * 다 쓴 스트랜드는 pthread_pool_strand_wait()으로 작업이 모두 끝나기를 기다린 뒤 pthread_pool_strand_destroy()로 정리한다.
+ */
+typedef struct {
+    struct pthread_pool *pool;  /* 스트랜드의 작업을 실행할 스레드풀 */
+    pthread_mutex_t mutex;      /* buf와 active를 보호하는 상호배타 락 */
+    task_t *buf;                /* 아직 실행하지 않은 작업을 담는 원형 버퍼 */
+    int cap;                    /* buf의 크기, 2의 거듭제곱 */
+    int head;                   /* 다음에 실행할 작업의 위치 */
+    int len;                    /* buf에 담긴 작업의 수 */
+    int batch;                  /* 한 번 차례를 얻었을 때 실행할 작업의 최대 수 */
+    bool active;                /* 스트랜드를 실행하는 작업이 있으면 true */
+    atomic_uint pending;        /* 넣었지만 아직 끝나지 않은 작업의 수 */
+} pool_strand_t;
+
 /*
  * 스레드풀을 운영하는데 필요한 정보를 저장하는 스레드풀 제어블록 구조체 타입
  *
  * running은 스레드풀이 현재 실행 또는 종료 상태임을 나타낸다.
  * 스레드풀의 FIFO 작업 대기열인 배열 q는 원형 버퍼의 역할을 한다.
- * q_size는 원형버퍼로 사용하는 배열 q의 방의 갯수를 의미한다.
- * q_front는 대기열에서 다음에 실행될 작업의 위치를 나타낸다.
- * q_len은 대기열의 길이를 나타낸다. q_len이 0이면 현재 대기하고 있는 작업이 없다는 뜻이다.
- * q_len의 값이 q_size이면 대기열이 차서 새 작업을 더 넣을 수 없는 상황을 의미한다.
- * bee는 작업을 수행하는 일꾼 스레드의 ID를 저장하는 배열이다.
- * bee_size는 배열 bee의 크기를 나타내며 일꾼 스레드의 갯수를 의미한다.
+ * q는 우선순위 단계마다 q_size개씩 나눠 쓰며, 단계별 대기열의 위치와 길이는 lane에 있다.
+ * NUMA 노드마다 대기열을 따로 두면 노드마다 q와 같은 공간을 하나씩 할당하며, q는 0번 노드의 공간을 가리킨다.
+ * q_size는 단계 하나의 원형버퍼로 사용하는 방의 갯수를 의미한다.
+ * q는 캐시 라인 경계에서 시작하고 방 하나가 task_t 하나이므로, 이웃한 방의 작업을 서로 다른 일꾼이 다뤄도 캐시 라인을 다투지 않는다.
+ * q_len은 모든 단계의 대기열 길이를 합한 값이다. q_len이 0이면 현재 대기하고 있는 작업이 없다는 뜻이다.
+ * 단계별 대기열의 길이가 q_size이면 그 단계가 차서 새 작업을 더 넣을 수 없는 상황을 의미한다.
+ * bee는 작업을 수행하는 일꾼 스레드의 ID를 저장하는 배열이다. 일꾼 수가 바뀔 수 있으므로 POOL_MAXBSIZE 크기로 잡는다.
+ * bee_size는 현재 일하고 있는 일꾼 스레드의 갯수를 의미한다. 일꾼은 항상 bee와 hive의 앞쪽 bee_size칸을 차지한다.
  * mutex는 대기열을 조회하거나 변경하기 위해 사용하는 상호배타 락이다.
  * full과 empty는 대기열에 작업이 채워지기를 또는 빈 자리가 생기기를 기다리는 조건 변수이다.
+ * sched는 작업 배분 방식이다. POOL_SCHED_STEAL이면 hive의 일꾼마다 하나씩 작업 덱이 있고,
+ * 대기열 q는 스레드풀 밖에서 들어오는 작업만 받는다. 일꾼이 요청한 작업은 자기 덱에 넣는다.
+ * idle은 할 일이 없어 잠든 일꾼의 수이며, 작업을 넣은 스레드가 깨울 대상이 있는지 확인할 때 쓴다.
+ * ring은 락 없는 대기열을 사용할 때 0단계의 원형 버퍼이며, 이때는 q와 q_len을 사용하지 않는다.
+ * 다른 단계의 원형 버퍼는 lane에 있다.
+ * 락 없는 대기열에서는 조건 변수 대신 notempty와 notfull을 futex로 기다린다. 대기열이 정말로 비었거나
+ * 꽉 찼을 때만 잠들며, blocked는 빈 자리를 기다리며 잠든 요청 스레드의 수이다.
+ * 락을 쓰는 대기열에서도 잠들기 전에 돌며 기다리도록 설정하면 notempty와 notfull을 바꿔 돌고 있는 쪽에 알린다.
+ * batch는 일꾼이 한 번에 가져오는 작업의 최대 수이다. discard는 POOL_DISCARD로 종료 중임을 나타내며,
+ * 일꾼은 이 값을 보고 미리 가져가 두었지만 아직 시작하지 않은 작업을 버린다.
+ * draining은 pthread_pool_shutdown_drain()이 일꾼에게 남은 작업을 맡기고 기다리는 중임을 나타낸다. 이때 일꾼은 잠들 때마다
+ * drain_seq를 바꿔 기다리는 쪽을 깨운다. discarded는 종료하면서 실행하지 않고 버린 작업의 수이다.
+ * fut_free는 다시 쓸 수 있는 작업 완료 핸들의 목록이고, fut_slab은 핸들을 묶음으로 할당한 공간의 목록이다.
+ * 두 목록은 fut_mutex로 보호한다.
+ * prio는 우선순위 단계의 수이고 lane은 단계마다 하나씩 두는 대기열의 배열이다.
+ * age는 작업이 남아 있는 낮은 단계가 높은 단계에 밀릴 수 있는 횟수이다.
+ * hive는 일꾼의 제어 블록을 가리키는 POOL_MAXBSIZE 크기의 표이다. 제어 블록은 그 자리에 처음 일꾼을 만들 때 할당하고,
+ * 일꾼이 물러나도 다른 일꾼이 읽고 있을 수 있으므로 종료할 때까지 두었다가 다시 쓴다.
+ * bee_target은 pthread_pool_resize()나 자동 조절이 정한 일꾼 수이다. bee_size가 이보다 크면
+ * 가장 마지막 일꾼부터 할 일이 없을 때 물러난다. bee_min, bee_max, grow_len, idle_ms는 자동 조절의 기준이며
+ * resize_mutex는 일꾼을 늘리거나 물러나게 할 때 잡는 상호배타 락이고,
+ * threads는 이 스레드풀의 일꾼을 맡고 있는 스레드의 수이다. 일꾼 스레드는 스레드 캐시에서 오므로 조인하지 않고,
+ * 종료할 때는 threads가 0이 되기를 기다린다. dormant는 lazy로 만들어 아직 일꾼을 시작하지 않았으면 true이다.
+ * wheel은 지연 작업과 주기 작업을 담는 타이머 휠이며 timer_mutex로 보호한다. timers는 휠에 있는 타이머의 수이고,
+ * timer_next는 휠에서 다음에 일이 생기는 시각(CLOCK_MONOTONIC 기준 밀리초)이다.
+ * 타이머가 있으면 잠든 일꾼 가운데 timer_keeper를 맡은 하나만 timer_next까지 시간 제한을 두고 잠든다.
+ * nodes는 공유 대기열을 나눠 둔 NUMA 노드의 수이며, lane은 노드마다 prio개씩 이어 붙인 배열이 된다.
+ * cpus는 일꾼을 묶을 ncpus개의 CPU 번호를 일꾼을 배치할 순서대로 담은 배열이고, 일꾼을 묶지 않으면 NULL이다.
+ * spin_ns와 yields는 잠들기 전에 돌며 기다릴 최대 시간과 양보할 횟수이다. 일꾼은 돌 시간을 저마다 정하고,
+ * 요청 스레드는 submit_gap(기다린 시간의 이동 평균)에서 정한 submit_spin_ns를 함께 쓴다.
+ * submit_waits는 요청 스레드의 기다림이 잠들기, 돌기, 양보하기로 끝난 횟수이다.
+ * stats는 작업마다 시각을 재는 통계를 모으는지를, q_high는 공유 대기열 길이의 최댓값을,
+ * rejected는 POOL_FULL로 거절한 작업의 수를 나타낸다. 일꾼마다 모으는 통계는 hive의 제어 블록에 있다.
+ * on_full, reject, reject_ctx는 속성에서 가져온 꽉 찬 대기열의 처리 방식과 버린 작업을 알려 줄 함수이다.
+ * caller_ran과 dropped는 POOL_CALLER_RUNS로 직접 실행한 작업과 POOL_DROP_OLDEST로 버린 작업의 수이고,
+ * canceled는 토큰이 만료되어 실행하지 않은 작업의 수이다.
+ * trace는 일꾼이 아닌 스레드의 사건을 남기는 기록 버퍼로, 사건을 남기지 않으면 NULL이다. 일꾼의 기록 버퍼는 hive의
+ * 제어 블록에 있고 버퍼마다 trace_size칸이다. trace_ns와 trace_tick은 스레드풀을 만들 때 잰 시각과 시계 값으로,
+ * 사건에 적은 시계 값을 나노초로 바꿀 때 쓴다.
+ * fiber_free는 다시 쓸 수 있는 파이버의 목록이고 fiber_all은 이 스레드풀이 만든 모든 파이버의 목록이며, 둘 다 fiber_mutex로
+ * 보호한다. 파이버의 스택은 한 번 만들면 종료할 때까지 다시 쓴다. fiber_stack은 파이버 하나의 스택 크기이다.
+ * io는 비동기 입출력을 처리하는 io_uring이나 입출력 스레드로, 처음 입출력을 요청할 때 resize_mutex를 잡고 만든다.
+ * io_threads는 io_uring을 쓸 수 없을 때 만들 입출력 스레드의 수이다.
+ * shared는 프로세스 전체의 공유 일꾼을 쓰는지를 나타내며, 이때 bee_size는 이 스레드풀의 작업을 동시에 실행할 공유 일꾼의
+ * 최대 수이다. weight, deficit, reserved, busy, tenant_next, tenant_prev는 공유 일꾼이 스레드풀을 고를 때 쓰며 공유 일꾼의 락으로 보호한다.
  */
-typedef struct {
-    bool running;           /* 스레드풀의 실행 또는 종료 상태 */
+typedef struct pthread_pool {
+    atomic_bool running;    /* 스레드풀의 실행 또는 종료 상태 */
     task_t *q;              /* FIFO 작업 대기열로 사용할 원형 버퍼 */
     int q_size;             /* 원형 버퍼 q 배열의 크기 */
-    int q_front;            /* 대기열에서 다음에 실행될 작업의 위치 */
-    int q_len;              /* 대기열의 길이, 0이면 현재 대기하고 있는 작업이 없다는 뜻 */
+    int q_len;              /* 모든 단계의 대기열 길이의 합, 0이면 현재 대기하고 있는 작업이 없다는 뜻 */
     pthread_t *bee;         /* 일꾼(일벌) 스레드의 ID를 저장하기 위한 배열 */
-    int bee_size;           /* bee 배열의 크기로 일꾼 스레드의 수를 의미 */
+    atomic_int bee_size;    /* 현재 일꾼 스레드의 수 */
     pthread_mutex_t mutex;  /* 대기열을 접근하기 위해 사용하는 상호배타 락 */
     pthread_cond_t full;    /* 빈 대기열에 새 작업이 들어올 때까지 기다리는 곳 */
     pthread_cond_t empty;   /* 대기열에 빈 자리가 발생할 때까지 기다리는 곳 */
+    int sched;              /* 작업 배분 방식, POOL_SCHED_FIFO 또는 POOL_SCHED_STEAL */
+    struct bee **hive;      /* 일꾼마다 하나씩 두는 작업 덱과 제어 정보를 가리키는 표 */
+    atomic_int idle;        /* 할 일이 없어 잠들어 있는 일꾼의 수 */
+    struct ring *ring;      /* 락 없는 대기열, POOL_QUEUE_LOCK이면 NULL */
+    atomic_uint notempty;   /* 락 없는 대기열에 작업이 들어올 때마다 바뀌는 futex 값 */
+    atomic_uint notfull;    /* 락 없는 대기열에 빈 자리가 생길 때마다 바뀌는 futex 값 */
+    atomic_int blocked;     /* 락 없는 대기열의 빈 자리를 기다리며 잠든 요청 스레드의 수 */
+    int batch;              /* 일꾼이 공유 대기열에서 한 번에 가져오는 작업의 최대 수 */
+    atomic_bool discard;    /* POOL_DISCARD로 종료 중이면 true */
+    atomic_bool draining;   /* 일꾼이 남은 작업을 마치기를 기다리는 중이면 true */
+    atomic_uint drain_seq;  /* 기다리는 동안 일꾼이 잠들 때마다 바뀌는 futex 값 */
+    atomic_ulong discarded; /* 종료하면서 버린 작업의 수 */
+    pthread_mutex_t fut_mutex;      /* 작업 완료 핸들 목록을 보호하는 상호배타 락 */
+    pool_future_t *fut_free;        /* 다시 쓸 수 있는 작업 완료 핸들의 목록 */
+    struct future_slab *fut_slab;   /* 작업 완료 핸들을 묶음으로 할당한 공간의 목록 */
+    int prio;               /* 우선순위 단계의 수 */
+    int age;                /* 낮은 단계가 밀릴 수 있는 횟수, 0이면 항상 높은 단계부터 */
+    struct pool_lane *lane; /* NUMA 노드와 우선순위 단계마다 하나씩 두는 대기열의 배열 */
+    atomic_int bee_target;  /* 맞추려는 일꾼의 수 */
+    int bee_min;            /* 자동 조절할 때 남겨 둘 일꾼의 최소 수 */
+    int bee_max;            /* 자동 조절할 때 늘릴 수 있는 일꾼의 최대 수, 0이면 자동 조절하지 않음 */
+    int grow_len;           /* 대기열의 길이가 이보다 길면 일꾼을 늘린다 */
+    int idle_ms;            /* 마지막 일꾼이 이만큼 할 일이 없으면 물러난다 */
+    pthread_mutex_t resize_mutex;   /* 일꾼을 늘리거나 물러나게 할 때 잡는 상호배타 락 */
+    atomic_uint threads;    /* 일꾼을 맡고 있는 스레드의 수 */
+    atomic_bool dormant;    /* 아직 일꾼을 시작하지 않았으면 true */
+    struct timer_wheel *wheel;      /* 지연 작업과 주기 작업을 담는 타이머 휠 */
+    pthread_mutex_t timer_mutex;    /* 타이머 휠을 보호하는 상호배타 락 */
+    atomic_int timers;              /* 휠에 있는 타이머의 수 */
+    atomic_ullong timer_next;       /* 휠에서 다음에 일이 생기는 시각 */
+    atomic_bool timer_keeper;       /* 타이머 시각에 맞춰 잠든 일꾼이 있으면 true */
+    int nodes;              /* 공유 대기열을 나눠 둔 NUMA 노드의 수 */
+    int affinity;           /* 일꾼을 CPU에 묶는 방식 */
+    int *cpus;              /* 일꾼을 배치할 순서대로 담은 CPU 번호의 배열, 묶지 않으면 NULL */
+    int ncpus;              /* cpus 배열의 길이 */
+    long spin_ns;           /* 잠들기 전에 돌며 기다릴 최대 시간(나노초), 0이면 돌지 않음 */
+    int yields;             /* 잠들기 전에 CPU를 양보할 횟수 */
+    atomic_long submit_gap;         /* 요청 스레드가 빈 자리를 기다린 시간의 이동 평균 */
+    atomic_long submit_spin_ns;     /* 요청 스레드가 돌며 기다릴 시간 */
+    atomic_ulong submit_waits[3];   /* 요청 스레드의 기다림이 끝난 단계별 횟수 */
+    bool stats;             /* 작업마다 시각을 재는 통계를 모으면 true */
+    atomic_int q_high;      /* 공유 대기열에 한꺼번에 쌓였던 작업 수의 최댓값 */
+    atomic_ulong rejected;  /* POOL_FULL로 거절한 작업의 수 */
+    int on_full;            /* POOL_BY_POLICY로 요청한 작업의 대기열이 꽉 찼을 때의 처리 방식 */
+    void (*reject)(void (*f)(void *p), void *p, void *ctx);    /* 버린 작업을 알려 줄 함수 */
+    void *reject_ctx;       /* reject에 넘길 값 */
+    atomic_ulong caller_ran;/* POOL_CALLER_RUNS로 요청한 스레드가 직접 실행한 작업의 수 */
+    atomic_ulong dropped;   /* POOL_DROP_OLDEST로 버린 작업의 수 */
+    atomic_ulong canceled;  /* 토큰이 만료되어 실행하지 않은 작업의 수 */
+    struct trace_buf *trace;/* 일꾼이 아닌 스레드의 사건을 남기는 기록 버퍼, 남기지 않으면 NULL */
+    int trace_size;         /* 기록 버퍼 하나의 칸 수, 2의 거듭제곱 */
+    long trace_ns;          /* 스레드풀을 만들 때의 시각(나노초) */
+    unsigned long long trace_tick;  /* 스레드풀을 만들 때의 시계 값 */
+    pthread_mutex_t fiber_mutex;    /* 파이버 목록을 보호하는 상호배타 락 */
+    struct pool_fiber *fiber_free;  /* 다시 쓸 수 있는 파이버의 목록 */
+    struct pool_fiber *fiber_all;   /* 이 스레드풀이 만든 모든 파이버의 목록 */
+    size_t fiber_stack;             /* 파이버 하나의 스택 크기, 보호 페이지는 빼고 페이지 단위로 올린 값 */
+    _Atomic(struct pool_io *) io;   /* 비동기 입출력을 처리하는 곳, 아직 입출력을 요청하지 않았으면 NULL */
+    int io_threads;                 /* io_uring을 쓸 수 없을 때 만들 입출력 스레드의 수 */
+    bool shared;                    /* 공유 일꾼을 쓰면 true */
+    int weight;                     /* 차례마다 실행할 작업의 수 */
+    int deficit;                    /* 이번 차례에 더 실행할 수 있는 작업의 수 */
+    int reserved;                   /* 공유 일꾼이 deficit에서 미리 빼 두고 아직 치르지 않은 작업의 수 */
+    int busy;                       /* 이 스레드풀의 작업을 실행 중인 공유 일꾼의 수 */
+    struct pthread_pool *tenant_next;   /* 공유 일꾼을 쓰는 스레드풀의 원형 목록에서 다음, 빠졌으면 NULL */
+    struct pthread_pool *tenant_prev;   /* 원형 목록에서 앞 */
 } pthread_pool_t;
 
+int pthread_pool_attr_init(pthread_pool_attr_t *attr);
 int pthread_pool_init(pthread_pool_t *pool, size_t bee_size, size_t queue_size);
+int pthread_pool_init_attr(pthread_pool_t *pool, size_t bee_size, size_t queue_size, const pthread_pool_attr_t *attr);
 int pthread_pool_submit(pthread_pool_t *pool, void (*f)(void *p), void *p, int flag);
+int pthread_pool_submit_prio(pthread_pool_t *pool, void (*f)(void *p), void *p, int prio, int flag);
+int pthread_pool_submit_inline(pthread_pool_t *pool, void (*f)(void *p), const void *arg, size_t size, int flag);
+size_t pthread_pool_submit_batch(pthread_pool_t *pool, task_t *tasks, size_t n, int flag);
+int pthread_pool_submit_future(pthread_pool_t *pool, void (*f)(void *p), void *p, int flag, pool_future_t **future);
+int pthread_pool_future_wait(pool_future_t *future);
+int pthread_pool_future_timedwait(pool_future_t *future, const struct timespec *abstime);
+bool pthread_pool_future_poll(pool_future_t *future);
+void pthread_pool_future_release(pool_future_t *future);
+int pthread_pool_future_then(pool_future_t *future, void (*f)(void *p), void *p, pool_future_t **next);
+int pthread_pool_group_init(pool_group_t *group, pthread_pool_t *pool);
+int pthread_pool_group_submit(pool_group_t *group, void (*f)(void *p), void *p);
+int pthread_pool_group_wait(pool_group_t *group);
+int pthread_pool_group_cancel(pool_group_t *group);
+int pthread_pool_token_init(pool_token_t *token);
+int pthread_pool_token_cancel(pool_token_t *token);
+int pthread_pool_token_deadline(pool_token_t *token, unsigned long timeout_ms);
+bool pthread_pool_token_expired(pool_token_t *token);
+bool pthread_pool_canceled(void);
+int pthread_pool_submit_token(pthread_pool_t *pool, void (*f)(void *p), void *p, pool_token_t *token, int flag);
+int pthread_pool_submit_fiber(pthread_pool_t *pool, void (*f)(void *p), void *p, int flag);
+int pthread_pool_yield(void);
+int pthread_pool_io_read(pthread_pool_t *pool, int fd, void *buf, size_t len, off_t offset,
+                        void (*done)(void *p, long res), void *p);
+int pthread_pool_io_write(pthread_pool_t *pool, int fd, const void *buf, size_t len, off_t offset,
+                         void (*done)(void *p, long res), void *p);
+int pthread_pool_io_fsync(pthread_pool_t *pool, int fd, void (*done)(void *p, long res), void *p);
+int pthread_pool_strand_init(pool_strand_t *strand, pthread_pool_t *pool, int batch);
+int pthread_pool_strand_submit(pool_strand_t *strand, void (*f)(void *p), void *p);
+int pthread_pool_strand_wait(pool_strand_t *strand);
+int pthread_pool_strand_destroy(pool_strand_t *strand);
+int pthread_pool_parallel_for(pthread_pool_t *pool, long begin, long end, long grain,
+                              void (*fn)(void *ctx, long begin, long end), void *ctx);
+int pthread_pool_parallel_reduce(pthread_pool_t *pool, long begin, long end, long grain,
+                                 void (*fn)(void *ctx, long begin, long end, void *acc),
+                                 void (*join)(void *ctx, void *acc, const void *other),
+                                 void *result, size_t size, void *ctx);
+int pthread_pool_schedule_after(pthread_pool_t *pool, unsigned long delay_ms, void (*f)(void *p), void *p,
+                                pool_timer_t **timer);
+int pthread_pool_schedule_every(pthread_pool_t *pool, unsigned long delay_ms, unsigned long period_ms,
+                                void (*f)(void *p), void *p, pool_timer_t **timer);
+int pthread_pool_timer_cancel(pool_timer_t *timer);
+int pthread_pool_resize(pthread_pool_t *pool, size_t bee_size);
+int pthread_pool_wait_stats(pthread_pool_t *pool, pool_wait_stats_t *stats);
+int pthread_pool_stats(pthread_pool_t *pool, pool_stats_t *stats);
+unsigned long pthread_pool_hist_value(int bucket);
+unsigned long pthread_pool_hist_percentile(const unsigned long *hist, double p);
+int pthread_pool_trace_dump(pthread_pool_t *pool, const char *path);
 int pthread_pool_shutdown(pthread_pool_t *pool, int how);
+int pthread_pool_shutdown_drain(pthread_pool_t *pool, const struct timespec *abstime, size_t *left);
 
 #endif